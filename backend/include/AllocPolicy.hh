@@ -0,0 +1,40 @@
+#ifndef semalloc_ALLOCPOLICY_HH
+#define semalloc_ALLOCPOLICY_HH
+#include "defines.hh"
+
+// optional work of the malloc and free fast paths, each off when no option asks for it
+enum ALLOC_FEATURE {
+    ALLOC_COUNTED = 1,      // the STAT counters of mallocs and frees: stat, live_stats or profile
+    ALLOC_LAZY = 2,         // the lazy pool and the site policies decide where a loop CSI goes
+    ALLOC_BUDGETED = 4,     // the memory budget is polled
+    ALLOC_TIMED = 8,        // one of LATENCY_SAMPLE_PERIOD calls is timed: latency
+};
+#define ALLOC_VARIANT_N 16
+
+/**
+ * The allocation core (MemoryManager::mallocMemory, freeRegularMemory) is written once against
+ * a policy and instantiated for every variant, so the fast path of the variant the options pick
+ * carries no test for a feature it does not have. css_malloc and css_free are bound to their
+ * variant on the first call, see semalloc.cc; every other path takes the runtime policy, which
+ * tests the features the manager was set up with.
+ */
+template<uint32_t Variant>
+struct fixed_policy_t {
+    static bool on(uint32_t, uint32_t feature) {
+        return Variant & feature;
+    }
+};
+
+struct runtime_policy_t {
+    static bool on(uint32_t variant, uint32_t feature) {
+        return variant & feature;
+    }
+};
+
+class AllocPolicy {
+public:
+    // the variant of the process, from the options, which must be read already
+    static uint32_t Select();
+};
+
+#endif //semalloc_ALLOCPOLICY_HH
@@ -0,0 +1,74 @@
+#ifndef semalloc_CSIDIRECTORY_HH
+#define semalloc_CSIDIRECTORY_HH
+#include <atomic>
+#include "defines.hh"
+
+// a wide context is laid out like the upper half of a narrow size, with the CSTV not cut to 16 bits
+#define WIDE_CONTEXT_CSTV_MASK  0x0000FFFFFFFFFFFFUL
+#define WIDE_CONTEXT_RH_MASK    CSI_RH_BITMASK
+#define WIDE_CONTEXT_LOOP_BIT   CSI_LOOP_BIT_MASK
+#define WIDE_CONTEXT_KEY(context) (((context) & ~WIDE_CONTEXT_LOOP_BIT) | 0x8000000000000000UL) // 0 marks an empty slot
+
+#define WIDE_CSI_BASE (1U << 30) // wide CSIs are handed out from here, above the 30 bits of a narrow one
+#define CSI_DIRECTORY_ROOT_BIT 10
+#define CSI_DIRECTORY_LEAF_BIT 12
+#define CSI_DIRECTORY_PROBE_N 16 // slots of a leaf tried before a context falls back to its narrow CSI
+
+struct csi_directory_slot_t {
+    std::atomic<uint64_t> key;
+    std::atomic<uint32_t> CSI; // 0 until the inserting thread has numbered the context
+    uint32_t unused;
+};
+
+typedef struct {
+    size_t contexts;        // distinct contexts given a wide CSI
+    size_t narrowShared;    // of them, contexts whose narrow CSI an earlier context already had
+    size_t overflowN;       // contexts that found no slot and kept their narrow CSI
+} semalloc_csi_directory_stats_t;
+
+/**
+ * The wide-CSI convention (css_malloc_wide and friends) passes the site as a separate 64-bit
+ * context instead of the upper 32 bits of the size, so requests are not capped at 4 GiB and the
+ * CSTV keeps 48 bits instead of 16. The directory numbers every distinct context densely from
+ * WIDE_CSI_BASE; the dense CSI then goes through the managers as any other CSI, and since
+ * consecutive numbers hash to consecutive BIBOP slots, the first INDIVIDUAL_BIBOP_MAX_N sites
+ * never share or probe. A narrow CSI has 30 bits (the CSTV and the recursion hash above it), so
+ * it never reaches the dense range.
+ *
+ * A lookup is two loads, like a page table: the top CSI_DIRECTORY_ROOT_BIT bits of the mixed
+ * context pick a leaf, the next CSI_DIRECTORY_LEAF_BIT bits a slot in it, and at most
+ * CSI_DIRECTORY_PROBE_N slots are tried from there. Leaves are mapped on first use and never
+ * freed; slots are claimed with a CAS on the key, so the directory needs no lock.
+ *
+ * Every new context also marks its narrow CSI in a bitmap, so the stats tell how many sites the
+ * 30-bit encoding would have merged.
+ */
+class CSIDirectory {
+private:
+    static std::atomic<csi_directory_slot_t*> root[1 << CSI_DIRECTORY_ROOT_BIT];
+    static std::atomic<uint32_t> nextCSI;
+    static std::atomic<size_t> narrowShared;
+    static std::atomic<size_t> overflowN;
+    static std::atomic<uint64_t*> narrowSeen;
+
+    static csi_directory_slot_t* leaf(size_t index);
+    static uint32_t insert(csi_directory_slot_t* slot, uint64_t key, uint64_t context);
+    static void markNarrow(uint32_t CSI);
+
+    // a context without a slot shares its narrow CSI, never a dense one
+    static uint32_t fallback(uint64_t context) {
+        return narrow(context);
+    }
+
+public:
+    // the CSI the narrow encoding gives the context
+    static uint32_t narrow(uint64_t context) {
+        return (uint32_t)(context & 0xFFFF) | (uint32_t)((context & WIDE_CONTEXT_RH_MASK) >> 32);
+    }
+
+    static uint32_t lookup(uint64_t context);
+
+    static void getStats(semalloc_csi_directory_stats_t* stats);
+};
+
+#endif //semalloc_CSIDIRECTORY_HH
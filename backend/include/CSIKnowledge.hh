@@ -0,0 +1,53 @@
+#ifndef semalloc_CSIKNOWLEDGE_HH
+#define semalloc_CSIKNOWLEDGE_HH
+#include <atomic>
+#include "defines.hh"
+#include "hash.h"
+
+#define CSI_KNOWLEDGE_N (1 << 16)
+#define CSI_KNOWLEDGE_KEY(CSI) ((uint32_t)(CSI) | 0x80000000U) // 0 marks an empty slot
+
+/**
+ * What the threads learnt about each loop CSI, shared so a new thread skips the lazy warm-up
+ * of the sites others already promoted. It only holds decisions; every thread still allocates
+ * from its own BIBOPs.
+ *
+ * Entries are inserted with a CAS on the key and never removed. A demotion retracts the
+ * promotion and counts itself, so new threads warm the site up again, with the backoff the
+ * demotions so far earned. The state is written on promotion and demotion only, so the table is
+ * read-mostly and needs no lock.
+ */
+struct csi_knowledge_t {
+    std::atomic<uint32_t> key;
+    std::atomic<uint8_t> sizeClass;
+    std::atomic<uint8_t> promoted;
+    std::atomic<uint8_t> demotions;
+    uint8_t unused;
+};
+
+class CSIKnowledge {
+private:
+    static csi_knowledge_t table[CSI_KNOWLEDGE_N];
+
+    static csi_knowledge_t* find(size_t CSI, bool insert);
+
+public:
+    // true if another thread promoted the CSI with objects of the same size class
+    static bool isPromoted(size_t CSI, size_t sizeClass) {
+        csi_knowledge_t* entry = find(CSI, false);
+        return entry != nullptr &&
+               entry->promoted.load(std::memory_order_acquire) &&
+               entry->sizeClass.load(std::memory_order_relaxed) == sizeClass;
+    }
+
+    // the demotions of the CSI over all threads, up to UINT8_MAX
+    static uint8_t demotions(size_t CSI) {
+        csi_knowledge_t* entry = find(CSI, false);
+        return entry != nullptr ? entry->demotions.load(std::memory_order_relaxed) : 0;
+    }
+
+    static void publishPromotion(size_t CSI, size_t realSize, size_t sizeClass);
+    static void publishDemotion(size_t CSI);
+};
+
+#endif //semalloc_CSIKNOWLEDGE_HH
@@ -0,0 +1,60 @@
+#ifndef semalloc_CALLSITE_HH
+#define semalloc_CALLSITE_HH
+#include "defines.hh"
+#include "Options.hh"
+
+#define AUTO_CSI_MAX_FRAMES 4                       // the return address and three hops
+#define AUTO_CSI_MULTIPLIER 0x9E3779B97F4A7C15UL    // 2^64 / golden ratio
+
+extern __thread uintptr_t callSiteStackTop; // 0 until the thread's stack is known, then no hop is taken
+extern __thread uintptr_t callSiteStackBottom;
+
+/**
+ * CSIs for binaries that did not go through the analyzer. With SEMALLOC_OPTIONS=auto_csi=FRAMES
+ * the malloc and new entry points (GLIBC_OVERRIDE) give every size without CSI bits the loop bit
+ * and a CSI hashed from the return address and FRAMES - 1 frame-pointer hops above it, at most
+ * AUTO_CSI_MAX_FRAMES. Whether a site is really in a loop is left to the lazy pool: it is promoted
+ * only once it repeats LAZY_PROMOTE_COUNT times in a window, so auto_csi keeps the lazy loop on.
+ *
+ * Code built without frame pointers leaves anything in its frame-pointer register; a hop is only
+ * taken to an aligned address above the last one and inside the thread's stack, so a bad chain
+ * costs a less stable CSI, not a fault.
+ */
+class CallSite {
+public:
+    static void InitThread();
+
+    static inline size_t tag(size_t size, void* returnAddress, void* frame) {
+        uint32_t frames = semallocOptions.autoCSI;
+        if (__builtin_expect(frames == 0, 1) || (size >> 32) != 0) {
+            return size;
+        }
+        return size | CSI_LOOP_BIT_MASK | ((size_t)hashFrames(frames, returnAddress, frame) << 32);
+    }
+
+private:
+    static inline uint32_t hashFrames(uint32_t frames, void* returnAddress, void* frame) {
+        uint64_t hash = (uint64_t)returnAddress * AUTO_CSI_MULTIPLIER;
+
+        // a frame record is {the caller's frame pointer, the return address} on x86-64 and aarch64
+        auto* record = (uintptr_t*)frame;
+        uintptr_t top = callSiteStackTop;
+        uintptr_t bottom = callSiteStackBottom;
+        if ((uintptr_t)record < bottom || (uintptr_t)record + 2 * sizeof(uintptr_t) > top) {
+            frames = 1;
+        }
+        for (uint32_t i = 1; i < frames; i++) {
+            uintptr_t next = record[0];
+            if (next <= (uintptr_t)record || next < bottom || next + 2 * sizeof(uintptr_t) > top || (next & 7)) {
+                break;
+            }
+            record = (uintptr_t*)next;
+            hash = (hash ^ record[1]) * AUTO_CSI_MULTIPLIER;
+        }
+
+        auto CSI = (uint32_t)(hash >> 34);
+        return CSI ? CSI : 1;
+    }
+};
+
+#endif //semalloc_CALLSITE_HH
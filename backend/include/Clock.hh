@@ -0,0 +1,45 @@
+#ifndef semalloc_CLOCK_HH
+#define semalloc_CLOCK_HH
+#include <ctime>
+#include "defines.hh"
+#ifdef __x86_64__
+#include <x86intrin.h>
+#endif
+
+static inline uint64_t readTSC() {
+#if defined(__x86_64__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t tsc;
+    __asm__ volatile ("mrs %0, cntvct_el0" : "=r" (tsc));
+    return tsc;
+#else
+    return 0;
+#endif
+}
+
+static inline uint64_t nowNs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000UL + now.tv_nsec;
+}
+
+// the TSC rate, measured against the monotonic clock since the options were read
+class Clock {
+private:
+    static uint64_t startTSC;
+    static uint64_t startNs;
+
+public:
+    static void InitClock() {
+        startTSC = readTSC();
+        startNs = nowNs();
+    }
+
+    static uint64_t tscHz() {
+        uint64_t elapsedNs = nowNs() - startNs;
+        return elapsedNs ? (uint64_t)((double)(readTSC() - startTSC) * 1e9 / (double)elapsedNs) : 0;
+    }
+};
+
+#endif //semalloc_CLOCK_HH
@@ -0,0 +1,77 @@
+#ifndef semalloc_DUMPWRITER_HH
+#define semalloc_DUMPWRITER_HH
+#include <cerrno>
+#include <cinttypes>
+#include <unistd.h>
+
+// buffered write(2) for the profile dumps, which must not allocate
+struct dump_writer_t {
+    int fd;
+    size_t n;
+    char buffer[4096];
+
+    void flush() {
+        for (size_t done = 0; done < n;) {
+            ssize_t written = write(fd, buffer + done, n - done);
+            if (written <= 0 && errno != EINTR) {
+                break;
+            }
+            done += written > 0 ? written : 0;
+        }
+        n = 0;
+    }
+
+    void put(const char* text) {
+        for (; *text; text++) {
+            if (n == sizeof buffer) {
+                flush();
+            }
+            buffer[n++] = *text;
+        }
+    }
+
+    void putBytes(const char* data, size_t length) {
+        for (size_t i = 0; i < length; i++) {
+            if (n == sizeof buffer) {
+                flush();
+            }
+            buffer[n++] = data[i];
+        }
+    }
+
+    void putNumber(int64_t value) {
+        char digits[24];
+        char* c = digits + sizeof digits;
+        *--c = 0;
+        uint64_t magnitude = value < 0 ? -(uint64_t)value : value;
+        do {
+            *--c = (char)('0' + magnitude % 10);
+            magnitude /= 10;
+        } while (magnitude);
+        if (value < 0) {
+            *--c = '-';
+        }
+        put(c);
+    }
+
+    void putHex(uint64_t value) {
+        char digits[24];
+        char* c = digits + sizeof digits;
+        *--c = 0;
+        do {
+            *--c = "0123456789abcdef"[value & 0xF];
+            value >>= 4;
+        } while (value);
+        put("0x");
+        put(c);
+    }
+
+    void putField(const char* name, int64_t value) {
+        put(",\"");
+        put(name);
+        put("\":");
+        putNumber(value);
+    }
+};
+
+#endif //semalloc_DUMPWRITER_HH
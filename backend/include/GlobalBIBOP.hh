@@ -5,23 +5,67 @@
 #ifndef semalloc_GLOBALBIBOP_HH
 #define semalloc_GLOBALBIBOP_HH
 #include "BIBOP.hh"
+#include "MemoryPool.hh"
+#include "Options.hh"
 
 class GlobalBIBOP: public BIBOP {
+private:
+    void* regions[GLOBAL_BAG_N]; // the first chunk of every bag
+    size_t regionSize;
+
 public:
-    void InitGlobalBIBOP() {
+    void InitGlobalBIBOP(size_t colorIndex, const bibop_options_t* options) {
 
         for (int i = 0; i < GLOBAL_BAG_N; i++) {
+#ifdef BITMAP_FREE_TRACKING
+            // bitmap chunks are found by masking the object address, so they are aligned to their size
+            size_t capacity = options->chunkSize;
+            void* data = MemoryPool::ReserveAligned(capacity, capacity);
+#else
             void* data = mmap(nullptr, GLOBAL_SINGLE_BIBOP_SIZE, PROT_READ | PROT_WRITE,
-                              MAP_PRIVATE | MAP_ANON, -1, 0);
+                              MAP_PRIVATE | MAP_ANON | MAP_NORESERVE, -1, 0);
+            size_t capacity = GLOBAL_SINGLE_BIBOP_SIZE;
+#endif
+            regions[i] = data;
+            regionSize = capacity;
+#ifdef BIBOP_COLORING
+            objects[i] = SingleBIBOP::AllocateSingleBIBOP(
+                    (uint64_t) data, MIN_BAG_SIZE << i, capacity, options,
+                    semallocOptions.coloring ? BIBOP_COLOR(colorIndex + i) : 0);
+#else
             objects[i] = SingleBIBOP::AllocateSingleBIBOP(
-                    (uint64_t) data, MIN_BAG_SIZE << i, GLOBAL_SINGLE_BIBOP_SIZE);
+                    (uint64_t) data, MIN_BAG_SIZE << i, capacity, options);
+#endif
             Debug("Index: %d, size: %d\n", i, MIN_BAG_SIZE << i);
         }
 
         bibopType = GLOBAL_BIBOP;
     }
 
+    void* getRegion(int index) {
+        return regions[index];
+    }
+
+    SingleBIBOP* getBag(size_t index) {
+        return objects[index];
+    }
+
+    void accountUsage(usage_t* usage) {
+        for (auto* bag : objects) {
+            bag->accountUsage(usage);
+        }
+    }
+
+    size_t trim() {
+        size_t released = 0;
+        for (auto* bag : objects) {
+            released += bag->trim();
+        }
+        return released;
+    }
+
     void freeGlobalObject(void *ptr);
+    void DestroyGlobalBIBOP();
 };
 
 #endif //semalloc_GLOBALBIBOP_HH
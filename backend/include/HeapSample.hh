@@ -0,0 +1,51 @@
+#ifndef semalloc_HEAPSAMPLE_HH
+#define semalloc_HEAPSAMPLE_HH
+#include "defines.hh"
+
+#define HEAP_SAMPLE_N (1 << 16)     // live samples at most, more are dropped
+#define HEAP_BUCKET_N (1 << 14)     // distinct stacks and CSIs
+#define HEAP_SAMPLE_DEPTH 32
+
+/**
+ * Sampled heap profile, on with SEMALLOC_OPTIONS=heap_profile=PATH. Every manager counts the
+ * bytes it hands out down from a random, exponentially distributed interval of
+ * sample_interval bytes on average; the allocation that crosses zero is sampled with its CSI
+ * and a frame-pointer stack, and its header is marked so its free retires the sample.
+ *
+ * Samples are grouped per stack and CSI into buckets that keep the live and the cumulative
+ * counts. The profile is written in the legacy pprof heap_v2 text format, live as in-use and
+ * cumulative as allocated space, at exit, on SIGUSR2 and by semalloc_heap_profile_dump(); the
+ * CSI of a bucket follows its stack as a comment. Stacks need frame pointers in the callers.
+ */
+struct heap_bucket_t {
+    uint64_t hash;              // 0 marks an empty bucket, published last
+    uint32_t CSI;
+    uint32_t depth;
+    size_t allocN;
+    size_t allocBytes;
+    size_t liveN;
+    size_t liveBytes;
+    uint64_t stack[HEAP_SAMPLE_DEPTH];
+};
+
+class HeapSampler {
+public:
+    static bool enabled;
+
+    static void InitHeapSampler();
+
+    // bytes until the next sample, drawn from the seed of the manager
+    static int64_t nextInterval(uint64_t* seed);
+
+    // headerAddress is the header at the start of the slot, or of the huge mapping
+    // false if the sample table is full
+    static bool sample(void* headerAddress, size_t size, size_t CSI, uint16_t owner);
+    static void release(void* headerAddress);
+    // drops the samples of a heap being destroyed
+    static void releaseOwner(uint16_t owner);
+
+    // no allocation, it also runs on the dump thread SIGUSR2 wakes
+    static bool Dump(const char* path);
+};
+
+#endif //semalloc_HEAPSAMPLE_HH
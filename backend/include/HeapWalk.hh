@@ -0,0 +1,45 @@
+#ifndef semalloc_HEAPWALK_HH
+#define semalloc_HEAPWALK_HH
+#include "defines.hh"
+
+#define WALK_WINDOW_PAGES 4096      // pages asked to mincore at once
+#define FRAG_SITE_N 4096            // CSIs the fragmentation report tells apart
+
+// one chunk of a global bag or of an individual BIBOP, as the walk passes it to the callback
+struct semalloc_walk_chunk_t {
+    const void* bibop;          // the SingleBIBOP, every BIBOP's chunks come one after the other
+    void* start;                // the first slot
+    void* end;                  // the end of the carved slots
+    size_t slotSize;            // headers included
+    size_t resident;            // bytes of the pages of [start, end) in memory
+    uint32_t CSI;               // 0 for a global bag
+    uint16_t manager;
+    uint8_t individual;
+};
+
+// called for every carved slot in address order, ptr is what malloc returned for it;
+// a non-zero return ends the walk
+typedef int (*semalloc_walk_callback)(const semalloc_walk_chunk_t* chunk, void* ptr, int allocated, void* arg);
+
+/**
+ * Heap walk over the chunks every BIBOP recorded, reading the state of a slot from the
+ * allocated bit of the header at its start. Slots on pages that are not resident were purged
+ * or never written, so they are free and the walk does not fault them in. Huge objects are
+ * not walked, css_usage() counts them.
+ *
+ * Nothing is stopped: the walk reads other threads' BIBOPs as they change, so a slot
+ * allocated or freed meanwhile may show either state. It allocates nothing and only pins the
+ * managers, so a heap destroyed meanwhile waits for the walk to finish. SIGUSR2 runs it on the
+ * dump thread, not in the handler.
+ *
+ * The fragmentation report, on with SEMALLOC_OPTIONS=frag_report=PATH (at exit, on SIGUSR2)
+ * or from semalloc_fragmentation_report(), puts occupancy and resident bytes per BIBOP, per
+ * size class and per CSI side by side, as JSON.
+ */
+class HeapWalk {
+public:
+    static int Walk(semalloc_walk_callback callback, void* arg);
+    static bool Report(const char* path);
+};
+
+#endif //semalloc_HEAPWALK_HH
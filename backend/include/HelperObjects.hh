@@ -9,8 +9,10 @@
 
 struct HugeHeader {
     size_t size; // 8
-    char unused[7]; // 7
-    unsigned char controlByte; // 0: regular, 1: huge 00000000; 00000001
+    uint16_t heap; // 2, owning heap, 0 if the mapping belongs to no heap
+    char site[4]; // 4, allocating CSI, unaligned
+    char unused[1]; // 1
+    unsigned char controlByte; // 0: regular, 1: huge 00000000; 00000001; 0x10: sampled
 
     void setHuge() {
         controlByte ^= (unsigned char)0x01;
@@ -19,13 +21,36 @@ struct HugeHeader {
     bool isHuge() {
         return controlByte & (unsigned char)0x01;
     }
+
+    void setSampled() {
+        controlByte |= (unsigned char)0x10;
+    }
+
+    bool isSampled() {
+        return controlByte & (unsigned char)0x10;
+    }
+
+    void setSite(uint32_t CSI) {
+        memcpy(site, &CSI, sizeof CSI);
+    }
+
+    uint32_t getSite() {
+        uint32_t CSI;
+        memcpy(&CSI, site, sizeof CSI);
+        return CSI;
+    }
 };
 
 struct RegularHeader {
     void* bibop; // 8
-    uint32_t memalign_offset; // 4
+    union {
+        uint32_t memalign_offset; // 4, header of an aligned object: bytes back to its slot
+        uint32_t CSI; // 4, header at the start of a slot: the allocating CSI
+    };
     uint16_t thread_id; // 2
-    // .....ABT
+    // ...SMABT
+    // S: 1 if the heap sampler holds a sample of the object
+    // M: 0 at the start of its slot; 1 moved up by memalign
     // A: 0 not allocated; 1 allocated
     // B: 0 individual; 1 global
     // T: 0 regular; 1 huge
@@ -40,24 +65,50 @@ struct RegularHeader {
     }
 
     void setGlobal() {
-        controlByte ^= (unsigned char)0x02;
+        controlByte |= (unsigned char)0x02;
     }
 
     void setIndividual() {
         controlByte &= (unsigned char)0xFD;
     }
 
+    bool isGlobal() {
+        return controlByte & (unsigned char)0x02;
+    }
+
     void setAllocation() {
-        controlByte ^= (unsigned char)0x04;
+        controlByte |= (unsigned char)0x04;
     }
 
+    // a free object is no sample either
     void setFree() {
-        controlByte &= (unsigned char)0xFB;
+        controlByte &= (unsigned char)0xEB;
     }
 
     bool isAllocation() {
         return controlByte & (unsigned char)0x04;
     }
+
+    void setAligned() {
+        controlByte |= (unsigned char)0x08;
+    }
+
+    bool isAligned() {
+        return controlByte & (unsigned char)0x08;
+    }
+
+    void setSampled() {
+        controlByte |= (unsigned char)0x10;
+    }
+
+    bool isSampled() {
+        return controlByte & (unsigned char)0x10;
+    }
+
+    // the header at the start of the slot, the one the allocation wrote
+    RegularHeader* slot() {
+        return isAligned() ? (RegularHeader*)((uint64_t)this - memalign_offset) : this;
+    }
 };
 
 // size 16
@@ -74,5 +125,25 @@ struct ListElement{
     ListElement* nxt;
 };
 
+// at the start of the first page of a huge mapping owned by a heap
+struct HugeLink {
+    HugeLink* prev;
+    HugeLink* nxt;
+};
+
+// bytes of one kind of storage, headers included; arena is what the bump pointers carved out
+struct usage_t {
+    size_t arena;
+    size_t inUse;
+    size_t free;
+    size_t blocks; // free slots, or mappings for the huge ones
+};
+
+struct semalloc_usage_t {
+    usage_t global;
+    usage_t individual;
+    usage_t huge;
+};
+
 
 #endif
\ No newline at end of file
@@ -7,17 +7,55 @@
 #include "BIBOP.hh"
 
 class IndividualBIBOP: public SingleBIBOP {
+private:
+    uint32_t policy; // SITE_POLICY of the CSI
+    uint32_t CSI;
 
 public:
-    void InitIndividualBIBOP(uint64_t _base, size_t _objectSize, size_t _capacity) {
-        bump = _base;
-        base = _base;
+    IndividualBIBOP* nextBIBOP; // all individual BIBOPs of a manager, newest first
+
+    void InitIndividualBIBOP(uint64_t _base, size_t _objectSize, size_t _capacity, const bibop_options_t* _options,
+                             size_t _color, uint32_t _policy, uint32_t _CSI) {
+        policy = _policy;
+        CSI = _CSI;
         objectSize = _objectSize + HEADER_SIZE;
+        options = *_options;
         freeList.nxt = nullptr;
-        capacity = _capacity;
+        liveN = 0;
+        carvedN = 0;
+        chunks = nullptr;
+#ifdef BITMAP_FREE_TRACKING
+        partial = nullptr;
+#endif
+#ifdef NURSERY
+        initNursery(options.nursery != 0);
+#endif
+        InitChunk(_base, _capacity, _color);
+    }
+
+    // only individual BIBOPs can be nurseries, so the global bags never look at the nursery state
+    void* allocateIndividualObject() {
+#ifdef NURSERY
+        if (__builtin_expect(nurseryState != NURSERY_OFF, 0)) {
+            void* ptr = this->allocateNursery();
+            if (ptr != nullptr) {
+                return ptr;
+            }
+        }
+#endif
+        return this->allocateObject();
     }
 
-    void freeIndividualObject(void *ptr);
+    // global objects are freed through here too, global tells them apart
+    void freeIndividualObject(void *ptr, bool global);
+
+    uint32_t getPolicy() {
+        return policy;
+    }
+
+    uint32_t getCSI() {
+        return CSI;
+    }
 };
 
 
@@ -0,0 +1,100 @@
+#ifndef semalloc_LIVESTATS_HH
+#define semalloc_LIVESTATS_HH
+#include <atomic>
+#include "defines.hh"
+#include "HelperObjects.hh"
+
+#define LIVE_STATS_MAGIC "SEMLIVE1"
+#define LIVE_SITE_N 64              // CSIs in the page, the ones with the most bytes in use
+#define LIVE_SITE_SCRATCH_N 4096    // CSIs the publisher can tell apart
+
+/**
+ * Live statistics, on with SEMALLOC_OPTIONS=live_stats=MS. Every MS milliseconds a publisher
+ * thread sums the counters of the managers into a page of the shared-memory segment
+ * /semalloc.<pid> (so /dev/shm/semalloc.<pid>), which semalloc-top and anyone else can map
+ * read-only. The segment is unlinked at exit; one left by a crash belongs to a dead pid.
+ *
+ * The page is written under a seqlock: seq is odd while the publisher writes, readers copy
+ * the page and retry if seq was odd or changed, see liveStatsRead(). Counters are cumulative,
+ * readers take rates from two copies and timeNs.
+ */
+struct live_thread_t {
+    uint16_t id;                // manager index, MAX_THREAD and up are heaps
+    uint16_t heap;
+    uint32_t unused;
+    size_t mallocN;
+    size_t freeN;               // by the owner
+    size_t remoteFreeN;         // by other threads, once drained
+    size_t remoteBacklog;       // pushed by other threads and not drained yet
+    size_t inUse;               // bytes of live objects, headers included
+    size_t arena;
+};
+
+struct live_bag_t {
+    size_t mallocN;
+    usage_t usage;              // the global bag and the individual BIBOPs of the size class
+};
+
+struct live_site_t {
+    uint32_t CSI;
+    uint32_t bibopN;
+    size_t inUse;               // in the individual BIBOPs of the CSI, global bag objects are not told apart
+    size_t arena;
+};
+
+struct live_page_t {
+    char magic[8];
+    uint32_t size;              // sizeof(live_page_t), to catch a reader of another version
+    uint32_t pid;
+    uint64_t seq;
+    uint64_t timeNs;            // CLOCK_MONOTONIC of the last update
+    uint32_t intervalMs;
+    uint32_t threadN;
+    uint32_t siteN;
+    uint32_t unused;
+    size_t rss;                 // of the whole process, from /proc/self/statm
+    semalloc_usage_t usage;
+    live_bag_t bags[GLOBAL_BAG_N];
+    live_site_t sites[LIVE_SITE_N];
+    live_thread_t threads[MAX_MANAGER];
+};
+
+static inline void liveStatsName(char* name, uint32_t pid) {
+    // no snprintf, the publisher may start inside the first malloc
+    char digits[10];
+    size_t n = 0;
+    do {
+        digits[n++] = (char)('0' + pid % 10);
+        pid /= 10;
+    } while (pid);
+
+    memcpy(name, "/semalloc.", 10);
+    for (size_t i = 0; i < n; i++) {
+        name[10 + i] = digits[n - 1 - i];
+    }
+    name[10 + n] = 0;
+}
+
+// a consistent copy of the shared page, false if the publisher kept it busy
+static inline bool liveStatsRead(const live_page_t* shared, live_page_t* out) {
+    for (int attempt = 0; attempt < 1000; attempt++) {
+        uint64_t seq = __atomic_load_n(&shared->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            continue;
+        }
+        memcpy(out, shared, sizeof(live_page_t));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (__atomic_load_n(&shared->seq, __ATOMIC_RELAXED) == seq) {
+            return true;
+        }
+    }
+    return false;
+}
+
+class LiveStats {
+public:
+    // maps the segment and starts the publisher thread
+    static void Start(uint32_t intervalMs);
+};
+
+#endif //semalloc_LIVESTATS_HH
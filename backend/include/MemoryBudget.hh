@@ -0,0 +1,40 @@
+#ifndef semalloc_MEMORYBUDGET_HH
+#define semalloc_MEMORYBUDGET_HH
+#include <atomic>
+#include "defines.hh"
+
+/**
+ * Soft memory budget. The process is under pressure while its RSS is above the budget (set
+ * with budget=SIZE, or a share of the cgroup v2 memory.max) or while the PSI "some avg10" of
+ * its cgroup (or of the system) is above the pressure=PERCENT threshold.
+ *
+ * Under pressure the managers purge freed pages, stop promoting loop CSIs and steer the
+ * allocations of promoted ones into the global bags, rather than growing until the OOM killer
+ * steps in. The state is polled by whichever thread reaches a poll point after the interval;
+ * no watcher thread is started.
+ */
+class MemoryBudget {
+private:
+    static std::atomic<bool> pressure;
+    static std::atomic<uint64_t> nextPoll; // CLOCK_MONOTONIC_COARSE, in ms
+    static size_t budget;                  // bytes of RSS, 0 if there is none
+    static uint32_t psiThreshold;          // avg10 in hundredths of a percent, 0 if off
+    static int statmFd;
+    static int psiFd;
+
+    static size_t readRSS();
+    static uint32_t readPSI();
+
+public:
+    static bool enabled;
+
+    static void InitMemoryBudget();
+
+    static bool underPressure() {
+        return pressure.load(std::memory_order_relaxed);
+    }
+
+    static void poll();
+};
+
+#endif //semalloc_MEMORYBUDGET_HH
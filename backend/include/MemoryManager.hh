@@ -12,9 +12,26 @@
 #include "HelperObjects.hh"
 #include "GlobalBIBOP.hh"
 #include "IndividualBIBOP.hh"
+#include "Options.hh"
+#include "SitePolicy.hh"
+#include "CSIKnowledge.hh"
+#include "MemoryBudget.hh"
+#include "Stats.hh"
+#include "Profile.hh"
+#include "HeapSample.hh"
+#include "Clock.hh"
+#include "AllocPolicy.hh"
 #include <atomic>
 
 
+// who may use a manager: the thread it belongs to, nobody (an exited thread's manager, a heap
+// between calls), or one thread for the moment (a heap call, a css_trim of an idle manager)
+enum MANAGER_STATE : uint8_t {
+    MANAGER_OWNED,
+    MANAGER_IDLE,
+    MANAGER_BUSY,
+};
+
 class MemoryManager {
 private:
     MemoryPool* individualDataPool[INDIVIDUAL_DATA_POOL_N]; // all data will be allocated from the dataPool
@@ -22,69 +39,411 @@ private:
     struct lazy_element_t {
         size_t CSI;
         uint8_t occurCount;
+        uint8_t policy; // SITE_POLICY, looked up when the entry is created
+        uint8_t promoted;
+        uint8_t tinyN; // demotion windows in a row with few live objects
+        uint8_t demotions;
+        uint32_t windowCount; // allocations in the current promotion or demotion window
+        uint32_t windowStart; // allocTick at the start of the promotion window
     };
+    uint32_t allocTick; // loop allocations of this manager
     lazy_element_t lazyIdentifiers[INDIVIDUAL_DATA_POOL_N << 8];
 #endif
     MemoryPool* metadataPool; // all metadata will be allocated from the metadataPool
     BIBOP* globalBIBOP; // a global BIBOP handles all one-time allocation
 
+    // zero while unused; the manager is a fresh anonymous mapping, so no page of the table is
+    // touched before a loop CSI lands on it
     struct IndividualBIBOP_c_t {
         IndividualBIBOP* ptr[GLOBAL_BAG_N];
-        size_t CSI;
+        size_t key; // CSI + 1, 0 marks a free entry
     };
 
     size_t individualDatPoolBump;
+    size_t colorBump; // rotating cache color for the next chunk
     IndividualBIBOP_c_t individualBIBOP[INDIVIDUAL_BIBOP_MAX_N]; // individual BIBOPs each for one loop
 
     // free list
     std::atomic<ListElement*> FreeList;
+    std::atomic<bool> trimRequested; // set by other threads, served by the owner
+#if defined(LIVE_STATS) && defined(STAT)
+    bool liveStats;
+    std::atomic<size_t> remotePushN; // remote frees pushed, counted only for the live stats
+#endif
+
+    IndividualBIBOP* individualList;
+
+    // huge mappings of a heap, so destroying the heap can unmap them
+    HugeLink* hugeList;
+    std::atomic_flag hugeLock;
 
     uint16_t thread_id;
+    bool isHeap;
+    std::atomic<uint8_t> ownerState; // MANAGER_STATE
+
+    // copies of the runtime options read on the allocation path
+    uint32_t variant; // ALLOC_FEATURE bits, see AllocPolicy.hh
+    bool lazyLoop;
+    bool sitePolicy;
+    bool coloring;
+    uint32_t lazyOccur;
+    uint32_t promoteCount;
+    uint32_t promoteWindow;
+    uint32_t demoteLive;
+    uint32_t demoteWindow;
+    size_t bibopSize;
+    size_t prefaultSize;
+    bibop_options_t bibopOptions; // handed to every BIBOP of the manager
+    uint32_t pollTick; // allocations since the last budget poll
+#if defined(LATENCY_HISTOGRAM) && defined(STAT)
+    uint32_t latencyTick; // malloc and free calls, one of LATENCY_SAMPLE_PERIOD is timed
+#endif
+#ifdef HEAP_SAMPLING
+    int64_t sampleCountdown; // bytes to the next sample, INT64_MAX while sampling is off
+    uint64_t sampleSeed;
+#endif
 #ifdef DEBUG
     size_t huge_count;
 #endif
+#ifdef STAT
+    alignas(CACHE_LINE_SIZE) semalloc_stats_t stats;
+
+    template<class Policy = runtime_policy_t>
+    void countMalloc(STAT_PATH path, size_t CSI, size_t realSize, size_t n) {
+        if (!Policy::on(this->variant, ALLOC_COUNTED)) {
+            return;
+        }
+        size_t bytes = (realSize + HEADER_SIZE) * n;
+        statAdd(&this->stats.mallocN[path], n);
+        statAdd(&this->stats.mallocBytes[path], bytes);
+        if (path != STAT_HUGE) {
+            size_t sizeClass = BIBOP::computeSizeIndex(realSize);
+            statAdd(&this->stats.classN[sizeClass], n);
+            statAdd(&this->stats.classBytes[sizeClass], bytes);
+        }
+#ifdef CSI_PROFILE
+        if (this->profile == nullptr) {
+            return;
+        }
+        if (path == STAT_HUGE) {
+            for (size_t i = 0; i < n; i++) {
+                SiteProfile::countHugeMalloc(CSI, false, realSize + HEADER_SIZE);
+            }
+        } else {
+            SiteProfile::countMalloc(this->profile, CSI, path != STAT_GLOBAL, BIBOP::computeSizeIndex(realSize), bytes, n);
+        }
+#endif
+    }
+#endif
+#ifdef CSI_PROFILE
+    site_profile_t* profile; // nullptr unless the profile option is set
+#endif
+
+    void countChunk(size_t CSI, size_t bibopN) {
+#ifdef CSI_PROFILE
+        if (this->profile) {
+            SiteProfile::countBIBOP(this->profile, CSI, bibopN, 1);
+        }
+#endif
+    }
+
+    // times a slow path from its construction, or from start(), to the end of its scope
+    struct latency_timer_t {
+#if defined(LATENCY_HISTOGRAM) && defined(STAT)
+        MemoryManager* manager;
+        LATENCY_PATH path;
+        uint64_t startTick;
+
+        latency_timer_t(MemoryManager* _manager, LATENCY_PATH _path, bool now = true)
+                : manager(_manager), path(_path), startTick(0) {
+            if (now) {
+                this->start();
+            }
+        }
+
+        void start() {
+            if ((this->manager->variant & ALLOC_TIMED) && this->startTick == 0) {
+                this->startTick = readTSC();
+            }
+        }
+
+        ~latency_timer_t() {
+            if (this->startTick) {
+                this->manager->recordLatency(this->path, this->startTick);
+            }
+        }
+#else
+        latency_timer_t(MemoryManager*, LATENCY_PATH, bool = true) {}
+        void start() {}
+#endif
+    };
 
     IndividualBIBOP* getIndividualBIBOPbyCSI(size_t CSI, size_t objectSize);
     GlobalBIBOP* AllocateGlobalBIBOP();
-    IndividualBIBOP* AllocateIndividualBIBOP(size_t objectSize);
+    IndividualBIBOP* AllocateIndividualBIBOP(size_t objectSize, size_t CSI);
+    void prepareChunk(void* chunk, uint32_t policy);
+    size_t takePrefaultBudget(size_t length);
 
-    static void* allocateHuge(size_t size);
+    void* allocateHuge(size_t size, size_t CSI, size_t alignment = PAGE_SIZE);
+    void unlinkHuge(HugeLink* link);
     void handleFreeList();
+    size_t trimLocal();
+
+    template<class Policy>
+    void* allocateRegular(size_t realSize, size_t CSI, bool inLoop);
+    template<class Policy = runtime_policy_t>
+    void freeLocalMemory(void* ptr);
+    size_t fillBatch(SingleBIBOP* bibop, size_t CSI, bool global, size_t count, void** out);
 
-    bool tryPutToLazyPool(size_t CSI);
+    bool tryPutToLazyPool(size_t CSI, size_t realSize);
+    bool pinSite(size_t CSI);
+#ifdef LAZY_LOOP
+    bool tryPromote(lazy_element_t* site, size_t realSize);
+    bool tryDemote(lazy_element_t* site);
+    size_t countLiveObjects(size_t CSI, bool* nursery);
+#endif
     void* acquireIndividualDataPool();
+    void extendBIBOP(SingleBIBOP* bibop, void* chunk);
+    void recordChunk(SingleBIBOP* bibop);
+
+    template<class Policy = runtime_policy_t>
+    void pollBudget() {
+        if (Policy::on(this->variant, ALLOC_BUDGETED) && ++this->pollTick >= BUDGET_POLL_ALLOCATIONS) {
+            this->pollTick = 0;
+            MemoryBudget::poll();
+        }
+    }
+    size_t nextColor();
+
+    void countRemotePush(size_t n) {
+#if defined(LIVE_STATS) && defined(STAT)
+        if (this->liveStats) {
+            this->remotePushN.fetch_add(n, std::memory_order_relaxed);
+        }
+#endif
+    }
+
+    // unsampled allocations only pay the decrement
+    void* sampled(void* ptr, size_t realSize, size_t CSI) {
+#ifdef HEAP_SAMPLING
+        // a failed allocation takes no bytes off the countdown
+        if (__builtin_expect(ptr == nullptr, 0)) {
+            return ptr;
+        }
+        this->sampleCountdown -= (int64_t)realSize;
+        if (__builtin_expect(this->sampleCountdown < 0, 0)) {
+            this->takeSample(ptr, realSize, CSI);
+        }
+#endif
+        return ptr;
+    }
+
+    // a batch that crosses the countdown gives one sample, its last object
+    void sampledBatch(void** out, size_t n, size_t realSize, size_t CSI) {
+#ifdef HEAP_SAMPLING
+        this->sampleCountdown -= (int64_t)(realSize * n);
+        if (__builtin_expect(this->sampleCountdown < 0, 0) && n) {
+            this->takeSample(out[n - 1], realSize, CSI);
+        }
+#endif
+    }
+#ifdef HEAP_SAMPLING
+    __attribute__((noinline)) void takeSample(void* ptr, size_t realSize, size_t CSI);
+#endif
 
 public:
+    template<class Policy = runtime_policy_t>
     void* mallocMemory(size_t size);
     void* mallocMemory(size_t realSize, size_t CSI, bool inLoop);
+    // a huge mapping whose data starts on the alignment, for memalign requests past BAG_THRESHOLD
+    void* mallocHugeAligned(size_t realSize, size_t CSI, size_t alignment);
+    template<class Policy = runtime_policy_t>
     void freeRegularMemory(void* ptr);
     void freeOtherThreadMemory(void* ptr);
+    void freeOtherThreadMemory(ListElement* head, ListElement* tail, size_t n);
+
+    size_t mallocBatch(size_t realSize, size_t CSI, bool inLoop, size_t count, void** out);
+    void freeBatch(void** ptrs, size_t n);
+
+    size_t prewarm(size_t realSize, size_t CSI, size_t count);
+
+    // the owner trims at once, and so does another thread on an idle manager; a busy one gets a
+    // request it serves on its next malloc or free
+    size_t trim(bool owner);
+    void accountUsage(semalloc_usage_t* usage);
+    // per size class, the global bag and the individual BIBOPs of the class together
+    void accountBags(usage_t* bags);
+    static void accountHugeUsage(semalloc_usage_t* usage);
+
+#ifdef STAT
+    const semalloc_stats_t* getStats() {
+        return &this->stats;
+    }
+#endif
+
+    // the other calls only pay the increment, and nothing without the latency option
+    template<class Policy = runtime_policy_t>
+    bool sampleLatency() {
+#if defined(LATENCY_HISTOGRAM) && defined(STAT)
+        return Policy::on(this->variant, ALLOC_TIMED) && (++this->latencyTick & (LATENCY_SAMPLE_PERIOD - 1)) == 0;
+#else
+        return false;
+#endif
+    }
+
+    void recordLatency(LATENCY_PATH path, uint64_t start) {
+#if defined(LATENCY_HISTOGRAM) && defined(STAT)
+        statAdd(&this->stats.latency[path][latencyBucket(readTSC() - start)], 1);
+#endif
+    }
+
+    SingleBIBOP* getBag(size_t index) {
+        return ((GlobalBIBOP*)this->globalBIBOP)->getBag(index);
+    }
+
+    IndividualBIBOP* getIndividualList() {
+        return __atomic_load_n(&this->individualList, __ATOMIC_ACQUIRE);
+    }
+
+    uint16_t getThreadId() {
+        return this->thread_id;
+    }
+
+    bool isHeapManager() {
+        return this->isHeap;
+    }
+
+    // the manager of an exited thread, with all its objects, goes to the next new thread
+    void orphan() {
+        this->ownerState.store(MANAGER_IDLE, std::memory_order_release);
+    }
+
+    bool adopt() {
+        return this->claim(MANAGER_OWNED);
+    }
+
+    // a heap call holds the heap against a css_trim of it, a trim is short so the call spins
+    void enter() {
+        while (!this->claim(MANAGER_BUSY));
+    }
+
+    void leave() {
+        this->ownerState.store(MANAGER_IDLE, std::memory_order_release);
+    }
+
+    // remote frees waiting for the owner to drain them, 0 without the live stats
+    size_t getRemoteBacklog() {
+#if defined(LIVE_STATS) && defined(STAT)
+        size_t pushed = this->remotePushN.load(std::memory_order_relaxed);
+        size_t drained = __atomic_load_n(&this->stats.remoteFreeN, __ATOMIC_RELAXED);
+        return pushed > drained ? pushed - drained : 0;
+#else
+        return 0;
+#endif
+    }
+
+    site_profile_t* getProfile() {
+#ifdef CSI_PROFILE
+        return this->profile;
+#else
+        return nullptr;
+#endif
+    }
+
+    void InitMemoryManager(uint16_t _thread_id, bool _isHeap) {
+        this->variant = AllocPolicy::Select();
+        this->lazyLoop = semallocOptions.lazyLoop;
+        this->sitePolicy = SitePolicy::loaded();
+        this->coloring = semallocOptions.coloring;
+        this->lazyOccur = semallocOptions.lazyLoop ? semallocOptions.lazyOccur : 0;
+        // without the lazy loop (but with site policies) every loop CSI is promoted for good
+        this->promoteCount = semallocOptions.lazyLoop ? semallocOptions.promoteCount : 0;
+        this->promoteWindow = semallocOptions.promoteWindow;
+        this->demoteLive = semallocOptions.demoteLive;
+        this->demoteWindow = semallocOptions.lazyLoop && semallocOptions.demoteWindow ?
+                             semallocOptions.demoteWindow : UINT32_MAX;
+        this->bibopSize = semallocOptions.bibopSize;
+        this->prefaultSize = semallocOptions.prefaultSize < this->bibopSize ?
+                             semallocOptions.prefaultSize : this->bibopSize;
+        this->bibopOptions.chunkSize = this->bibopSize;
+        this->bibopOptions.releaseThreshold = semallocOptions.releaseThreshold;
+        this->bibopOptions.memoryRelease = semallocOptions.memoryRelease;
+        this->bibopOptions.nursery = semallocOptions.nursery;
+        this->pollTick = 0;
+#if defined(LATENCY_HISTOGRAM) && defined(STAT)
+        this->latencyTick = 0;
+#endif
+#ifdef HEAP_SAMPLING
+        this->sampleSeed = ((uint64_t)this ^ ((uint64_t)_thread_id << 32)) | 1;
+        this->sampleCountdown = HeapSampler::enabled ? HeapSampler::nextInterval(&this->sampleSeed) : INT64_MAX;
+#endif
 
-    void InitMemoryManager(uint16_t _thread_id) {
         this->individualDataPool[0] = MemoryPool::AllocateMemoryPool(INDIVIDUAL_DATA_POOL_SIZE);
         this->metadataPool = MemoryPool::AllocateMemoryPool(METADATA_POOL_SIZE);
 
+        // threads start at different colors, so their bags do not alias each other either
+        this->colorBump = _thread_id * GLOBAL_BAG_N;
         globalBIBOP = this->AllocateGlobalBIBOP();
-        memset(individualBIBOP, 0xFF, sizeof individualBIBOP);
 
         this->individualDatPoolBump = 0;
         this->FreeList = nullptr;
+        this->trimRequested = false;
+#if defined(LIVE_STATS) && defined(STAT)
+        this->liveStats = semallocOptions.liveStats != 0;
+        this->remotePushN = 0;
+#endif
+#ifdef STAT
+        memset(&this->stats, 0, sizeof this->stats);
+#endif
+#ifdef CSI_PROFILE
+        this->profile = SiteProfile::enabled ? SiteProfile::AllocateTable() : nullptr;
+#endif
+        this->individualList = nullptr;
+        this->hugeList = nullptr;
+        this->hugeLock.clear();
         this->thread_id = _thread_id;
+        this->isHeap = _isHeap;
+        this->ownerState = _isHeap ? MANAGER_IDLE : MANAGER_OWNED;
+    }
+
+    bool claim(MANAGER_STATE state) {
+        uint8_t idle = MANAGER_IDLE;
+        return this->ownerState.load(std::memory_order_relaxed) == MANAGER_IDLE &&
+               this->ownerState.compare_exchange_strong(idle, state, std::memory_order_acquire);
     }
 
 public:
-    static MemoryManager* AllocateMemoryManager(uint16_t _thread_id) {
+    static MemoryManager* AllocateMemoryManager(uint16_t _thread_id, bool _isHeap = false) {
         auto mm = (MemoryManager*)mmap(nullptr, sizeof(MemoryManager), PROT_READ | PROT_WRITE,
-                                                 MAP_PRIVATE | MAP_ANON, -1, 0);
-        mm->InitMemoryManager(_thread_id);
+                                                 MAP_PRIVATE | MAP_ANON | MAP_NORESERVE, -1, 0);
+        mm->InitMemoryManager(_thread_id, _isHeap);
         return mm;
     }
 
-    static inline void freeHugeMemory(void *ptr) {
-        auto* header = (HugeHeader*)((uint64_t)ptr - HEADER_SIZE);
-        auto* addr = (void*)((uint64_t)ptr - PAGE_SIZE);
-        munmap(addr, header->size + PAGE_SIZE);
-    }
+    void DestroyMemoryManager();
+
+    /**
+     * Code that reads the managers of other threads (stats, usage, trim, profile, live stats, heap
+     * walk) holds a pin for the whole walk. semalloc_heap_destroy takes the managers exclusively,
+     * so a heap is cleared from its slot, folded into the retired counters and unmapped while no
+     * walk is halfway through it. Pins do not nest.
+     */
+    static void pinManagers();
+    static void unpinManagers();
+    static void lockManagers();
+    static void unlockManagers();
+
+    struct managers_pinned_t {
+        managers_pinned_t() {
+            MemoryManager::pinManagers();
+        }
+
+        ~managers_pinned_t() {
+            MemoryManager::unpinManagers();
+        }
+    };
+
+    static void freeHugeMemory(void *ptr);
 
     static inline size_t getHugeSize(void *ptr) {
         auto* header = (HugeHeader*)((uint64_t)ptr - HEADER_SIZE);
@@ -93,12 +452,14 @@ public:
 
     static inline size_t getRegularSize(void* ptr) {
         auto* header = (RegularHeader*)((uint64_t)ptr - HEADER_SIZE);
+        // an object moved up by memalign loses the bytes in front of it
+        size_t offset = header->isAligned() ? header->memalign_offset : 0;
         if (!header->isRegular()) {
             auto* bibop = (SingleBIBOP*)header->bibop;
-            return bibop->getObjectSize();
+            return bibop->getObjectSize() - offset;
         } else {
             auto* bibop = (IndividualBIBOP*)header->bibop;
-            return bibop->getObjectSize();
+            return bibop->getObjectSize() - offset;
         }
     }
 };
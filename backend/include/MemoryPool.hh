@@ -15,13 +15,18 @@ public:
     void* allocateMemory(size_t size);
     void* getPoolBase();
     void* getBumpMemory();
+    void releaseMemoryPool();
 
     static MemoryPool* AllocateMemoryPool(size_t InitSize) {
         Debug("Init pool with size %zu\n", InitSize);
         auto mp = (MemoryPool*)mmap(nullptr, sizeof(MemoryPool), PROT_READ | PROT_WRITE,
                                        MAP_PRIVATE | MAP_ANON, -1, 0);
+#ifdef BITMAP_FREE_TRACKING
+        mp->baseMemory = ReserveAligned(InitSize, BITMAP_CHUNK_SIZE);
+#else
         mp->baseMemory = mmap(nullptr, InitSize, PROT_READ | PROT_WRITE,
-                              MAP_PRIVATE | MAP_ANON, -1, 0);
+                              MAP_PRIVATE | MAP_ANON | MAP_NORESERVE, -1, 0);
+#endif
 
         mp->bumpMemory = mp->baseMemory;
         mp->boundaryMemory = (void*)((size_t)mp->baseMemory + InitSize);
@@ -29,6 +34,38 @@ public:
         return mp;
     }
 
+    // take the page faults of [start, start + length) now rather than on the allocation path
+    static void Prefault(void* start, size_t length) {
+#ifdef MADV_POPULATE_WRITE
+        if (madvise(start, length, MADV_POPULATE_WRITE) == 0) {
+            return;
+        }
+#endif
+        // older kernels: touch every page with an add of 0, the range may hold live objects
+        for (size_t offset = 0; offset < length; offset += PAGE_SIZE) {
+            __atomic_fetch_add((char*)start + offset, 0, __ATOMIC_RELAXED);
+        }
+    }
+
+    // reserve size bytes starting at a multiple of alignment (a power of two)
+    static void* ReserveAligned(size_t size, size_t alignment) {
+        auto raw = (uint64_t)mmap(nullptr, size + alignment, PROT_READ | PROT_WRITE,
+                                  MAP_PRIVATE | MAP_ANON | MAP_NORESERVE, -1, 0);
+        if ((void*)raw == MAP_FAILED) {
+            Error("mmap failed for size %zu\n", size + alignment);
+            exit(1);
+        }
+
+        uint64_t aligned = (raw + alignment - 1) & ~(uint64_t)(alignment - 1);
+        if (aligned > raw) {
+            munmap((void*)raw, aligned - raw);
+        }
+        if (raw + alignment > aligned) {
+            munmap((void*)(aligned + size), raw + alignment - aligned);
+        }
+        return (void*)aligned;
+    }
+
 };
 
 
@@ -0,0 +1,43 @@
+#ifndef semalloc_OPTIONS_HH
+#define semalloc_OPTIONS_HH
+#include "defines.hh"
+
+/**
+ * Runtime knobs, read from SEMALLOC_OPTIONS once before the first manager is set up, e.g.
+ *      SEMALLOC_OPTIONS="lazy_occur=4,release_threshold=64K,bibop_size=256M,policy=/etc/app.pol"
+ * The compile-time defines are the defaults; a feature compiled out stays out.
+ * Managers copy what their hot path needs, so the struct is never written afterwards.
+ */
+struct Options {
+    bool lazyLoop;              // lazy_loop=0|1
+    uint32_t lazyOccur;         // lazy_occur=N, allocations of a loop CSI kept in the global bags
+    uint32_t promoteCount;      // promote_count=N
+    uint32_t promoteWindow;     // promote_window=N
+    uint32_t demoteLive;        // demote_live=N
+    uint32_t demoteWindow;      // demote_window=N, 0 never demotes
+    bool memoryRelease;         // memory_release=0|1
+    size_t releaseThreshold;    // release_threshold=SIZE, SIZE_MAX if release is off
+    size_t bibopSize;           // bibop_size=SIZE, a power of two up to INDIVIDUAL_BIBOP_SIZE
+    bool coloring;              // coloring=0|1
+    size_t prefaultSize;        // prefault=SIZE, populated at the start of every new chunk
+    size_t prefaultBudget;      // prefault_budget=SIZE, total for all chunks of the process
+    size_t budget;              // budget=SIZE, soft RSS budget, 0 takes it from the cgroup
+    uint32_t pressure;          // pressure=PERCENT, PSI avg10 threshold, 0 ignores PSI
+    bool stat;                  // stat=0|1, count and print the statistics at exit, see AllocPolicy.hh
+    size_t sampleInterval;      // sample_interval=SIZE, mean bytes between two heap samples
+    bool latency;               // latency=0|1, per-path latency histograms, see Stats.hh
+    uint32_t liveStats;         // live_stats=MS, period of the shared-memory stats page, 0 is off, see LiveStats.hh
+    uint32_t autoCSI;           // auto_csi=FRAMES, CSIs from the call stack of uninstrumented code, see CallSite.hh
+    uint32_t nursery;           // nursery=LIVE, bump-only BIBOPs for CSIs with fewer objects live at once, 0 is off, see SingleBIBOP.hh
+    char policyFile[256];       // policy=PATH, per-CSI policies, see SitePolicy.hh
+    char traceFile[256];        // trace=PATH, binary event trace (LOG_TO_FILE builds), see Trace.hh
+    char profileFile[256];      // profile=PATH, per-CSI profile dumped at exit and on SIGUSR2, see Profile.hh
+    char heapProfileFile[256];  // heap_profile=PATH, sampled heap profile in pprof format, see HeapSample.hh
+    char fragReportFile[256];   // frag_report=PATH, fragmentation report at exit and on SIGUSR2, see HeapWalk.hh
+
+    static void InitOptions();
+};
+
+extern Options semallocOptions;
+
+#endif //semalloc_OPTIONS_HH
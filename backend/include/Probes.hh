@@ -0,0 +1,70 @@
+#ifndef semalloc_PROBES_HH
+#define semalloc_PROBES_HH
+#include "defines.hh"
+
+/**
+ * USDT probes of the provider "semalloc", in the .note.stapsdt format of sys/sdt.h, so that
+ *      bpftrace -e 'usdt:libsemalloc.so:semalloc:huge_map { @[arg1] = count(); }'
+ *      perf probe -x libsemalloc.so sdt_semalloc:new_bibop
+ * attach to a running process without a rebuild. An idle probe is one nop; its arguments are
+ * only described in the note, all of them as 8-byte values.
+ *
+ * The probes and their arguments:
+ *      new_bibop(CSI, object size, bibop)          an individual BIBOP for a CSI
+ *      extend_bibop(bibop, chunk, chunk size)      a new chunk for a full BIBOP
+ *      pool_exhausted(thread, pool index)          a data pool is full, the next one is mapped
+ *      huge_map(address, size, CSI)
+ *      huge_unmap(address, size)
+ *      promote(thread, CSI, size)                  a loop CSI gets its own BIBOPs
+ *      demote(thread, CSI)                         and goes back to the global bags
+ *      nursery(bibop, object size)                 a BIBOP turns into a bump-only nursery
+ *      nursery_leave(bibop, live objects)          and back, an object outlived the prediction
+ *      drain(thread, frees)                        remote frees taken by their owner
+ *      release(address, length)                    pages given back with madvise
+ *
+ * They are compiled in with USDT_PROBES on x86-64 and aarch64, and compiled out elsewhere.
+ */
+#if defined(USDT_PROBES) && (defined(__x86_64__) || defined(__aarch64__))
+
+#define SEMALLOC_PROBE_ARG(n) "8@%[a" #n "]"
+
+// the probe note and, once per object, the base sdt tools use to find the load offset
+#define SEMALLOC_PROBE_NOTE(name, format, ...) \
+    __asm__ __volatile__ ( \
+            "990: nop\n" \
+            ".pushsection .note.stapsdt,\"?\",\"note\"\n" \
+            ".balign 4\n" \
+            ".4byte 992f-991f, 994f-993f, 3\n" \
+            "991: .asciz \"stapsdt\"\n" \
+            "992: .balign 4\n" \
+            "993: .8byte 990b\n" \
+            ".8byte _.stapsdt.base\n" \
+            ".8byte 0\n" \
+            ".asciz \"semalloc\"\n" \
+            ".asciz \"" #name "\"\n" \
+            ".asciz \"" format "\"\n" \
+            "994: .balign 4\n" \
+            ".popsection\n" \
+            ".ifndef _.stapsdt.base\n" \
+            ".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n" \
+            ".weak _.stapsdt.base\n" \
+            ".hidden _.stapsdt.base\n" \
+            "_.stapsdt.base: .space 1\n" \
+            ".size _.stapsdt.base, 1\n" \
+            ".popsection\n" \
+            ".endif\n" \
+            :: __VA_ARGS__)
+
+#define SEMALLOC_PROBE2(name, x1, x2) \
+    SEMALLOC_PROBE_NOTE(name, SEMALLOC_PROBE_ARG(1) " " SEMALLOC_PROBE_ARG(2), \
+                        [a1] "nor" ((uint64_t)(x1)), [a2] "nor" ((uint64_t)(x2)))
+#define SEMALLOC_PROBE3(name, x1, x2, x3) \
+    SEMALLOC_PROBE_NOTE(name, SEMALLOC_PROBE_ARG(1) " " SEMALLOC_PROBE_ARG(2) " " SEMALLOC_PROBE_ARG(3), \
+                        [a1] "nor" ((uint64_t)(x1)), [a2] "nor" ((uint64_t)(x2)), [a3] "nor" ((uint64_t)(x3)))
+
+#else
+#define SEMALLOC_PROBE2(name, x1, x2) do {} while (0)
+#define SEMALLOC_PROBE3(name, x1, x2, x3) do {} while (0)
+#endif
+
+#endif //semalloc_PROBES_HH
@@ -0,0 +1,94 @@
+#ifndef semalloc_PROFILE_HH
+#define semalloc_PROFILE_HH
+#include "defines.hh"
+#include "hash.h"
+
+#define PROFILE_SITE_N (1 << 16)
+#define PROFILE_KEY(CSI) ((uint32_t)(CSI) | 0x80000000U) // 0 marks an empty slot
+#define PROFILE_HUGE_CLASS GLOBAL_BAG_N
+
+/**
+ * Per-CSI allocation profile, on with SEMALLOC_OPTIONS=profile=PATH. It is written to PATH as
+ * JSON, sites ranked by bytes, when the process exits and whenever it gets SIGUSR2.
+ *
+ * Every manager counts its regular objects in a table of its own, frees included: remote frees
+ * are counted when the owner drains them. Huge objects are freed by any thread, so they go to a
+ * shared table updated with atomics, as do the counters of destroyed heaps. Live and peak live
+ * are kept per table; the dump sums them, so its peak is an upper bound of the process peak.
+ */
+struct site_profile_t {
+    uint32_t key;
+    uint32_t loop;          // 1 once the site allocated in a loop
+    size_t mallocN;
+    size_t freeN;
+    size_t bytes;           // allocated, headers included
+    int64_t live;
+    int64_t peakLive;
+    size_t bibopN;          // individual BIBOPs created for the site
+    size_t chunkN;          // chunks taken by those BIBOPs, their first ones included
+    size_t classN[GLOBAL_BAG_N + 1]; // allocations per size class, the last one counts huge objects
+};
+
+class SiteProfile {
+private:
+    static site_profile_t* sharedSites;
+
+    static site_profile_t* find(site_profile_t* table, size_t CSI);
+    static void merge(site_profile_t* table, const site_profile_t* from);
+
+public:
+    static bool enabled;
+
+    // sets up the per-CSI tables and the heap sampler the options ask for, and the SIGUSR2 dump
+    static void InitProfile();
+    // the thread that dumps on SIGUSR2, started once a manager can serve its allocations
+    static void StartDumpThread();
+    static site_profile_t* AllocateTable();
+    // folds the table into the shared one and unmaps it, for a heap being destroyed
+    static void RetireTable(site_profile_t* table);
+
+    // the table of a manager has a single writer
+    static void countMalloc(site_profile_t* table, size_t CSI, bool loop, size_t sizeClass, size_t bytes, size_t n) {
+        site_profile_t* site = find(table, CSI);
+        if (site == nullptr) {
+            return;
+        }
+        if (loop && !site->loop) {
+            __atomic_store_n(&site->loop, 1, __ATOMIC_RELAXED);
+        }
+        __atomic_store_n(&site->mallocN, site->mallocN + n, __ATOMIC_RELAXED);
+        __atomic_store_n(&site->bytes, site->bytes + bytes, __ATOMIC_RELAXED);
+        __atomic_store_n(&site->classN[sizeClass], site->classN[sizeClass] + n, __ATOMIC_RELAXED);
+        int64_t live = site->live + (int64_t)n;
+        __atomic_store_n(&site->live, live, __ATOMIC_RELAXED);
+        if (live > site->peakLive) {
+            __atomic_store_n(&site->peakLive, live, __ATOMIC_RELAXED);
+        }
+    }
+
+    static void countFree(site_profile_t* table, size_t CSI) {
+        site_profile_t* site = find(table, CSI);
+        if (site == nullptr) {
+            return;
+        }
+        __atomic_store_n(&site->freeN, site->freeN + 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&site->live, site->live - 1, __ATOMIC_RELAXED);
+    }
+
+    static void countBIBOP(site_profile_t* table, size_t CSI, size_t bibopN, size_t chunkN) {
+        site_profile_t* site = find(table, CSI);
+        if (site == nullptr) {
+            return;
+        }
+        __atomic_store_n(&site->bibopN, site->bibopN + bibopN, __ATOMIC_RELAXED);
+        __atomic_store_n(&site->chunkN, site->chunkN + chunkN, __ATOMIC_RELAXED);
+    }
+
+    static void countHugeMalloc(size_t CSI, bool loop, size_t bytes);
+    static void countHugeFree(size_t CSI);
+
+    // no allocation, it also runs on the dump thread SIGUSR2 wakes
+    static void Dump();
+};
+
+#endif //semalloc_PROFILE_HH
@@ -6,6 +6,49 @@
 #define semalloc_SINGLEBIBOP_HH
 #include "defines.hh"
 #include "HelperObjects.hh"
+#include "MemoryPool.hh"
+
+// a chunk a BIBOP carved slots from, kept in the metadata pool for the heap walk
+struct chunk_record_t {
+    uint64_t start;         // the first slot
+    uint64_t end;           // the end of the carved slots, 0 while the BIBOP still carves from it
+    chunk_record_t* nxt;    // the chunk before
+};
+
+// the options of the owning manager a BIBOP reads on its free path, copied when it is set up
+struct bibop_options_t {
+    size_t chunkSize;           // bibop_size; a bitmap chunk is aligned to it
+    size_t releaseThreshold;    // release_threshold
+    uint32_t nursery;           // nursery
+    bool memoryRelease;         // memory_release
+};
+
+#ifdef NURSERY
+/**
+ * The nursery of an individual BIBOP (nursery=LIVE). A BIBOP is watched over windows of
+ * NURSERY_WINDOW allocations; if the peak of objects live at once stays below LIVE over a window,
+ * the site never holds many objects together and the BIBOP is armed. This is a bound on
+ * concurrent live objects, not on the lifetime of each one: a single object may live for the
+ * whole window as long as few others do.
+ *
+ * The next time the last object of an armed BIBOP is freed, with all of it in one chunk, it
+ * becomes a nursery: its free slots are forgotten, allocation only bumps through a region of
+ * NURSERY_REGION_SIZE at the start of the chunk, a free only counts down, and the free that leaves
+ * no live object resets the bump to the first slot. The region stays small, so a nursery keeps
+ * reusing the same cache lines. Only the individual path checks the state; the global bags never
+ * become nurseries and do not look.
+ *
+ * A site whose objects stop dying together shows up as a full region with live objects. The BIBOP
+ * then goes back to its free list: the slots of the region whose header is not allocated are
+ * freed, and it is watched again over a window twice as long, up to NURSERY_BACKOFF_MAX times.
+ */
+enum NURSERY_STATE {
+    NURSERY_OFF,
+    NURSERY_WATCH,
+    NURSERY_ARMED,
+    NURSERY_ON
+};
+#endif
 
 class SingleBIBOP {
 protected:
@@ -13,25 +56,99 @@ protected:
         node* nxt;
     };
 
+#ifdef BITMAP_FREE_TRACKING
+    // metadata at the start of every chunk; one bitmap word tracks a page of 64 slots
+    struct chunk_t {
+        uint64_t slotBase;
+        size_t pageN;
+        size_t freeN;
+        uint64_t* summary; // bit set: the page has at least one free slot
+        size_t summaryN;
+        size_t summaryHint; // no summary word below the hint is set
+        chunk_t* nxtPartial; // the next earlier chunk with free slots
+
+        uint64_t* freeMap() {
+            return (uint64_t*)(this + 1);
+        }
+
+        size_t findFullestPage();
+    };
+#endif
+
     uint64_t bump;
     uint64_t base;
     size_t objectSize;
+    bibop_options_t options;
     node freeList;
     size_t capacity;
+    size_t liveN; // objects handed out and not yet freed
+    size_t carvedN; // objects ever taken from the bump pointer
+    chunk_record_t* chunks; // newest first
+#ifdef NURSERY
+    uint8_t nurseryState; // NURSERY_STATE
+    uint8_t nurseryBackoff; // fallbacks so far
+    uint32_t watchN; // allocations in the current watch window
+    size_t watchLive; // the most objects live at an allocation of the window
+    uint64_t nurseryStart; // the first slot of the region
+    uint64_t nurseryTop; // the highest bump of the region, no slot above it was carved
+    uint64_t nurseryEnd; // no slot of the region ends above it
+#endif
+#ifdef BITMAP_FREE_TRACKING
+    chunk_t* chunk; // the chunk we allocate from
+    size_t currentPage;
+    chunk_t* partial; // earlier chunks with free slots, used once the current one has none
+    size_t partialPage;
+
+    void* takeSlot(chunk_t* owner, size_t* page);
+    size_t purgePage(chunk_t* owner, size_t page);
+    size_t trimChunk(chunk_t* owner);
+#endif
+
+    void InitChunk(uint64_t _base, size_t _capacity, size_t _color);
+    size_t releaseSlot(uint64_t slot);
+    void recycleSlot(void* ptr);
+#ifdef NURSERY
+    void initNursery(bool watch) {
+        nurseryState = watch ? NURSERY_WATCH : NURSERY_OFF;
+        nurseryBackoff = 0;
+        watchN = 0;
+        watchLive = 0;
+        nurseryTop = 0;
+    }
+
+    void* allocateNursery();
+    bool freeNursery();
+    void watchNursery();
+    bool enterNursery();
+    void leaveNursery();
+#endif
 
 public:
     void* allocateObject();
+    size_t allocateBatch(size_t count, void** out);
+    size_t prewarm(size_t count);
     void freeObject(void* ptr);
-    void ExtendSingleBIBOP(uint64_t _base, size_t _capacity);
+    void ExtendSingleBIBOP(uint64_t _base, size_t _capacity, size_t _color = 0);
 
-    void InitSingleBIBOP(uint64_t _base, size_t _objectSize) {
-        bump = _base;
-        base = _base;
+    void InitSingleBIBOP(uint64_t _base, size_t _objectSize, size_t _capacity, const bibop_options_t* _options,
+                         size_t _color = 0) {
         objectSize = _objectSize + HEADER_SIZE;
+        options = *_options;
         freeList.nxt = nullptr;
+        liveN = 0;
+        carvedN = 0;
+        chunks = nullptr;
+#ifdef BITMAP_FREE_TRACKING
+        partial = nullptr;
+#endif
+#ifdef NURSERY
+        initNursery(false);
+#endif
+        InitChunk(_base, _capacity, _color);
     }
 
-    static SingleBIBOP* AllocateSingleBIBOP(uint64_t _base, size_t _objectSize, size_t capacity) {
+    static SingleBIBOP* AllocateSingleBIBOP(uint64_t _base, size_t _objectSize, size_t capacity,
+                                            const bibop_options_t* _options, size_t _color = 0) {
         auto sb = (SingleBIBOP*)mmap(nullptr, sizeof(SingleBIBOP), PROT_READ | PROT_WRITE,
                               MAP_PRIVATE | MAP_ANON, -1, 0);
         if (sb == nullptr) {
@@ -39,13 +156,70 @@ public:
             exit(1);
         }
 
-        sb->InitSingleBIBOP(_base, _objectSize);
-        sb->capacity = capacity;
+        sb->InitSingleBIBOP(_base, _objectSize, capacity, _options, _color);
         return sb;
     }
 
     size_t getObjectSize();
 
+    size_t getReleaseThreshold() {
+        return options.releaseThreshold;
+    }
+
+    size_t getLiveN() {
+        return liveN;
+    }
+
+    bool inNursery() {
+#ifdef NURSERY
+        return nurseryState == NURSERY_ON;
+#else
+        return false;
+#endif
+    }
+
+    // the current chunk, a record from the metadata pool; the walk reads the list from any thread
+    void recordChunk(chunk_record_t* record) {
+        record->start = bump;
+        record->end = 0;
+        record->nxt = chunks;
+        __atomic_store_n(&chunks, record, __ATOMIC_RELEASE);
+    }
+
+    chunk_record_t* getChunks() {
+        return __atomic_load_n(&chunks, __ATOMIC_ACQUIRE);
+    }
+
+    // the end of the slots carved from the current chunk, which starts at start;
+    // a slot fits while its end stays below capacity, and a failed allocation moves bump past it
+    uint64_t carvedEnd(uint64_t start) {
+        uint64_t limit = base + capacity;
+        uint64_t fit = limit > start ? start + (limit - 1 - start) / objectSize * objectSize : start;
+        uint64_t current = __atomic_load_n(&bump, __ATOMIC_RELAXED);
+#ifdef NURSERY
+        // a nursery reset moves the bump back below slots it carved before
+        uint64_t top = __atomic_load_n(&nurseryTop, __ATOMIC_RELAXED);
+        current = top > current ? top : current;
+#endif
+        return current < fit ? current : fit;
+    }
+
+    size_t getSlotSize() {
+        return objectSize;
+    }
+
+    // read from any thread, so the counters may be a little behind
+    void accountUsage(usage_t* usage) {
+        size_t carved = carvedN;
+        size_t live = liveN < carved ? liveN : carved;
+        usage->arena += carved * objectSize;
+        usage->inUse += live * objectSize;
+        usage->free += (carved - live) * objectSize;
+        usage->blocks += carved - live;
+    }
+
+    size_t trim();
+
 };
 
 #endif //semalloc_SINGLEBIBOP_HH
@@ -0,0 +1,59 @@
+#ifndef semalloc_SITEPOLICY_HH
+#define semalloc_SITEPOLICY_HH
+#include "defines.hh"
+
+enum SITE_POLICY : uint32_t {
+    SITE_DEFAULT = 0,
+    SITE_GLOBAL = 1,        // always stays in the global bags
+    SITE_DEDICATED = 2,     // own BIBOP from the first allocation, no lazy warm-up
+    SITE_PREFAULT = 4,      // new chunks are prefaulted, up to SITE_PREFAULT_SIZE
+    SITE_HUGEPAGE = 8,      // new chunks are backed by transparent huge pages
+};
+
+#define SITE_POLICY_MAGIC "SEMPOL01"
+#define SITE_PREFAULT_SIZE (2UL << 20)
+
+/**
+ * Policy file, memory-mapped as is (see tools/semalloc-policy.py):
+ *      site_policy_header_t, then n site_policy_entry_t.
+ * A CSI matches an entry if low <= (CSI & mask) <= high; the first match wins.
+ * Masking with 0xFFFF ignores the recursion hash.
+ */
+struct site_policy_header_t {
+    char magic[8];
+    uint32_t n;
+    uint32_t unused;
+};
+
+struct site_policy_entry_t {
+    uint32_t low;
+    uint32_t high;
+    uint32_t mask;
+    uint32_t policy;
+};
+
+class SitePolicy {
+private:
+    static const site_policy_entry_t* entries;
+    static uint32_t entryN;
+
+public:
+    static void LoadSitePolicy(const char* path);
+
+    static bool loaded() {
+        return entryN != 0;
+    }
+
+    // once per CSI, when its directory entry is created
+    static uint32_t lookup(size_t CSI) {
+        for (uint32_t i = 0; i < entryN; i++) {
+            uint32_t masked = CSI & entries[i].mask;
+            if (masked >= entries[i].low && masked <= entries[i].high) {
+                return entries[i].policy;
+            }
+        }
+        return SITE_DEFAULT;
+    }
+};
+
+#endif //semalloc_SITEPOLICY_HH
@@ -0,0 +1,103 @@
+#ifndef semalloc_STATS_HH
+#define semalloc_STATS_HH
+#include "defines.hh"
+
+enum STAT_PATH {
+    STAT_GLOBAL,        // not in a loop
+    STAT_LAZY,          // a loop CSI kept in the global bags
+    STAT_INDIVIDUAL,    // a loop CSI served by its own BIBOP
+    STAT_HUGE,
+    STAT_PATH_N
+};
+
+// with the latency option, slow paths are always timed and the fast paths sampled
+enum LATENCY_PATH {
+    LATENCY_MALLOC,     // one of LATENCY_SAMPLE_PERIOD calls
+    LATENCY_FREE,       // one of LATENCY_SAMPLE_PERIOD calls
+    LATENCY_EXTEND,     // a new chunk from acquireIndividualDataPool
+    LATENCY_NEW_BIBOP,  // an individual BIBOP for a CSI
+    LATENCY_HUGE,       // the mmap of a huge object
+    LATENCY_DRAIN,      // draining the remote frees
+    LATENCY_PROBE,      // CSI probes, from their LATENCY_LONG_PROBE-th slot on
+    LATENCY_PATH_N
+};
+
+/**
+ * Log-linear latency buckets in TSC ticks, as in HDR histograms: every power of two is split
+ * into 2^LATENCY_SUB_BITS linear steps, so a bucket is at most 1/8 of its value wide.
+ * Values from 2^LATENCY_MAX_BIT ticks on share the last bucket.
+ */
+#define LATENCY_SUB_BITS 3
+#define LATENCY_MAX_BIT 36
+#define LATENCY_BUCKET_N ((LATENCY_MAX_BIT - LATENCY_SUB_BITS + 2) << LATENCY_SUB_BITS)
+
+static inline size_t latencyBucket(uint64_t ticks) {
+    if (ticks < (1 << LATENCY_SUB_BITS)) {
+        return ticks;
+    }
+    unsigned bit = 63 - __builtin_clzll(ticks);
+    size_t index = ((size_t)(bit - LATENCY_SUB_BITS + 1) << LATENCY_SUB_BITS) |
+                   ((ticks >> (bit - LATENCY_SUB_BITS)) & ((1 << LATENCY_SUB_BITS) - 1));
+    return index < LATENCY_BUCKET_N ? index : LATENCY_BUCKET_N - 1;
+}
+
+// the lowest value of a bucket
+static inline uint64_t latencyBucketValue(size_t index) {
+    if (index < (1 << LATENCY_SUB_BITS)) {
+        return index;
+    }
+    unsigned bit = (index >> LATENCY_SUB_BITS) + LATENCY_SUB_BITS - 1;
+    uint64_t mantissa = (1 << LATENCY_SUB_BITS) | (index & ((1 << LATENCY_SUB_BITS) - 1));
+    return mantissa << (bit - LATENCY_SUB_BITS);
+}
+
+/**
+ * Allocation counters. Every manager owns one set, written only by its thread (or by the one
+ * thread using a heap) with plain relaxed stores, and on a cache line of its own; readers sum
+ * them without stopping anyone. Bytes include the object header.
+ */
+struct semalloc_stats_t {
+    size_t mallocN[STAT_PATH_N];
+    size_t mallocBytes[STAT_PATH_N];
+    size_t classN[GLOBAL_BAG_N];        // regular allocations per size class, any path
+    size_t classBytes[GLOBAL_BAG_N];
+    size_t freeN;                       // regular frees by the owner
+    size_t remoteFreeN;                 // regular frees by other threads, counted when drained
+    size_t individualPoolN;             // individual BIBOPs created
+    size_t latency[LATENCY_PATH_N][LATENCY_BUCKET_N]; // events per latencyBucket, all zero without the option
+    size_t managerN;                    // managers summed into a snapshot
+    size_t tscHz;                       // set by the snapshot, to turn ticks into time
+};
+
+#define STAT_FIELD_N (sizeof(semalloc_stats_t) / sizeof(size_t))
+
+// nanoseconds at quantile q (0.5 for p50) of a latency histogram, the middle of its bucket
+static inline double latencyPercentile(const size_t* histogram, size_t tscHz, double q) {
+    size_t total = 0;
+    for (size_t i = 0; i < LATENCY_BUCKET_N; i++) {
+        total += histogram[i];
+    }
+    if (total == 0 || tscHz == 0) {
+        return 0;
+    }
+
+    size_t rank = (size_t)(q * (double)total);
+    size_t seen = 0;
+    size_t i = 0;
+    for (; i < LATENCY_BUCKET_N - 1; i++) {
+        seen += histogram[i];
+        if (seen > rank) {
+            break;
+        }
+    }
+    uint64_t low = latencyBucketValue(i);
+    uint64_t high = i < LATENCY_BUCKET_N - 1 ? latencyBucketValue(i + 1) : low;
+    return (double)(low + high) / 2 * 1e9 / (double)tscHz;
+}
+
+// no lock prefix: only the owner writes, the atomics just keep the readers' loads whole
+static inline void statAdd(size_t* counter, size_t n) {
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+}
+
+#endif //semalloc_STATS_HH
@@ -0,0 +1,110 @@
+#ifndef semalloc_TRACE_HH
+#define semalloc_TRACE_HH
+#include <atomic>
+#include "defines.hh"
+#include "HelperObjects.hh"
+#include "Clock.hh"
+
+/**
+ * Binary event trace, compiled in with the LOG_TO_FILE option and started with
+ * SEMALLOC_OPTIONS=trace=PATH. Every thread appends fixed-size events to a ring of its own;
+ * a flusher thread drains the rings into PATH through a sliding memory-mapped window.
+ * A full ring drops events (the count is in the file header), it never blocks the thread.
+ * tools/semalloc-trace.py turns the file into CSV or JSON.
+ */
+#define TRACE_MAGIC "SEMTRC01"
+#define TRACE_RING_N (1 << 14)                  // events per thread, a power of two
+#define TRACE_FLUSH_MS 10
+#define TRACE_WINDOW_SIZE (16UL << 20)          // bytes of the file mapped at a time
+
+enum TRACE_TYPE : uint8_t {
+    TRACE_MALLOC,
+    TRACE_FREE,
+    TRACE_REALLOC,
+};
+
+enum TRACE_PATH : uint8_t {
+    TRACE_PATH_GLOBAL,      // global bag
+    TRACE_PATH_INDIVIDUAL,  // BIBOP of a loop CSI
+    TRACE_PATH_HUGE,
+    TRACE_PATH_REMOTE,      // free of another thread's object
+    TRACE_PATH_NONE,        // NULL in or out
+};
+
+struct trace_event_t {
+    uint64_t tsc;       // at the start of the call
+    uint64_t ptr;
+    uint64_t bibop;
+    uint32_t size;      // requested, without the CSI bits
+    uint32_t CSI;
+    uint32_t latency;   // TSC ticks spent in the call
+    uint16_t thread;
+    uint8_t type;       // TRACE_TYPE
+    uint8_t path;       // TRACE_PATH
+    uint8_t sizeClass;  // GLOBAL_BAG_N for huge objects
+    uint8_t unused[7];
+};
+
+struct trace_header_t {
+    char magic[8];
+    uint32_t eventSize;
+    uint32_t unused;
+    uint64_t tscHz;     // filled in when the trace stops
+    uint64_t eventN;
+    uint64_t droppedN;
+    char padding[24];
+};
+
+struct trace_ring_t {
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> head; // written by the thread
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> tail; // written by the flusher
+    std::atomic<uint64_t> dropped; // written by the thread
+    trace_event_t events[TRACE_RING_N];
+};
+
+class EventTrace {
+private:
+    static trace_ring_t* rings[MAX_MANAGER];
+
+    static void flush();
+    static void* flusher(void*);
+    static trace_ring_t* acquireRing(size_t thread);
+
+public:
+    static std::atomic<bool> enabled;
+
+    static void Start(const char* path);
+    static void Stop();
+
+    // what the header of a live object tells; call before the object is freed
+    static void describe(trace_event_t* event, void* ptr, size_t thread);
+
+    static void record(size_t thread, trace_event_t* event, uint8_t type, size_t size, uint64_t start) {
+        event->tsc = start;
+        event->latency = (uint32_t)(readTSC() - start);
+        event->thread = thread;
+        event->type = type;
+        if (size & CSI_HUGE_SIZE_BIT_MASK) {
+            size &= CSI_HUGE_SIZE_SIZE_MASK;
+            event->size = size < UINT32_MAX ? size : UINT32_MAX;
+            event->CSI = 0;
+        } else {
+            event->size = GET_REAL_SIZE(size);
+            event->CSI = (size & CSI_BIT_MASK) >> 32;
+        }
+
+        trace_ring_t* ring = rings[thread] ? rings[thread] : acquireRing(thread);
+        if (ring == nullptr) {
+            return;
+        }
+        uint64_t head = ring->head.load(std::memory_order_relaxed);
+        if (head - ring->tail.load(std::memory_order_acquire) >= TRACE_RING_N) {
+            ring->dropped.store(ring->dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return;
+        }
+        ring->events[head & (TRACE_RING_N - 1)] = *event;
+        ring->head.store(head + 1, std::memory_order_release);
+    }
+};
+
+#endif //semalloc_TRACE_HH
@@ -15,18 +15,42 @@
 // #define INFO2
 //  #define DEBUG
 //#define ENABLE_ASSERTS
-#define STAT
+#define STAT // per-manager allocation counters, see Stats.hh
+#define CSI_PROFILE // per-CSI counters behind the profile option, needs STAT, see Profile.hh
+#define HEAP_SAMPLING // sampled heap profile behind the heap_profile option, see HeapSample.hh
+#define HEAP_SAMPLE_INTERVAL (512UL << 10) // bytes between two samples on average
+#define LATENCY_HISTOGRAM // per-path latency histograms behind the latency option, needs STAT, see Stats.hh
+#define LATENCY_SAMPLE_PERIOD 64 // one of this many malloc and free calls is timed, a power of two
+#define LATENCY_LONG_PROBE 8 // CSI probes are timed once they pass this many slots
+#define USDT_PROBES // static tracepoints on the slow paths, a nop each, see Probes.hh
+#define LIVE_STATS // shared-memory stats page behind the live_stats option, needs STAT, see LiveStats.hh
 
 #define LAZY_LOOP
-#define LAZY_OCCUR 2
+#define LAZY_OCCUR 2 // warm-up allocations of a loop CSI before it can be promoted
+// a loop CSI is promoted to its own BIBOP once it allocates LAZY_PROMOTE_COUNT objects within
+// LAZY_PROMOTE_WINDOW loop allocations of its thread; it is demoted back to the global bags after
+// LAZY_DEMOTE_TINY_N windows of LAZY_DEMOTE_WINDOW own allocations with fewer than LAZY_DEMOTE_LIVE
+// live objects. Every demotion doubles the rate needed for the next promotion.
+#define LAZY_PROMOTE_COUNT 4
+#define LAZY_PROMOTE_WINDOW 4096
+#define LAZY_DEMOTE_LIVE 4
+#define LAZY_DEMOTE_WINDOW 4096
+#define LAZY_DEMOTE_TINY_N 2
+#define LAZY_BACKOFF_MAX 4
+#define PREFAULT_SIZE 0 // bytes populated at the start of every new chunk, 0 is off
+#define PREFAULT_BUDGET (256UL << 20) // bytes the prefault policy may populate over the process lifetime
+#define SHARED_CSI_KNOWLEDGE // threads inherit the promotions of the others, see CSIKnowledge.hh
 #include "debug.hh"
 
 /// global definitions
 
 #define MAX_THREAD 128
+#define MAX_HEAP 128 // explicit heaps take the manager slots after the threads
+#define MAX_MANAGER (MAX_THREAD + MAX_HEAP)
 
 #define PAGE_SIZE_BIT 12
 #define PAGE_SIZE (1 << PAGE_SIZE_BIT)
+#define CACHE_LINE_SIZE 64
 #define MIN_BAG_SIZE 16
 
 #define GLOBAL_BAG_N 14
@@ -57,6 +81,32 @@
 #define AGGRESSIVE_MEMORY_RELEASE
 #define MEMORY_RELEASE_THRESHOLD (8 * 4096)
 
+// memory budget: under memory pressure purge freed pages and keep loop CSIs in the global bags
+#define MEMORY_BUDGET
+#define BUDGET_CGROUP_PERCENT 90 // share of the cgroup memory.max taken as the budget if none is given
+#define BUDGET_PRESSURE_AVG10 10 // PSI "some avg10" threshold, in percent
+#define BUDGET_POLL_MS 100
+#define BUDGET_POLL_ALLOCATIONS 4096 // allocations of a manager between two looks at the clock
+
+// cache coloring: every new chunk starts its bump at a rotating cache-line offset,
+// so the first objects of different BIBOPs do not all land in the same cache sets
+#define BIBOP_COLORING
+#define BIBOP_COLOR_N (PAGE_SIZE / CACHE_LINE_SIZE)
+#define BIBOP_COLOR(n) (((n) % BIBOP_COLOR_N) * CACHE_LINE_SIZE)
+
+// free tracking: an intrusive LIFO free list by default, or per-page free bitmaps
+// (a page is a run of 64 slots) that allocate from the fullest page and purge empty ones
+// #define BITMAP_FREE_TRACKING
+#define BITMAP_CHUNK_SIZE INDIVIDUAL_BIBOP_SIZE
+#define BITMAP_CANDIDATE_N 4
+
+// nursery: an individual BIBOP whose CSI never has more than a few objects live at once turns into
+// a bump-only region, reset when its last object is freed, behind the nursery option, see SingleBIBOP.hh
+#define NURSERY
+#define NURSERY_WINDOW 1024 // allocations of a BIBOP over which its live objects are watched
+#define NURSERY_REGION_SIZE (256UL << 10) // bytes a nursery bumps through, at least twice LIVE objects
+#define NURSERY_BACKOFF_MAX 4 // every fallback doubles the window, up to this many times
+
 #define LOG2(x) ((unsigned) (8*sizeof(unsigned long long) - __builtin_clzll((x - 1))))
 
 enum BIBOP_TYPE {
@@ -8,11 +8,28 @@
 #include "defines.hh"
 #include "BIBOP.hh"
 #include "MemoryManager.hh"
+#include "HeapWalk.hh"
+#include "CSIDirectory.hh"
 
 void* css_malloc(size_t size);
 
 void css_free(void* ptr);
 
+void css_free_sized(void* ptr, size_t size);
+
+void css_free_aligned_sized(void* ptr, size_t alignment, size_t size);
+
+size_t css_malloc_batch(size_t count, size_t size, size_t csi, void** out);
+
+void css_free_batch(void** ptrs, size_t n);
+
+// Populate the memory the next count objects of (csi, size) will take on this thread, so a
+// latency-critical phase does not fault on them. A non-zero csi is a loop site: it is promoted
+// for good, like a dedicated site of the site policy, so neither demotion nor the pressure mode
+// of a memory budget moves it back to the global bags. csi 0 warms the global bag of the size.
+// Returns the objects covered, at most the rest of the current chunk, 0 if no BIBOP is left.
+size_t semalloc_prewarm(size_t csi, size_t size, size_t count);
+
 void* css_realloc(void *ptr, size_t size);
 
 void* css_calloc(size_t nmemb, size_t size);
@@ -23,8 +40,74 @@ int css_posix_memalign(void**, size_t, size_t);
 
 void* css_aligned_alloc(size_t, size_t);
 
+// The wide-CSI convention, see CSIDirectory.hh: size is a plain size of up to 64 bits and context
+// the site, laid out as WIDE_CONTEXT_*. The analyzer emits calls to these when built with WIDE_CSI,
+// so their names are not mangled. Objects are freed with css_free.
+extern "C" {
+void* css_malloc_wide(size_t size, uint64_t context);
+
+void* css_calloc_wide(size_t nmemb, size_t size, uint64_t context);
+
+void* css_realloc_wide(void* ptr, size_t size, uint64_t context);
+
+void* css_memalign_wide(size_t alignment, size_t size, uint64_t context);
+
+int css_posix_memalign_wide(void** ptr, size_t alignment, size_t size, uint64_t context);
+}
+
+// Contexts the wide-CSI directory numbered, and how many of them the narrow encoding would have
+// merged with an earlier one.
+void semalloc_csi_directory_stats(semalloc_csi_directory_stats_t* stats);
+
 void semalloc_finalize();
 
+// An explicit heap is a MemoryManager of its own, with the same CSI segregation as a thread.
+// It is not locked: use it from one thread at a time. Objects may still be freed from any
+// thread with css_free. Destroying a heap releases all of its memory at once; it waits for
+// running stats snapshots, usage reports and heap walks to finish.
+typedef MemoryManager semalloc_heap;
+
+semalloc_heap* semalloc_heap_create();
+
+void semalloc_heap_destroy(semalloc_heap* heap);
+
+void* semalloc_heap_malloc(semalloc_heap* heap, size_t size);
+
+void semalloc_heap_free(semalloc_heap* heap, void* ptr);
+
 size_t css_malloc_usable_size(void*);
 
+// Give the whole free pages of all managers back to the system. The calling thread trims its
+// own manager, the managers of exited threads and the heaps no call runs on at once; every other
+// thread or heap does so on its next malloc or free. Returns 1 if memory was released right away.
+int css_trim();
+
+// Arena, in-use and free bytes of the global bags, the individual BIBOPs and the huge mappings.
+// Counters of other threads are read without synchronisation, so the numbers are approximate.
+// A heap destroyed meanwhile waits for the report to finish.
+void css_usage(semalloc_usage_t* usage);
+
+void css_malloc_stats(FILE* out);
+
+// Sum the allocation counters of every manager (see Stats.hh) without stopping any thread.
+// All zero if the library is built without STAT.
+void semalloc_stats_snapshot(semalloc_stats_t* stats);
+
+int css_malloc_info(FILE* out);
+
+// Write the sampled heap profile (see HeapSample.hh) to path, or to the heap_profile path if
+// path is NULL. Returns 0, or -1 if sampling is off or the file cannot be written.
+int semalloc_heap_profile_dump(const char* path);
+
+// Call callback for every carved slot of every BIBOP, allocated or not (see HeapWalk.hh), without
+// stopping other threads. Returns 1 if the callback ended the walk, 0 otherwise. Heaps are not
+// destroyed during a walk, so the callback must not destroy one or start another walk.
+int semalloc_heap_walk(semalloc_walk_callback callback, void* arg);
+
+// Write the fragmentation report (see HeapWalk.hh) to path, or to the frag_report path if path is
+// NULL. Returns 0, or -1 if there is no path, the file cannot be written or a report is running.
+int semalloc_fragmentation_report(const char* path);
+
+size_t css_good_size(size_t size);
+
 #endif //BACKEND_semalloc_HH
@@ -5,22 +5,17 @@
 #ifndef semalloc_THREADS_H
 #define semalloc_THREADS_H
 #include <atomic>
+#include <pthread.h>
 #include "MemoryManager.hh"
+#include "Trace.hh"
+#include "LiveStats.hh"
+#include "CallSite.hh"
 
-extern MemoryManager* globalMemoryManager[MAX_THREAD];
+extern MemoryManager* globalMemoryManager[MAX_MANAGER];
 extern std::atomic<size_t> thread_bump;
 extern __thread size_t thread_id;
 extern __thread size_t tid;
 
-#ifdef STAT
-    extern size_t* n_malloc;
-    extern size_t* n_individual_pool;
-    extern size_t* n_individual_allocation;
-    extern size_t* s_lazy_memory;
-    extern size_t* s_global_memory;
-    extern size_t* s_rec_memory;
-#endif
-
 //! Fast thread ID
 // https://github.com/mjansson/rpmalloc
 inline uintptr_t get_thread_id() {
@@ -53,43 +48,111 @@ inline uintptr_t get_thread_id() {
 }
 
 
-void init_thread() {
+static pthread_key_t threadExitKey;
+static __thread bool threadExited;
+
+static void orphanManager(void* manager) {
+    ((MemoryManager*)manager)->orphan();
+    // libc still frees after the key destructors, those go to the owners' remote lists (css_free);
+    // a malloc takes a manager again and gives it back in the next destructor round
+    threadExited = true;
+    tid = 0;
+}
+
+static void createThreadExitKey() {
+    pthread_key_create(&threadExitKey, orphanManager);
+}
+
+// a manager left by an exited thread, or a new one; the thread slots end where the heaps start
+static MemoryManager* acquireManager() {
+    size_t threadN = thread_bump.load(std::memory_order_acquire);
+    for (size_t id = 0; id < threadN && id < MAX_THREAD; id++) {
+        auto* manager = __atomic_load_n(&globalMemoryManager[id], __ATOMIC_ACQUIRE);
+        if (manager != nullptr && manager->adopt()) {
+            Debug("thread adopts manager %zu\n", id);
+            return manager;
+        }
+    }
+
     size_t currentThreadID = std::atomic_fetch_add_explicit(&thread_bump, 1, std::memory_order_acquire);
-    globalMemoryManager[currentThreadID] = MemoryManager::AllocateMemoryManager(currentThreadID);
-    thread_id = currentThreadID;
-    tid = get_thread_id();
+    if (currentThreadID >= MAX_THREAD) {
+        Error("Thread max reached (max=%d), no manager for a new thread\n", MAX_THREAD);
+        abort();
+    }
+    auto* manager = MemoryManager::AllocateMemoryManager(currentThreadID);
+    __atomic_store_n(&globalMemoryManager[currentThreadID], manager, __ATOMIC_RELEASE);
+    return manager;
+}
 
-#ifdef STAT
-    if (thread_id == 0) {
-        n_malloc = (size_t*)mmap(nullptr, PAGE_SIZE, PROT_READ | PROT_WRITE,
-                        MAP_PRIVATE | MAP_ANON |MAP_NORESERVE, -1, 0);
-        n_individual_pool = (size_t*)mmap(nullptr, PAGE_SIZE, PROT_READ | PROT_WRITE,
-                                          MAP_PRIVATE | MAP_ANON |MAP_NORESERVE, -1, 0);
-        n_individual_allocation = (size_t*)mmap(nullptr, PAGE_SIZE, PROT_READ | PROT_WRITE,
-                                                MAP_PRIVATE | MAP_ANON |MAP_NORESERVE, -1, 0);
-        s_lazy_memory = (size_t*)mmap(nullptr, PAGE_SIZE, PROT_READ | PROT_WRITE,
-                                                MAP_PRIVATE | MAP_ANON |MAP_NORESERVE, -1, 0);
-        s_global_memory = (size_t*)mmap(nullptr, PAGE_SIZE, PROT_READ | PROT_WRITE,
-                                           MAP_PRIVATE | MAP_ANON |MAP_NORESERVE, -1, 0);
-        s_rec_memory = (size_t*)mmap(nullptr, PAGE_SIZE, PROT_READ | PROT_WRITE,
-                                                MAP_PRIVATE | MAP_ANON |MAP_NORESERVE, -1, 0);
+void init_thread() {
+    Options::InitOptions();
+    static pthread_once_t keyOnce = PTHREAD_ONCE_INIT;
+    pthread_once(&keyOnce, createThreadExitKey);
+
+    MemoryManager* manager = acquireManager();
+    thread_id = manager->getThreadId();
+    tid = get_thread_id();
+    pthread_setspecific(threadExitKey, manager);
+    CallSite::InitThread();
 
+#ifdef LOG_TO_FILE
+    // the flusher thread is started once a manager can serve its allocations
+    static std::atomic<bool> traceStarted;
+    if (semallocOptions.traceFile[0] && !traceStarted.exchange(true)) {
+        EventTrace::Start(semallocOptions.traceFile);
+    }
+#endif
+    SiteProfile::StartDumpThread();
+#if defined(LIVE_STATS) && defined(STAT)
+    static std::atomic<bool> liveStarted;
+    if (semallocOptions.liveStats && !liveStarted.exchange(true)) {
+        LiveStats::Start(semallocOptions.liveStats);
     }
 #endif
 }
 
 #ifdef STAT
 void semalloc_finalize() {
-    if (thread_id != 0) {
+    if (!semallocOptions.stat) {
         return;
     }
 
-    fprintf(stderr, "Number of allocations: %zu\n", *n_malloc);
-    fprintf(stderr, "Number of individual pools: %zu\n", *n_individual_pool);
-    fprintf(stderr, "Number of individual allocations: %zu\n", *n_individual_allocation + *n_individual_pool);
-    fprintf(stderr, "Size of lazy memory: %zu\n", *s_lazy_memory);
-    fprintf(stderr, "Size of global memory (note the thread spawn takes space): %zu\n", *s_global_memory);
-    fprintf(stderr, "Size recycling memory: %zu\n", *s_rec_memory);
+    semalloc_stats_t stats;
+    semalloc_stats_snapshot(&stats);
+    fprintf(stderr, "Number of allocations: %zu\n",
+            stats.mallocN[STAT_GLOBAL] + stats.mallocN[STAT_LAZY] + stats.mallocN[STAT_INDIVIDUAL]);
+    fprintf(stderr, "Number of individual pools: %zu\n", stats.individualPoolN);
+    fprintf(stderr, "Number of individual allocations: %zu\n", stats.mallocN[STAT_INDIVIDUAL]);
+    fprintf(stderr, "Number of huge allocations: %zu\n", stats.mallocN[STAT_HUGE]);
+    fprintf(stderr, "Number of frees (remote): %zu (%zu)\n", stats.freeN + stats.remoteFreeN, stats.remoteFreeN);
+    fprintf(stderr, "Size of lazy memory: %zu\n", stats.mallocBytes[STAT_LAZY]);
+    fprintf(stderr, "Size of global memory (note the thread spawn takes space): %zu\n", stats.mallocBytes[STAT_GLOBAL]);
+    fprintf(stderr, "Size recycling memory: %zu\n", stats.mallocBytes[STAT_INDIVIDUAL]);
+    fprintf(stderr, "Size of huge memory: %zu\n", stats.mallocBytes[STAT_HUGE]);
+
+    semalloc_csi_directory_stats_t sites;
+    semalloc_csi_directory_stats(&sites);
+    if (sites.contexts) {
+        fprintf(stderr, "Wide CSI sites (narrow CSI shared, over the directory): %zu (%zu, %zu)\n",
+                sites.contexts, sites.narrowShared, sites.overflowN);
+    }
+
+    static const char* latencyNames[LATENCY_PATH_N] = {
+            "malloc", "free", "extend", "new bibop", "huge", "drain", "probe"
+    };
+    for (size_t path = 0; path < LATENCY_PATH_N; path++) {
+        size_t n = 0;
+        for (size_t count : stats.latency[path]) {
+            n += count;
+        }
+        if (n) {
+            fprintf(stderr, "Latency of %s (%zu timed): p50 %.0f ns, p99 %.0f ns, p99.9 %.0f ns\n",
+                    latencyNames[path], n,
+                    latencyPercentile(stats.latency[path], stats.tscHz, 0.5),
+                    latencyPercentile(stats.latency[path], stats.tscHz, 0.99),
+                    latencyPercentile(stats.latency[path], stats.tscHz, 0.999));
+        }
+    }
 }
 #endif
 
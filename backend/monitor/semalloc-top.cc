@@ -0,0 +1,153 @@
+// semalloc-top: watch the live statistics of a process started with SEMALLOC_OPTIONS=live_stats=MS
+//
+//      semalloc-top [-d SECONDS] [-n COUNT] PID
+//
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#include "LiveStats.hh"
+
+static const char* human(size_t bytes, char* buffer, size_t length) {
+    const char* units = "BKMGT";
+    double value = (double)bytes;
+    while (value >= 1024 && units[1]) {
+        value /= 1024;
+        units++;
+    }
+    snprintf(buffer, length, *units == 'B' ? "%.0f%c" : "%.1f%c", value, *units);
+    return buffer;
+}
+
+static double rate(size_t now, size_t before, double seconds) {
+    return seconds > 0 && now >= before ? (double)(now - before) / seconds : 0;
+}
+
+static const live_thread_t* findThread(const live_page_t* page, uint16_t id) {
+    for (uint32_t i = 0; i < page->threadN; i++) {
+        if (page->threads[i].id == id) {
+            return &page->threads[i];
+        }
+    }
+    return nullptr;
+}
+
+static void show(const live_page_t* now, const live_page_t* before) {
+    char a[16], b[16], c[16], d[16];
+    double seconds = before ? (double)(now->timeNs - before->timeNs) / 1e9 : 0;
+
+    size_t inUse = now->usage.global.inUse + now->usage.individual.inUse;
+    size_t arena = now->usage.global.arena + now->usage.individual.arena;
+    printf("semalloc-top  pid %u  rss %s  in use %s of %s  huge %zu (%s)  published every %u ms\n\n",
+           now->pid, human(now->rss, a, sizeof a), human(inUse, b, sizeof b), human(arena, c, sizeof c),
+           now->usage.huge.blocks, human(now->usage.huge.inUse, d, sizeof d), now->intervalMs);
+
+    printf("%-8s %12s %12s %12s %10s %10s %10s\n", "THREAD", "MALLOC/s", "FREE/s", "REMOTE/s", "BACKLOG", "IN USE",
+           "ARENA");
+    for (uint32_t i = 0; i < now->threadN; i++) {
+        const live_thread_t* thread = &now->threads[i];
+        const live_thread_t* last = before ? findThread(before, thread->id) : nullptr;
+        char name[16];
+        snprintf(name, sizeof name, thread->heap ? "heap %u" : "%u", thread->id);
+        printf("%-8s %12.0f %12.0f %12.0f %10zu %10s %10s\n", name,
+               last ? rate(thread->mallocN, last->mallocN, seconds) : 0,
+               last ? rate(thread->freeN, last->freeN, seconds) : 0,
+               last ? rate(thread->remoteFreeN, last->remoteFreeN, seconds) : 0,
+               thread->remoteBacklog, human(thread->inUse, a, sizeof a), human(thread->arena, b, sizeof b));
+    }
+
+    printf("\n%-8s %12s %10s %10s %10s\n", "BAG", "MALLOC/s", "IN USE", "ARENA", "FREE");
+    for (size_t i = 0; i < GLOBAL_BAG_N; i++) {
+        const live_bag_t* bag = &now->bags[i];
+        if (bag->usage.arena == 0 && bag->mallocN == 0) {
+            continue;
+        }
+        printf("%-8d %12.0f %10s %10s %10s\n", MIN_BAG_SIZE << i,
+               before ? rate(bag->mallocN, before->bags[i].mallocN, seconds) : 0,
+               human(bag->usage.inUse, a, sizeof a), human(bag->usage.arena, b, sizeof b),
+               human(bag->usage.free, c, sizeof c));
+    }
+
+    if (now->siteN) {
+        printf("\n%-12s %8s %10s %10s\n", "CSI", "BIBOPS", "IN USE", "ARENA");
+    }
+    for (uint32_t i = 0; i < now->siteN; i++) {
+        const live_site_t* site = &now->sites[i];
+        printf("0x%-10x %8u %10s %10s\n", site->CSI, site->bibopN, human(site->inUse, a, sizeof a),
+               human(site->arena, b, sizeof b));
+    }
+    fflush(stdout);
+}
+
+static void usage(const char* self) {
+    fprintf(stderr, "usage: %s [-d SECONDS] [-n COUNT] PID\n", self);
+    exit(2);
+}
+
+int main(int argc, char** argv) {
+    double delay = 1;
+    long count = -1;
+    int option;
+    while ((option = getopt(argc, argv, "d:n:")) != -1) {
+        if (option == 'd') {
+            delay = atof(optarg);
+        } else if (option == 'n') {
+            count = atol(optarg);
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (optind + 1 != argc || delay <= 0) {
+        usage(argv[0]);
+    }
+
+    auto pid = (uint32_t)atol(argv[optind]);
+    char name[32];
+    liveStatsName(name, pid);
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        fprintf(stderr, "%s: no live stats for pid %u, is it running with SEMALLOC_OPTIONS=live_stats=MS?\n",
+                argv[0], pid);
+        return 1;
+    }
+    auto* shared = (const live_page_t*)mmap(nullptr, sizeof(live_page_t), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (shared == MAP_FAILED || memcmp(shared->magic, LIVE_STATS_MAGIC, sizeof shared->magic) != 0 ||
+        shared->size != sizeof(live_page_t)) {
+        fprintf(stderr, "%s: %s is not a live stats page of this version\n", argv[0], name);
+        return 1;
+    }
+
+    static live_page_t pages[2];
+    live_page_t* now = &pages[0];
+    live_page_t* before = nullptr;
+    bool terminal = isatty(STDOUT_FILENO);
+    struct timespec period = {(time_t)delay, (long)((delay - (time_t)delay) * 1e9)};
+    for (long i = 0; count < 0 || i < count; i++) {
+        if (kill((pid_t)pid, 0) != 0) {
+            fprintf(stderr, "%s: pid %u is gone\n", argv[0], pid);
+            return 1;
+        }
+        if (!liveStatsRead(shared, now)) {
+            fprintf(stderr, "%s: the page of pid %u stays busy\n", argv[0], pid);
+            return 1;
+        }
+
+        if (terminal) {
+            printf("\033[H\033[2J");
+        } else if (i) {
+            printf("\n");
+        }
+        show(now, before);
+
+        before = now;
+        now = now == &pages[0] ? &pages[1] : &pages[0];
+        if (count < 0 || i + 1 < count) {
+            nanosleep(&period, nullptr);
+        }
+    }
+    return 0;
+}
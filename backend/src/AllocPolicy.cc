@@ -0,0 +1,30 @@
+#include "AllocPolicy.hh"
+#include "Options.hh"
+#include "SitePolicy.hh"
+#include "MemoryBudget.hh"
+#include "Profile.hh"
+
+uint32_t AllocPolicy::Select() {
+    uint32_t variant = 0;
+#ifdef STAT
+    if (semallocOptions.stat || semallocOptions.liveStats || SiteProfile::enabled) {
+        variant |= ALLOC_COUNTED;
+    }
+#endif
+#ifdef LAZY_LOOP
+    if (semallocOptions.lazyLoop || SitePolicy::loaded()) {
+        variant |= ALLOC_LAZY;
+    }
+#endif
+#ifdef MEMORY_BUDGET
+    if (MemoryBudget::enabled) {
+        variant |= ALLOC_BUDGETED;
+    }
+#endif
+#if defined(LATENCY_HISTOGRAM) && defined(STAT)
+    if (semallocOptions.latency) {
+        variant |= ALLOC_TIMED;
+    }
+#endif
+    return variant;
+}
@@ -0,0 +1,98 @@
+#include "CSIDirectory.hh"
+#include "CallSite.hh"
+
+#define CSI_DIRECTORY_LEAF_SIZE ((sizeof(csi_directory_slot_t)) << CSI_DIRECTORY_LEAF_BIT)
+#define NARROW_CSI_N (1UL << 30)
+
+std::atomic<csi_directory_slot_t*> CSIDirectory::root[1 << CSI_DIRECTORY_ROOT_BIT];
+std::atomic<uint32_t> CSIDirectory::nextCSI;
+std::atomic<size_t> CSIDirectory::narrowShared;
+std::atomic<size_t> CSIDirectory::overflowN;
+std::atomic<uint64_t*> CSIDirectory::narrowSeen;
+
+// the leaf of a root index, mapped by whichever thread needs it first
+csi_directory_slot_t* CSIDirectory::leaf(size_t index) {
+    csi_directory_slot_t* current = root[index].load(std::memory_order_acquire);
+    if (current != nullptr) {
+        return current;
+    }
+
+    void* mapped = mmap(nullptr, CSI_DIRECTORY_LEAF_SIZE, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANON | MAP_NORESERVE, -1, 0);
+    if (mapped == MAP_FAILED) {
+        Error("CSI directory leaf mmap failed (%zu bytes)\n", CSI_DIRECTORY_LEAF_SIZE);
+        return nullptr;
+    }
+
+    if (!root[index].compare_exchange_strong(current, (csi_directory_slot_t*)mapped, std::memory_order_acq_rel)) {
+        munmap(mapped, CSI_DIRECTORY_LEAF_SIZE);
+        return current;
+    }
+    return (csi_directory_slot_t*)mapped;
+}
+
+uint32_t CSIDirectory::lookup(uint64_t context) {
+    uint64_t key = WIDE_CONTEXT_KEY(context);
+    uint64_t mixed = key * AUTO_CSI_MULTIPLIER;
+    csi_directory_slot_t* slots = leaf(mixed >> (64 - CSI_DIRECTORY_ROOT_BIT));
+    if (slots == nullptr) {
+        return fallback(context);
+    }
+
+    size_t index = mixed >> (64 - CSI_DIRECTORY_ROOT_BIT - CSI_DIRECTORY_LEAF_BIT);
+    for (size_t i = 0; i < CSI_DIRECTORY_PROBE_N; i++) {
+        csi_directory_slot_t* slot = &slots[(index + i) & ((1 << CSI_DIRECTORY_LEAF_BIT) - 1)];
+        uint64_t current = slot->key.load(std::memory_order_acquire);
+        if (current == 0 && slot->key.compare_exchange_strong(current, key, std::memory_order_acq_rel)) {
+            return insert(slot, key, context);
+        }
+        if (current != key) {
+            continue;
+        }
+
+        // the inserting thread numbers the context right after its CAS
+        uint32_t CSI;
+        while ((CSI = slot->CSI.load(std::memory_order_acquire)) == 0) {
+        }
+        return CSI;
+    }
+
+    overflowN.fetch_add(1, std::memory_order_relaxed);
+    return fallback(context);
+}
+
+uint32_t CSIDirectory::insert(csi_directory_slot_t* slot, uint64_t key, uint64_t context) {
+    uint32_t CSI = WIDE_CSI_BASE + nextCSI.fetch_add(1, std::memory_order_relaxed);
+    slot->CSI.store(CSI, std::memory_order_release);
+    markNarrow(narrow(context));
+    Debug("Wide context %lx numbered %u\n", key, CSI);
+    return CSI;
+}
+
+void CSIDirectory::markNarrow(uint32_t CSI) {
+    uint64_t* bitmap = narrowSeen.load(std::memory_order_acquire);
+    if (bitmap == nullptr) {
+        void* mapped = mmap(nullptr, NARROW_CSI_N / 8, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANON | MAP_NORESERVE, -1, 0);
+        if (mapped == MAP_FAILED) {
+            Error("CSI directory bitmap mmap failed (%zu bytes)\n", NARROW_CSI_N / 8);
+            return;
+        }
+        if (!narrowSeen.compare_exchange_strong(bitmap, (uint64_t*)mapped, std::memory_order_acq_rel)) {
+            munmap(mapped, NARROW_CSI_N / 8);
+        } else {
+            bitmap = (uint64_t*)mapped;
+        }
+    }
+
+    uint64_t bit = 1UL << (CSI % 64);
+    if (__atomic_fetch_or(&bitmap[CSI / 64], bit, __ATOMIC_RELAXED) & bit) {
+        narrowShared.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void CSIDirectory::getStats(semalloc_csi_directory_stats_t* stats) {
+    stats->contexts = nextCSI.load(std::memory_order_relaxed);
+    stats->narrowShared = narrowShared.load(std::memory_order_relaxed);
+    stats->overflowN = overflowN.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,58 @@
+#include "CSIKnowledge.hh"
+
+csi_knowledge_t CSIKnowledge::table[CSI_KNOWLEDGE_N];
+
+csi_knowledge_t* CSIKnowledge::find(size_t CSI, bool insert) {
+    uint32_t key = CSI_KNOWLEDGE_KEY(CSI);
+    uint16_t index = hash(CSI);
+
+    for (uint32_t i = 0; i < CSI_KNOWLEDGE_N; i++) {
+        csi_knowledge_t* entry = &table[(uint16_t)(index + i)];
+        uint32_t current = entry->key.load(std::memory_order_acquire);
+        if (current == key) {
+            return entry;
+        }
+
+        if (current == 0) {
+            if (!insert) {
+                return nullptr;
+            }
+            if (entry->key.compare_exchange_strong(current, key, std::memory_order_acq_rel) || current == key) {
+                return entry;
+            }
+        }
+    }
+
+    // a full table only costs the warm-up
+    return nullptr;
+}
+
+void CSIKnowledge::publishPromotion(size_t CSI, size_t realSize, size_t sizeClass) {
+    csi_knowledge_t* entry = find(CSI, true);
+    if (entry == nullptr) {
+        return;
+    }
+
+    // the first promotion decides the size class the others inherit
+    if (entry->promoted.load(std::memory_order_relaxed)) {
+        return;
+    }
+
+    entry->sizeClass.store(sizeClass, std::memory_order_relaxed);
+    entry->promoted.store(1, std::memory_order_release);
+    Debug("Shared promotion of CSI %zu, size %zu\n", CSI, realSize);
+}
+
+void CSIKnowledge::publishDemotion(size_t CSI) {
+    csi_knowledge_t* entry = find(CSI, false);
+    if (entry == nullptr) {
+        return;
+    }
+
+    uint8_t demotions = entry->demotions.load(std::memory_order_relaxed);
+    if (demotions < UINT8_MAX) {
+        entry->demotions.store(demotions + 1, std::memory_order_relaxed);
+    }
+    entry->promoted.store(0, std::memory_order_release);
+    Debug("Shared demotion of CSI %zu\n", CSI);
+}
@@ -0,0 +1,40 @@
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "CallSite.hh"
+
+extern "C" void* __libc_stack_end;
+
+__thread uintptr_t callSiteStackTop;
+__thread uintptr_t callSiteStackBottom;
+
+// after the thread's manager is set up: pthread_getattr_np allocates
+void CallSite::InitThread() {
+    if (semallocOptions.autoCSI <= 1) {
+        return;
+    }
+
+    // the main thread's attributes come from /proc/self/maps, its stack ends below the environment
+    // and grows down at most the stack limit
+    if (getpid() == (pid_t)syscall(SYS_gettid)) {
+        struct rlimit limit;
+        uintptr_t top = (uintptr_t)__libc_stack_end;
+        if (getrlimit(RLIMIT_STACK, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY && limit.rlim_cur < top) {
+            callSiteStackBottom = top - limit.rlim_cur;
+        }
+        callSiteStackTop = top;
+        return;
+    }
+
+    pthread_attr_t attributes;
+    if (pthread_getattr_np(pthread_self(), &attributes) != 0) {
+        return;
+    }
+    void* stack;
+    size_t size;
+    if (pthread_attr_getstack(&attributes, &stack, &size) == 0) {
+        callSiteStackBottom = (uintptr_t)stack;
+        callSiteStackTop = (uintptr_t)stack + size;
+    }
+    pthread_attr_destroy(&attributes);
+}
@@ -0,0 +1,4 @@
+#include "Clock.hh"
+
+uint64_t Clock::startTSC;
+uint64_t Clock::startNs;
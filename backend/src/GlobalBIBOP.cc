@@ -2,6 +2,7 @@
 // Created by r53wang on 6/12/23.
 //
 #include "GlobalBIBOP.hh"
+#include "Probes.hh"
 
 void GlobalBIBOP::freeGlobalObject(void *ptr) {
     Debug("Enter Global Free %p\n", ptr);
@@ -11,8 +12,17 @@ void GlobalBIBOP::freeGlobalObject(void *ptr) {
     auto* bibop = (SingleBIBOP*)header->bibop;
     auto size = bibop->getObjectSize();
 
-    if (size >= MEMORY_RELEASE_THRESHOLD) {
+    if (size >= bibop->getReleaseThreshold()) {
+        SEMALLOC_PROBE2(release, header, (size >> PAGE_SIZE_BIT) << PAGE_SIZE_BIT);
         madvise(header, (size >> PAGE_SIZE_BIT) << PAGE_SIZE_BIT, MADV_DONTNEED);
     }
 #endif
 }
+
+void GlobalBIBOP::DestroyGlobalBIBOP() {
+    // later chunks of the bags come from the data pools and are released with them
+    for (int i = 0; i < GLOBAL_BAG_N; i++) {
+        munmap(regions[i], regionSize);
+        munmap(objects[i], sizeof(SingleBIBOP));
+    }
+}
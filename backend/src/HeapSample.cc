@@ -0,0 +1,257 @@
+#include <atomic>
+#include <cmath>
+#include <fcntl.h>
+#include "HeapSample.hh"
+#include "HelperObjects.hh"
+#include "DumpWriter.hh"
+#include "Options.hh"
+
+struct heap_sample_t {
+    uint64_t key;           // address of the header, 0 if the record is free
+    size_t size;
+    heap_bucket_t* bucket;
+    heap_sample_t* nxt;     // in its index chain, or in the free list
+    uint16_t owner;
+};
+
+bool HeapSampler::enabled;
+
+// samples are rare, one lock covers the buckets and the sample index
+static std::atomic_flag sampleLock = ATOMIC_FLAG_INIT;
+static heap_bucket_t* buckets;
+static heap_sample_t* samples;
+static heap_sample_t** sampleIndex;
+static heap_sample_t* freeSamples;
+static size_t sampleBump;
+static size_t droppedN;
+
+#define SAMPLE_INDEX(key) (((key) >> 4) & (HEAP_SAMPLE_N - 1))
+
+void HeapSampler::InitHeapSampler() {
+    size_t length = HEAP_BUCKET_N * sizeof(heap_bucket_t) + HEAP_SAMPLE_N * sizeof(heap_sample_t) +
+                    HEAP_SAMPLE_N * sizeof(heap_sample_t*);
+    void* data = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON | MAP_NORESERVE, -1, 0);
+    if (data == MAP_FAILED) {
+        Error("heap sampler mmap failed (%zu bytes)\n", length);
+        return;
+    }
+
+    buckets = (heap_bucket_t*)data;
+    samples = (heap_sample_t*)(buckets + HEAP_BUCKET_N);
+    sampleIndex = (heap_sample_t**)(samples + HEAP_SAMPLE_N);
+    enabled = true;
+}
+
+int64_t HeapSampler::nextInterval(uint64_t* seed) {
+    // xorshift64*, then -log(u) for an exponential draw around the mean interval
+    uint64_t x = *seed;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *seed = x;
+    double u = (double)((x * 0x2545F4914F6CDD1DUL) >> 11) / (double)(1UL << 53);
+    return (int64_t)(-std::log(1.0 - u) * (double)semallocOptions.sampleInterval) + 1;
+}
+
+// walk the frame pointers, giving up on the first frame that does not look like one
+static __attribute__((noinline)) uint32_t captureStack(uint64_t* stack) {
+    auto* fp = (uint64_t*)__builtin_frame_address(0);
+    uint32_t depth = 0;
+    while (depth < HEAP_SAMPLE_DEPTH && fp != nullptr && fp[1] != 0) {
+        stack[depth++] = fp[1];
+        auto* next = (uint64_t*)fp[0];
+        if (next <= fp || (uint64_t)next - (uint64_t)fp > (1UL << 20) || ((uint64_t)next & 7)) {
+            break;
+        }
+        fp = next;
+    }
+    return depth;
+}
+
+static heap_bucket_t* findBucket(uint64_t* stack, uint32_t depth, size_t CSI) {
+    uint64_t hash = 0xCBF29CE484222325UL ^ CSI;
+    for (uint32_t i = 0; i < depth; i++) {
+        hash = (hash ^ stack[i]) * 0x100000001B3UL;
+    }
+    hash |= 1;
+
+    for (size_t i = 0; i < HEAP_BUCKET_N; i++) {
+        heap_bucket_t* bucket = &buckets[(hash + i) & (HEAP_BUCKET_N - 1)];
+        if (bucket->hash == 0) {
+            bucket->CSI = CSI;
+            bucket->depth = depth;
+            memcpy(bucket->stack, stack, depth * sizeof(uint64_t));
+            // the dump reads the buckets without the lock
+            __atomic_store_n(&bucket->hash, hash, __ATOMIC_RELEASE);
+            return bucket;
+        }
+        if (bucket->hash == hash && bucket->CSI == CSI && bucket->depth == depth &&
+            memcmp(bucket->stack, stack, depth * sizeof(uint64_t)) == 0) {
+            return bucket;
+        }
+    }
+    return nullptr;
+}
+
+static void retire(heap_sample_t* record) {
+    heap_bucket_t* bucket = record->bucket;
+    __atomic_store_n(&bucket->liveN, bucket->liveN - 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&bucket->liveBytes, bucket->liveBytes - record->size, __ATOMIC_RELAXED);
+    record->key = 0;
+    record->nxt = freeSamples;
+    freeSamples = record;
+}
+
+bool HeapSampler::sample(void* headerAddress, size_t size, size_t CSI, uint16_t owner) {
+    uint64_t stack[HEAP_SAMPLE_DEPTH];
+    uint32_t depth = captureStack(stack);
+
+    while (sampleLock.test_and_set(std::memory_order_acquire));
+    heap_bucket_t* bucket = findBucket(stack, depth, CSI);
+    heap_sample_t* record = freeSamples;
+    if (record != nullptr) {
+        freeSamples = record->nxt;
+    } else if (sampleBump < HEAP_SAMPLE_N) {
+        record = &samples[sampleBump++];
+    }
+
+    if (bucket == nullptr || record == nullptr) {
+        if (record != nullptr) {
+            record->nxt = freeSamples;
+            freeSamples = record;
+        }
+        droppedN++;
+        sampleLock.clear(std::memory_order_release);
+        return false;
+    }
+
+    auto key = (uint64_t)headerAddress;
+    record->key = key;
+    record->size = size;
+    record->bucket = bucket;
+    record->owner = owner;
+    record->nxt = sampleIndex[SAMPLE_INDEX(key)];
+    sampleIndex[SAMPLE_INDEX(key)] = record;
+
+    __atomic_store_n(&bucket->allocN, bucket->allocN + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&bucket->allocBytes, bucket->allocBytes + size, __ATOMIC_RELAXED);
+    __atomic_store_n(&bucket->liveN, bucket->liveN + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&bucket->liveBytes, bucket->liveBytes + size, __ATOMIC_RELAXED);
+    sampleLock.clear(std::memory_order_release);
+    return true;
+}
+
+void HeapSampler::release(void* headerAddress) {
+    auto key = (uint64_t)headerAddress;
+
+    while (sampleLock.test_and_set(std::memory_order_acquire));
+    for (heap_sample_t** link = &sampleIndex[SAMPLE_INDEX(key)]; *link != nullptr; link = &(*link)->nxt) {
+        heap_sample_t* record = *link;
+        if (record->key == key) {
+            *link = record->nxt;
+            retire(record);
+            break;
+        }
+    }
+    sampleLock.clear(std::memory_order_release);
+}
+
+void HeapSampler::releaseOwner(uint16_t owner) {
+    while (sampleLock.test_and_set(std::memory_order_acquire));
+    for (size_t i = 0; i < HEAP_SAMPLE_N; i++) {
+        for (heap_sample_t** link = &sampleIndex[i]; *link != nullptr;) {
+            heap_sample_t* record = *link;
+            if (record->owner == owner) {
+                *link = record->nxt;
+                retire(record);
+            } else {
+                link = &record->nxt;
+            }
+        }
+    }
+    sampleLock.clear(std::memory_order_release);
+}
+
+static void writeCounts(dump_writer_t* out, size_t liveN, size_t liveBytes, size_t allocN, size_t allocBytes) {
+    out->putNumber((int64_t)liveN);
+    out->put(": ");
+    out->putNumber((int64_t)liveBytes);
+    out->put(" [");
+    out->putNumber((int64_t)allocN);
+    out->put(": ");
+    out->putNumber((int64_t)allocBytes);
+    out->put("] @");
+}
+
+bool HeapSampler::Dump(const char* path) {
+    static std::atomic<bool> dumping;
+    if (!enabled || dumping.exchange(true, std::memory_order_acquire)) {
+        return false;
+    }
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        Error("heap profile: cannot write %s\n", path);
+        dumping.store(false, std::memory_order_release);
+        return false;
+    }
+
+    size_t total[4] = {};
+    for (size_t i = 0; i < HEAP_BUCKET_N; i++) {
+        heap_bucket_t* bucket = &buckets[i];
+        if (__atomic_load_n(&bucket->hash, __ATOMIC_ACQUIRE)) {
+            total[0] += __atomic_load_n(&bucket->liveN, __ATOMIC_RELAXED);
+            total[1] += __atomic_load_n(&bucket->liveBytes, __ATOMIC_RELAXED);
+            total[2] += __atomic_load_n(&bucket->allocN, __ATOMIC_RELAXED);
+            total[3] += __atomic_load_n(&bucket->allocBytes, __ATOMIC_RELAXED);
+        }
+    }
+
+    // the legacy format of gperftools, pprof reads it and scales the samples back up
+    dump_writer_t out;
+    out.fd = fd;
+    out.n = 0;
+    out.put("heap profile: ");
+    writeCounts(&out, total[0], total[1], total[2], total[3]);
+    out.put(" heap_v2/");
+    out.putNumber((int64_t)semallocOptions.sampleInterval);
+    out.put("\n");
+
+    for (size_t i = 0; i < HEAP_BUCKET_N; i++) {
+        heap_bucket_t* bucket = &buckets[i];
+        if (!__atomic_load_n(&bucket->hash, __ATOMIC_ACQUIRE)) {
+            continue;
+        }
+        writeCounts(&out, __atomic_load_n(&bucket->liveN, __ATOMIC_RELAXED),
+                    __atomic_load_n(&bucket->liveBytes, __ATOMIC_RELAXED),
+                    __atomic_load_n(&bucket->allocN, __ATOMIC_RELAXED),
+                    __atomic_load_n(&bucket->allocBytes, __ATOMIC_RELAXED));
+        for (uint32_t j = 0; j < bucket->depth; j++) {
+            out.put(" ");
+            out.putHex(bucket->stack[j]);
+        }
+        out.put(" # csi ");
+        out.putHex(bucket->CSI);
+        out.put("\n");
+    }
+
+    // pprof maps the addresses to binaries with these
+    out.put("\nMAPPED_LIBRARIES:\n");
+    int maps = open("/proc/self/maps", O_RDONLY | O_CLOEXEC);
+    if (maps >= 0) {
+        char buffer[4096];
+        ssize_t n;
+        while ((n = read(maps, buffer, sizeof buffer)) > 0) {
+            out.putBytes(buffer, n);
+        }
+        close(maps);
+    }
+    out.flush();
+    close(fd);
+
+    if (droppedN) {
+        Error("heap profile: %zu samples dropped, the sample table is full\n", droppedN);
+    }
+    dumping.store(false, std::memory_order_release);
+    return true;
+}
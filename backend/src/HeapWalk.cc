@@ -0,0 +1,308 @@
+#include <algorithm>
+#include <atomic>
+#include <fcntl.h>
+#include <unistd.h>
+#include "HeapWalk.hh"
+#include "MemoryManager.hh"
+#include "DumpWriter.hh"
+
+extern MemoryManager* globalMemoryManager[MAX_MANAGER];
+
+static size_t residentBytes(uint64_t start, uint64_t end) {
+    unsigned char vector[WALK_WINDOW_PAGES];
+    size_t pages = 0;
+    for (uint64_t page = start & ~(uint64_t)(PAGE_SIZE - 1); page < end;) {
+        size_t n = (end - page + PAGE_SIZE - 1) >> PAGE_SIZE_BIT;
+        n = n < WALK_WINDOW_PAGES ? n : WALK_WINDOW_PAGES;
+        if (mincore((void*)page, n << PAGE_SIZE_BIT, vector) != 0) {
+            break;
+        }
+        for (size_t i = 0; i < n; i++) {
+            pages += vector[i] & 1;
+        }
+        page += n << PAGE_SIZE_BIT;
+    }
+    return pages << PAGE_SIZE_BIT;
+}
+
+static int walkSlots(const semalloc_walk_chunk_t* chunk, semalloc_walk_callback callback, void* arg) {
+    auto end = (uint64_t)chunk->end;
+    unsigned char vector[WALK_WINDOW_PAGES];
+    uint64_t windowStart = 0;
+    uint64_t windowEnd = 0;
+
+    for (auto slot = (uint64_t)chunk->start; slot + chunk->slotSize <= end; slot += chunk->slotSize) {
+        if (slot >= windowEnd) {
+            windowStart = slot & ~(uint64_t)(PAGE_SIZE - 1);
+            windowEnd = windowStart + ((uint64_t)WALK_WINDOW_PAGES << PAGE_SIZE_BIT);
+            uint64_t last = (end + PAGE_SIZE - 1) & ~(uint64_t)(PAGE_SIZE - 1);
+            windowEnd = windowEnd < last ? windowEnd : last;
+            if (mincore((void*)windowStart, windowEnd - windowStart, vector) != 0) {
+                memset(vector, 0, sizeof vector);
+            }
+        }
+
+        // a header is never split by a page, and a page out of memory holds no allocated slot
+        bool resident = vector[(slot - windowStart) >> PAGE_SIZE_BIT] & 1;
+        auto* header = (RegularHeader*)slot;
+        int allocated = resident && (__atomic_load_n(&header->controlByte, __ATOMIC_RELAXED) & 0x04);
+        if (callback(chunk, (void*)(slot + HEADER_SIZE), allocated, arg)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int walkBIBOP(MemoryManager* manager, SingleBIBOP* bibop, uint32_t CSI, bool individual,
+                     semalloc_walk_callback callback, void* arg) {
+    semalloc_walk_chunk_t chunk;
+    chunk.bibop = bibop;
+    chunk.slotSize = bibop->getSlotSize();
+    chunk.CSI = CSI;
+    chunk.manager = manager->getThreadId();
+    chunk.individual = individual;
+
+    for (chunk_record_t* record = bibop->getChunks(); record != nullptr; record = record->nxt) {
+        uint64_t end = __atomic_load_n(&record->end, __ATOMIC_RELAXED);
+        if (end == 0) {
+            end = bibop->carvedEnd(record->start);
+            // the owner moved on to a new chunk meanwhile
+            uint64_t closed = __atomic_load_n(&record->end, __ATOMIC_RELAXED);
+            end = closed ? closed : end;
+        }
+        chunk.start = (void*)record->start;
+        chunk.end = (void*)end;
+        chunk.resident = end > record->start ? residentBytes(record->start, end) : 0;
+        if (walkSlots(&chunk, callback, arg)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int HeapWalk::Walk(semalloc_walk_callback callback, void* arg) {
+    MemoryManager::managers_pinned_t pinned;
+    for (auto& slot : globalMemoryManager) {
+        auto* manager = __atomic_load_n(&slot, __ATOMIC_ACQUIRE);
+        if (manager == nullptr) {
+            continue;
+        }
+
+        for (size_t i = 0; i < GLOBAL_BAG_N; i++) {
+            if (walkBIBOP(manager, manager->getBag(i), 0, false, callback, arg)) {
+                return 1;
+            }
+        }
+        for (IndividualBIBOP* bibop = manager->getIndividualList(); bibop != nullptr; bibop = bibop->nextBIBOP) {
+            if (walkBIBOP(manager, bibop, bibop->getCSI(), true, callback, arg)) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+struct frag_counts_t {
+    size_t slotN;
+    size_t allocatedN;
+    size_t carved;          // bytes of the carved slots
+    size_t inUse;           // bytes of the allocated ones
+    size_t resident;
+};
+
+struct frag_site_t {
+    uint32_t CSI;
+    uint32_t bibopN;
+    frag_counts_t bibops;   // the individual BIBOPs of the CSI
+    size_t globalN;         // its objects in the global bags
+    size_t globalBytes;
+};
+
+struct frag_report_t {
+    dump_writer_t* out;
+    const void* bibop;
+    const void* chunkStart;
+    semalloc_walk_chunk_t first;    // of the BIBOP being counted
+    size_t chunkN;
+    frag_counts_t counts;
+    size_t bibopN;
+    size_t totalChunkN;
+    frag_counts_t total;
+    frag_counts_t classes[GLOBAL_BAG_N];
+};
+
+// the report runs one at a time, see Report()
+static frag_site_t fragSites[FRAG_SITE_N];
+static frag_site_t* rankedSites[FRAG_SITE_N];
+
+static frag_site_t* findSite(uint32_t CSI) {
+    for (size_t i = 0; i < FRAG_SITE_N; i++) {
+        frag_site_t* site = &fragSites[(hash(CSI) + i) & (FRAG_SITE_N - 1)];
+        if (site->CSI == CSI) {
+            return site;
+        }
+        if (site->CSI == 0) {
+            site->CSI = CSI;
+            return site;
+        }
+    }
+    return nullptr;
+}
+
+static void add(frag_counts_t* to, const frag_counts_t* from) {
+    to->slotN += from->slotN;
+    to->allocatedN += from->allocatedN;
+    to->carved += from->carved;
+    to->inUse += from->inUse;
+    to->resident += from->resident;
+}
+
+static void putCounts(dump_writer_t* out, const frag_counts_t* counts) {
+    out->putField("slots", (int64_t)counts->slotN);
+    out->putField("allocated", (int64_t)counts->allocatedN);
+    out->putField("carved", (int64_t)counts->carved);
+    out->putField("in_use", (int64_t)counts->inUse);
+    out->putField("resident", (int64_t)counts->resident);
+}
+
+static void flushBIBOP(frag_report_t* report) {
+    if (report->bibop == nullptr) {
+        return;
+    }
+
+    const semalloc_walk_chunk_t* chunk = &report->first;
+    size_t sizeClass = BIBOP::computeSizeIndex(chunk->slotSize - HEADER_SIZE);
+    add(&report->total, &report->counts);
+    add(&report->classes[sizeClass], &report->counts);
+    report->bibopN++;
+    report->totalChunkN += report->chunkN;
+    if (chunk->individual) {
+        frag_site_t* site = findSite(chunk->CSI);
+        if (site != nullptr) {
+            site->bibopN++;
+            add(&site->bibops, &report->counts);
+        }
+    }
+
+    dump_writer_t* out = report->out;
+    out->put(report->bibopN > 1 ? ",\n{\"bibop\":\"" : "\n{\"bibop\":\"");
+    out->putHex((uint64_t)chunk->bibop);
+    out->put("\",\"csi\":\"");
+    out->putHex(chunk->CSI);
+    out->put("\"");
+    out->putField("manager", chunk->manager);
+    out->putField("size", (int64_t)(chunk->slotSize - HEADER_SIZE));
+    out->putField("chunks", (int64_t)report->chunkN);
+    putCounts(out, &report->counts);
+    out->put("}");
+}
+
+static int countSlot(const semalloc_walk_chunk_t* chunk, void* ptr, int allocated, void* arg) {
+    auto* report = (frag_report_t*)arg;
+    if (chunk->bibop != report->bibop) {
+        flushBIBOP(report);
+        report->bibop = chunk->bibop;
+        report->first = *chunk;
+        report->chunkN = 0;
+        memset(&report->counts, 0, sizeof report->counts);
+        report->chunkStart = nullptr;
+    }
+    if (chunk->start != report->chunkStart) {
+        report->chunkStart = chunk->start;
+        report->chunkN++;
+        report->counts.resident += chunk->resident;
+    }
+
+    report->counts.slotN++;
+    report->counts.carved += chunk->slotSize;
+    if (allocated) {
+        report->counts.allocatedN++;
+        report->counts.inUse += chunk->slotSize;
+        if (!chunk->individual) {
+            // the header at the start of the slot keeps the allocating CSI
+            auto* header = (RegularHeader*)((uint64_t)ptr - HEADER_SIZE);
+            frag_site_t* site = header->CSI ? findSite(header->CSI) : nullptr;
+            if (site != nullptr) {
+                site->globalN++;
+                site->globalBytes += chunk->slotSize;
+            }
+        }
+    }
+    return 0;
+}
+
+bool HeapWalk::Report(const char* path) {
+    static std::atomic<bool> reporting;
+    if (reporting.exchange(true, std::memory_order_acquire)) {
+        return false;
+    }
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        Error("fragmentation report: cannot write %s\n", path);
+        reporting.store(false, std::memory_order_release);
+        return false;
+    }
+
+    dump_writer_t out;
+    out.fd = fd;
+    out.n = 0;
+    frag_report_t report = {};
+    report.out = &out;
+    memset(fragSites, 0, sizeof fragSites);
+
+    out.put("{\"pid\":");
+    out.putNumber(getpid());
+    out.put(",\"bibops\":[");
+    Walk(countSlot, &report);
+    flushBIBOP(&report);
+
+    out.put("\n],\"classes\":[");
+    bool first = true;
+    for (size_t i = 0; i < GLOBAL_BAG_N; i++) {
+        if (report.classes[i].slotN == 0) {
+            continue;
+        }
+        out.put(first ? "\n{\"size\":" : ",\n{\"size\":");
+        out.putNumber(MIN_BAG_SIZE << i);
+        putCounts(&out, &report.classes[i]);
+        out.put("}");
+        first = false;
+    }
+
+    // the sites with the most resident bytes their objects do not use first
+    size_t siteN = 0;
+    for (auto& site : fragSites) {
+        if (site.CSI) {
+            rankedSites[siteN++] = &site;
+        }
+    }
+    std::sort(rankedSites, rankedSites + siteN, [](const frag_site_t* a, const frag_site_t* b) {
+        size_t wasteA = a->bibops.resident > a->bibops.inUse ? a->bibops.resident - a->bibops.inUse : 0;
+        size_t wasteB = b->bibops.resident > b->bibops.inUse ? b->bibops.resident - b->bibops.inUse : 0;
+        return wasteA != wasteB ? wasteA > wasteB : a->globalBytes > b->globalBytes;
+    });
+    out.put("\n],\"sites\":[");
+    for (size_t i = 0; i < siteN; i++) {
+        frag_site_t* site = rankedSites[i];
+        out.put(i ? ",\n{\"csi\":\"" : "\n{\"csi\":\"");
+        out.putHex(site->CSI);
+        out.put("\"");
+        out.putField("bibops", site->bibopN);
+        putCounts(&out, &site->bibops);
+        out.putField("global_allocated", (int64_t)site->globalN);
+        out.putField("global_in_use", (int64_t)site->globalBytes);
+        out.put("}");
+    }
+
+    out.put("\n],\"totals\":{\"bibops\":");
+    out.putNumber((int64_t)report.bibopN);
+    out.putField("chunks", (int64_t)report.totalChunkN);
+    putCounts(&out, &report.total);
+    out.put("}}\n");
+    out.flush();
+    close(fd);
+
+    reporting.store(false, std::memory_order_release);
+    return true;
+}
@@ -3,7 +3,18 @@
 //
 #include "IndividualBIBOP.hh"
 
-void IndividualBIBOP::freeIndividualObject(void *ptr) {
+void IndividualBIBOP::freeIndividualObject(void *ptr, bool global) {
     Debug("Enter Individual Free %p\n", ptr);
+#ifdef NURSERY
+    if (__builtin_expect(!global && nurseryState >= NURSERY_ARMED, 0)) {
+        liveN--;
+        if (!this->freeNursery()) {
+            this->recycleSlot(ptr);
+        }
+        return;
+    }
+#else
+    (void)global;
+#endif
     this->freeObject(ptr);
 }
\ No newline at end of file
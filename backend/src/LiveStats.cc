@@ -0,0 +1,196 @@
+#include <algorithm>
+#include <cstddef>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include "LiveStats.hh"
+#include "MemoryManager.hh"
+#include "Clock.hh"
+
+#if defined(LIVE_STATS) && defined(STAT)
+extern MemoryManager* globalMemoryManager[MAX_MANAGER];
+
+static live_page_t* shared;
+static char segmentName[32];
+static uint32_t interval;
+
+// the publisher is the only thread using these
+static live_page_t scratch;
+static live_site_t siteScratch[LIVE_SITE_SCRATCH_N];
+
+static size_t readRSS() {
+    char buffer[128];
+    int fd = open("/proc/self/statm", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return 0;
+    }
+    ssize_t n = read(fd, buffer, sizeof buffer - 1);
+    close(fd);
+    if (n <= 0) {
+        return 0;
+    }
+    buffer[n] = 0;
+
+    // size resident shared ..., in pages
+    const char* c = strchr(buffer, ' ');
+    size_t pages = 0;
+    for (c = c != nullptr ? c + 1 : buffer + n; *c >= '0' && *c <= '9'; c++) {
+        pages = pages * 10 + (*c - '0');
+    }
+    return pages * PAGE_SIZE;
+}
+
+static void countSites(MemoryManager* manager) {
+    for (IndividualBIBOP* bibop = manager->getIndividualList(); bibop != nullptr; bibop = bibop->nextBIBOP) {
+        uint32_t CSI = bibop->getCSI();
+        size_t index = hash(CSI);
+        for (size_t i = 0; i < LIVE_SITE_SCRATCH_N; i++) {
+            live_site_t* site = &siteScratch[(index + i) & (LIVE_SITE_SCRATCH_N - 1)];
+            if (site->bibopN == 0 || site->CSI == CSI) {
+                usage_t usage = {};
+                bibop->accountUsage(&usage);
+                site->CSI = CSI;
+                site->bibopN++;
+                site->inUse += usage.inUse;
+                site->arena += usage.arena;
+                break;
+            }
+        }
+    }
+}
+
+static void collect() {
+    memset(&scratch, 0, sizeof scratch);
+    memset(siteScratch, 0, sizeof siteScratch);
+
+    MemoryManager::managers_pinned_t pinned;
+    for (auto& slot : globalMemoryManager) {
+        auto* manager = __atomic_load_n(&slot, __ATOMIC_ACQUIRE);
+        if (manager == nullptr) {
+            continue;
+        }
+
+        const semalloc_stats_t* stats = manager->getStats();
+        live_thread_t* thread = &scratch.threads[scratch.threadN++];
+        thread->id = manager->getThreadId();
+        thread->heap = manager->isHeapManager();
+        for (size_t path = 0; path < STAT_PATH_N; path++) {
+            thread->mallocN += __atomic_load_n(&stats->mallocN[path], __ATOMIC_RELAXED);
+        }
+        thread->freeN = __atomic_load_n(&stats->freeN, __ATOMIC_RELAXED);
+        thread->remoteFreeN = __atomic_load_n(&stats->remoteFreeN, __ATOMIC_RELAXED);
+        thread->remoteBacklog = manager->getRemoteBacklog();
+
+        semalloc_usage_t usage = {};
+        manager->accountUsage(&usage);
+        thread->inUse = usage.global.inUse + usage.individual.inUse;
+        thread->arena = usage.global.arena + usage.individual.arena;
+        for (size_t kind = 0; kind < 2; kind++) {
+            auto* from = (const size_t*)(kind ? &usage.individual : &usage.global);
+            auto* to = (size_t*)(kind ? &scratch.usage.individual : &scratch.usage.global);
+            for (size_t i = 0; i < sizeof(usage_t) / sizeof(size_t); i++) {
+                to[i] += from[i];
+            }
+        }
+
+        usage_t bags[GLOBAL_BAG_N] = {};
+        manager->accountBags(bags);
+        for (size_t i = 0; i < GLOBAL_BAG_N; i++) {
+            live_bag_t* bag = &scratch.bags[i];
+            bag->mallocN += __atomic_load_n(&stats->classN[i], __ATOMIC_RELAXED);
+            bag->usage.arena += bags[i].arena;
+            bag->usage.inUse += bags[i].inUse;
+            bag->usage.free += bags[i].free;
+            bag->usage.blocks += bags[i].blocks;
+        }
+
+        countSites(manager);
+    }
+    MemoryManager::accountHugeUsage(&scratch.usage);
+
+    live_site_t* ranked[LIVE_SITE_SCRATCH_N];
+    size_t siteN = 0;
+    for (auto& site : siteScratch) {
+        if (site.bibopN) {
+            ranked[siteN++] = &site;
+        }
+    }
+    size_t keep = siteN < LIVE_SITE_N ? siteN : LIVE_SITE_N;
+    std::partial_sort(ranked, ranked + keep, ranked + siteN, [](const live_site_t* a, const live_site_t* b) {
+        return a->inUse > b->inUse;
+    });
+    for (size_t i = 0; i < keep; i++) {
+        scratch.sites[i] = *ranked[i];
+    }
+    scratch.siteN = keep;
+    scratch.rss = readRSS();
+    scratch.timeNs = nowNs();
+}
+
+static void publish() {
+    collect();
+
+    // everything after seq, under the seqlock
+    uint64_t seq = shared->seq;
+    __atomic_store_n(&shared->seq, seq + 1, __ATOMIC_RELAXED);
+    std::atomic_thread_fence(std::memory_order_release);
+    size_t offset = offsetof(live_page_t, timeNs);
+    memcpy((char*)shared + offset, (const char*)&scratch + offset, sizeof(live_page_t) - offset);
+    shared->intervalMs = interval;
+    __atomic_store_n(&shared->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+static void* publisher(void*) {
+    struct timespec period = {interval / 1000, (long)(interval % 1000) * 1000000L};
+    while (true) {
+        publish();
+        nanosleep(&period, nullptr);
+    }
+    return nullptr;
+}
+
+void LiveStats::Start(uint32_t intervalMs) {
+    liveStatsName(segmentName, getpid());
+    int fd = shm_open(segmentName, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        Error("live stats: cannot create the segment %s\n", segmentName);
+        return;
+    }
+    size_t length = (sizeof(live_page_t) + PAGE_SIZE - 1) & ~(size_t)(PAGE_SIZE - 1);
+    void* page = ftruncate(fd, length) == 0 ?
+                 mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (page == MAP_FAILED) {
+        Error("live stats: cannot map the segment %s\n", segmentName);
+        shm_unlink(segmentName);
+        segmentName[0] = 0;
+        return;
+    }
+
+    shared = (live_page_t*)page;
+    memcpy(shared->magic, LIVE_STATS_MAGIC, sizeof shared->magic);
+    shared->size = sizeof(live_page_t);
+    shared->pid = getpid();
+    interval = intervalMs;
+
+    // detached, it dies with the process
+    pthread_t thread;
+    pthread_attr_t attributes;
+    pthread_attr_init(&attributes);
+    pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+    int error = pthread_create(&thread, &attributes, publisher, nullptr);
+    pthread_attr_destroy(&attributes);
+    if (error != 0) {
+        Error("live stats: cannot start the publisher (%d)\n", error);
+    }
+    Debug("Live stats in %s\n", segmentName);
+}
+
+static void __attribute__((destructor))
+unlinkLiveStats(void) {
+    // a forked child exits with the name of its parent's segment
+    if (segmentName[0] && shared->pid == (uint32_t)getpid()) {
+        shm_unlink(segmentName);
+    }
+}
+#endif
@@ -0,0 +1,162 @@
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include "MemoryBudget.hh"
+#include "Options.hh"
+
+std::atomic<bool> MemoryBudget::pressure;
+std::atomic<uint64_t> MemoryBudget::nextPoll;
+size_t MemoryBudget::budget;
+uint32_t MemoryBudget::psiThreshold;
+int MemoryBudget::statmFd = -1;
+int MemoryBudget::psiFd = -1;
+bool MemoryBudget::enabled;
+
+// no allocation here: we may be running inside the first malloc
+static ssize_t readFile(int fd, char* buffer, size_t size) {
+    ssize_t n = pread(fd, buffer, size - 1, 0);
+    buffer[n > 0 ? n : 0] = 0;
+    return n;
+}
+
+static size_t parseNumber(const char** c) {
+    size_t value = 0;
+    for (; **c >= '0' && **c <= '9'; (*c)++) {
+        value = value * 10 + (**c - '0');
+    }
+    return value;
+}
+
+static bool joinPath(char* out, size_t size, const char* a, const char* b, const char* c) {
+    size_t n = 0;
+    for (const char* part : {a, b, c}) {
+        size_t length = strlen(part);
+        if (n + length >= size) {
+            return false;
+        }
+        memcpy(out + n, part, length);
+        n += length;
+    }
+    out[n] = 0;
+    return true;
+}
+
+// the cgroup v2 directory of the process, empty on a v1 or unified-less system
+static void findCgroup(char* out, size_t size) {
+    out[0] = 0;
+    char buffer[1024];
+    int fd = open("/proc/self/cgroup", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+    readFile(fd, buffer, sizeof buffer);
+    close(fd);
+
+    const char* line = strstr(buffer, "0::");
+    if (line != nullptr && (line == buffer || line[-1] == '\n')) {
+        const char* end = strchr(line + 3, '\n');
+        size_t length = end ? end - line - 3 : strlen(line + 3);
+        if (length < size) {
+            memcpy(out, line + 3, length);
+            out[length] = 0;
+        }
+    }
+}
+
+void MemoryBudget::InitMemoryBudget() {
+#ifdef MEMORY_BUDGET
+    char cgroup[512];
+    char path[1024];
+    char buffer[64];
+    findCgroup(cgroup, sizeof cgroup);
+
+    budget = semallocOptions.budget;
+    if (budget == 0 && cgroup[0] && joinPath(path, sizeof path, "/sys/fs/cgroup", cgroup, "/memory.max")) {
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd >= 0) {
+            readFile(fd, buffer, sizeof buffer);
+            close(fd);
+            const char* c = buffer;
+            size_t limit = parseNumber(&c);
+            // "max" parses as 0: no limit
+            budget = limit / 100 * BUDGET_CGROUP_PERCENT;
+        }
+    }
+    if (budget) {
+        statmFd = open("/proc/self/statm", O_RDONLY | O_CLOEXEC);
+    }
+
+    psiThreshold = semallocOptions.pressure * 100;
+    if (psiThreshold) {
+        if (cgroup[0] && joinPath(path, sizeof path, "/sys/fs/cgroup", cgroup, "/memory.pressure")) {
+            psiFd = open(path, O_RDONLY | O_CLOEXEC);
+        }
+        if (psiFd < 0) {
+            psiFd = open("/proc/pressure/memory", O_RDONLY | O_CLOEXEC);
+        }
+    }
+
+    enabled = statmFd >= 0 || psiFd >= 0;
+    Debug("Memory budget %zu, PSI threshold %u, enabled %d\n", budget, psiThreshold, enabled);
+#endif
+}
+
+size_t MemoryBudget::readRSS() {
+    // statm: size resident shared ..., in pages
+    char buffer[128];
+    if (readFile(statmFd, buffer, sizeof buffer) <= 0) {
+        return 0;
+    }
+    const char* c = buffer;
+    parseNumber(&c);
+    c++;
+    return parseNumber(&c) << PAGE_SIZE_BIT;
+}
+
+uint32_t MemoryBudget::readPSI() {
+    // "some avg10=1.23 avg60=..."
+    char buffer[256];
+    if (readFile(psiFd, buffer, sizeof buffer) <= 0) {
+        return 0;
+    }
+    const char* c = strstr(buffer, "avg10=");
+    if (c == nullptr) {
+        return 0;
+    }
+    c += 6;
+    uint32_t value = parseNumber(&c) * 100;
+    if (*c == '.') {
+        c++;
+        const char* fraction = c;
+        uint32_t hundredths = parseNumber(&c);
+        value += c - fraction == 1 ? hundredths * 10 : hundredths;
+    }
+    return value;
+}
+
+void MemoryBudget::poll() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+    uint64_t ms = now.tv_sec * 1000 + now.tv_nsec / 1000000;
+
+    uint64_t next = nextPoll.load(std::memory_order_relaxed);
+    if (ms < next || !nextPoll.compare_exchange_strong(next, ms + BUDGET_POLL_MS, std::memory_order_relaxed)) {
+        return;
+    }
+
+    size_t rss = statmFd >= 0 ? readRSS() : 0;
+    uint32_t psi = psiFd >= 0 ? readPSI() : 0;
+
+    // leave the pressure mode only well below the thresholds, so it does not flap
+    bool over;
+    if (pressure.load(std::memory_order_relaxed)) {
+        over = (budget && rss > budget / 10 * 9) || (psiThreshold && psi > psiThreshold / 2);
+    } else {
+        over = (budget && rss > budget) || (psiThreshold && psi > psiThreshold);
+    }
+
+    if (over != pressure.load(std::memory_order_relaxed)) {
+        Debug("Memory pressure %d, rss %zu, avg10 %u\n", over, rss, psi);
+        pressure.store(over, std::memory_order_relaxed);
+    }
+}
@@ -2,136 +2,97 @@
 // Created by r53wang on 3/23/23.
 //
 
+#include <cerrno>
 #include "MemoryManager.hh"
+#include "Probes.hh"
 
-#ifdef STAT
-extern size_t* n_malloc;
-extern size_t* n_individual_pool;
-extern size_t* n_individual_allocation;
-extern size_t* s_rec_memory;
-extern size_t* s_lazy_memory;
-extern size_t* s_global_memory;
-#endif
+extern MemoryManager* globalMemoryManager[MAX_MANAGER];
+
+// huge mappings of all managers, they are freed by whoever frees the object
+static std::atomic<size_t> hugeBytes;
+static std::atomic<size_t> hugeN;
 
+// readers walking the managers, and whether a heap is being destroyed
+static std::atomic<uint32_t> managerPins;
+static std::atomic<bool> managerRetiring;
+
+template<class Policy>
 void *MemoryManager::mallocMemory(size_t size) {
     this->handleFreeList();
+#ifdef MEMORY_BUDGET
+    this->pollBudget<Policy>();
+#endif
     if (size & CSI_HUGE_SIZE_BIT_MASK) {
-        void* ptr = MemoryManager::allocateHuge(size & CSI_HUGE_SIZE_SIZE_MASK);
+        void* ptr = this->sampled(MemoryManager::allocateHuge(size & CSI_HUGE_SIZE_SIZE_MASK, 0),
+                                  size & CSI_HUGE_SIZE_SIZE_MASK, 0);
         Info2("Huge allocated to %p\n", ptr);
+#ifdef STAT
+        this->countMalloc<Policy>(STAT_HUGE, 0, size & CSI_HUGE_SIZE_SIZE_MASK, 1);
+#endif
         return ptr;
     }
 
-    size_t realSize = GET_REAL_SIZE(size);
-    Debug("Real size: %zu\n", realSize);
-    if (realSize == 0) {
-        return nullptr;
-    }
+    return this->allocateRegular<Policy>(GET_REAL_SIZE(size), (size & CSI_BIT_MASK) >> 32, size & CSI_LOOP_BIT_MASK);
+}
 
-    if (realSize >= BAG_THRESHOLD) {
-        return MemoryManager::allocateHuge(realSize);
-    }
-#ifdef STAT
-    *n_malloc += 1;
-#endif
-    size_t CSI = (size & CSI_BIT_MASK) >> 32;
-#ifdef STAT
-    Error("CSI>>>>>>>> %zu", CSI);
+void *MemoryManager::mallocMemory(size_t realSize, size_t CSI, bool inLoop) {
+    this->handleFreeList();
+#ifdef MEMORY_BUDGET
+    this->pollBudget();
 #endif
-    if ((size & CSI_LOOP_BIT_MASK) && (!tryPutToLazyPool(CSI))) {
-        // in the loop, we need to find the corresponding BIBOP
-        Info2("size %ld, CSI %zu Loop\n", realSize, CSI);
-
-        IndividualBIBOP* currentBIBOP = getIndividualBIBOPbyCSI(CSI, realSize);
-        void* ptr = currentBIBOP->allocateObject();
-        Info2("Allocated to %p\n", ptr);
-
-        if (ptr == nullptr) {
-            Debug("Need to extend BIBOP: %p\n", currentBIBOP);
-            void* chunk = this->acquireIndividualDataPool();
-            currentBIBOP->ExtendSingleBIBOP((uint64_t)chunk, INDIVIDUAL_BIBOP_SIZE);
-            ptr = currentBIBOP->allocateObject();
-            Info2("Allocated to %p\n", ptr);
-        }
-
-        void* data = (void*)((uint64_t)ptr + HEADER_SIZE);
-        auto* header = (RegularHeader*)ptr;
+    return this->allocateRegular<runtime_policy_t>(realSize, CSI, inLoop);
+}
 
-        header->thread_id = thread_id;
-        header->bibop = currentBIBOP;
-        header->setRegular();
-        header->setIndividual();
-        header->setAllocation();
-        header->memalign_offset = 0;
-#ifdef STAT
-        *n_individual_allocation += 1;
-        *s_rec_memory += realSize + 16;
+void* MemoryManager::mallocHugeAligned(size_t realSize, size_t CSI, size_t alignment) {
+    this->handleFreeList();
+#ifdef MEMORY_BUDGET
+    this->pollBudget();
 #endif
-        return data;
-    } else {
-        // not in loop, we don't need to allocate the identifier, just go ahead and allocate
-        Info2("size %ld, CSI %ld NLoop\n", realSize, CSI);
-        SingleBIBOP* targetBIBOP = *(globalBIBOP->size2BIBOP(realSize));
-        void* ptr = targetBIBOP->allocateObject();
-        Info2("Allocated to %p\n", ptr);
-
-        if (ptr == nullptr) {
-            Debug("Need to extend Global BIBOP: %p\n", globalBIBOP);
-            void* chunk = this->acquireIndividualDataPool();
-            targetBIBOP->ExtendSingleBIBOP((uint64_t )chunk, INDIVIDUAL_BIBOP_SIZE);
-            ptr = targetBIBOP->allocateObject();
-            Info2("Allocated to %p\n", ptr);
-        }
-
-        void* data = (void*)((uint64_t)ptr + HEADER_SIZE);
-        auto* header = (RegularHeader*)ptr;
-
-        header->thread_id = thread_id;
-        header->bibop = targetBIBOP;
-        header->setRegular();
-        header->setGlobal();
-        header->setAllocation();
-        header->memalign_offset = 0;
 #ifdef STAT
-        if (size & CSI_LOOP_BIT_MASK) {
-            *s_lazy_memory += realSize + 16;
-        } else {
-            *s_global_memory += realSize + 16;
-        }
+    this->countMalloc(STAT_HUGE, CSI, realSize, 1);
 #endif
-
-        return data;
-    }
+    return this->sampled(MemoryManager::allocateHuge(realSize, CSI, alignment), realSize, CSI);
 }
 
-void *MemoryManager::mallocMemory(size_t realSize, size_t CSI, bool inLoop) {
-    this->handleFreeList();
+template<class Policy>
+void* MemoryManager::allocateRegular(size_t realSize, size_t CSI, bool inLoop) {
     Debug("Real size: %zu\n", realSize);
     if (realSize == 0) {
         return nullptr;
     }
+    if (realSize > BAG_THRESHOLD) {
 #ifdef STAT
-    Error("CSI>>>>>>>> %zu", CSI);
+        this->countMalloc<Policy>(STAT_HUGE, CSI, realSize, 1);
 #endif
-    if (realSize >= BAG_THRESHOLD) {
-        return MemoryManager::allocateHuge(realSize);
+        return this->sampled(MemoryManager::allocateHuge(realSize, CSI), realSize, CSI);
     }
-#ifdef STAT
-    *n_malloc += 1;
-#endif
 
-    if (inLoop && (!tryPutToLazyPool(CSI))) {
+    // without the lazy pool and the site policies only the memory pressure keeps a loop global
+    bool lazy = inLoop && (Policy::on(this->variant, ALLOC_LAZY) ? tryPutToLazyPool(CSI, realSize)
+                                                                  : MemoryBudget::underPressure());
+    if (inLoop && !lazy) {
         // in the loop, we need to find the corresponding BIBOP
         Info2("size %ld, CSI %ld Loop\n", realSize, CSI);
 
         IndividualBIBOP* currentBIBOP = getIndividualBIBOPbyCSI(CSI, realSize);
-        void* ptr = currentBIBOP->allocateObject();
+        if (currentBIBOP == nullptr) {
+            errno = ENOMEM;
+            return nullptr;
+        }
+        void* ptr = currentBIBOP->allocateIndividualObject();
         Info2("Allocated to %p\n", ptr);
 
         if (ptr == nullptr) {
             Debug("Need to extend BIBOP: %p\n", currentBIBOP);
             void* chunk = this->acquireIndividualDataPool();
-            currentBIBOP->ExtendSingleBIBOP((uint64_t)chunk, INDIVIDUAL_BIBOP_SIZE);
-            ptr = currentBIBOP->allocateObject();
+            if (chunk == nullptr) {
+                errno = ENOMEM;
+                return nullptr;
+            }
+            this->extendBIBOP(currentBIBOP, chunk);
+            this->prepareChunk(chunk, currentBIBOP->getPolicy());
+            this->countChunk(CSI, 0);
+            ptr = currentBIBOP->allocateIndividualObject();
             Info2("Allocated to %p\n", ptr);
         }
 
@@ -143,12 +104,11 @@ void *MemoryManager::mallocMemory(size_t realSize, size_t CSI, bool inLoop) {
         header->setRegular();
         header->setIndividual();
         header->setAllocation();
-        header->memalign_offset = 0;
+        header->CSI = CSI;
 #ifdef STAT
-        *n_individual_allocation += 1;
-        *s_rec_memory += realSize + 16;
+        this->countMalloc<Policy>(STAT_INDIVIDUAL, CSI, realSize, 1);
 #endif
-        return data;
+        return this->sampled(data, realSize, CSI);
     } else {
         // not in loop, we don't need to allocate the identifier, just go ahead and allocate
         Info2("size %ld, CSI %ld NLoop\n", realSize, CSI);
@@ -159,7 +119,12 @@ void *MemoryManager::mallocMemory(size_t realSize, size_t CSI, bool inLoop) {
         if (ptr == nullptr) {
             Debug("Need to extend Global BIBOP: %p\n", globalBIBOP);
             void* chunk = this->acquireIndividualDataPool();
-            targetBIBOP->ExtendSingleBIBOP((uint64_t )chunk, INDIVIDUAL_BIBOP_SIZE);
+            if (chunk == nullptr) {
+                errno = ENOMEM;
+                return nullptr;
+            }
+            this->extendBIBOP(targetBIBOP, chunk);
+            this->prepareChunk(chunk, SITE_DEFAULT);
             ptr = targetBIBOP->allocateObject();
             Info2("Allocated to %p\n", ptr);
         }
@@ -172,19 +137,16 @@ void *MemoryManager::mallocMemory(size_t realSize, size_t CSI, bool inLoop) {
         header->setRegular();
         header->setGlobal();
         header->setAllocation();
-        header->memalign_offset = 0;
+        header->CSI = CSI;
 #ifdef STAT
-        if (inLoop) {
-            *s_lazy_memory += realSize + 16;
-        } else {
-            *s_global_memory += realSize + 16;
-        }
+        this->countMalloc<Policy>(inLoop ? STAT_LAZY : STAT_GLOBAL, CSI, realSize, 1);
 #endif
 
-        return data;
+        return this->sampled(data, realSize, CSI);
     }
 }
 
+template<class Policy>
 void MemoryManager::freeRegularMemory(void *ptr) {
     this->handleFreeList();
 
@@ -193,13 +155,32 @@ void MemoryManager::freeRegularMemory(void *ptr) {
         return;
     }
 
+    this->freeLocalMemory<Policy>(ptr);
+}
+
+template<class Policy>
+void MemoryManager::freeLocalMemory(void *ptr) {
     auto* header = (RegularHeader*)((uint64_t)ptr - HEADER_SIZE);
     if (!header->isAllocation()) {
         Error("Double free ptr: $%p\n", ptr);
         exit(-1);
     }
 
-    auto* data = (void*)((uint64_t)ptr - HEADER_SIZE - header->memalign_offset);
+    RegularHeader* data = header->slot();
+
+    // the BIBOP may purge the page of the slot, so the header is done with first
+#ifdef HEAP_SAMPLING
+    if (header->isSampled()) {
+        HeapSampler::release(data);
+    }
+#endif
+#ifdef CSI_PROFILE
+    if (this->profile) {
+        SiteProfile::countFree(this->profile, data->CSI);
+    }
+#endif
+    header->setFree();
+    data->setFree();
 
     if (!header->isRegular()) {
         auto* bibop = (GlobalBIBOP*)header->bibop;
@@ -208,43 +189,222 @@ void MemoryManager::freeRegularMemory(void *ptr) {
     } else {
         auto* bibop = (IndividualBIBOP*)header->bibop;
         Debug("Individual handle %p\n", ptr);
-        bibop->freeIndividualObject(data);
+        bibop->freeIndividualObject(data, data->isGlobal());
+    }
+#ifdef STAT
+    if (Policy::on(this->variant, ALLOC_COUNTED)) {
+        statAdd(&this->stats.freeN, 1);
     }
+#endif
+}
 
-    header->setFree();
+// every variant css_malloc and css_free can be bound to, and the runtime policy of the other paths
+#define INSTANTIATE_POLICY(Policy) \
+    template void* MemoryManager::mallocMemory<Policy>(size_t size); \
+    template void MemoryManager::freeRegularMemory<Policy>(void* ptr);
+INSTANTIATE_POLICY(runtime_policy_t)
+INSTANTIATE_POLICY(fixed_policy_t<0>)
+INSTANTIATE_POLICY(fixed_policy_t<1>)
+INSTANTIATE_POLICY(fixed_policy_t<2>)
+INSTANTIATE_POLICY(fixed_policy_t<3>)
+INSTANTIATE_POLICY(fixed_policy_t<4>)
+INSTANTIATE_POLICY(fixed_policy_t<5>)
+INSTANTIATE_POLICY(fixed_policy_t<6>)
+INSTANTIATE_POLICY(fixed_policy_t<7>)
+INSTANTIATE_POLICY(fixed_policy_t<8>)
+INSTANTIATE_POLICY(fixed_policy_t<9>)
+INSTANTIATE_POLICY(fixed_policy_t<10>)
+INSTANTIATE_POLICY(fixed_policy_t<11>)
+INSTANTIATE_POLICY(fixed_policy_t<12>)
+INSTANTIATE_POLICY(fixed_policy_t<13>)
+INSTANTIATE_POLICY(fixed_policy_t<14>)
+INSTANTIATE_POLICY(fixed_policy_t<15>)
+
+size_t MemoryManager::mallocBatch(size_t realSize, size_t CSI, bool inLoop, size_t count, void** out) {
+    this->handleFreeList();
+#ifdef MEMORY_BUDGET
+    this->pollBudget();
+#endif
+    Debug("Batch of %zu, real size: %zu\n", count, realSize);
+    if (realSize == 0) {
+        return 0;
+    }
+
+    if (realSize > BAG_THRESHOLD) {
+        for (size_t i = 0; i < count; i++) {
+            void* ptr = MemoryManager::allocateHuge(realSize, CSI);
+            if (ptr == nullptr) {
+                count = i;
+                break;
+            }
+            out[i] = this->sampled(ptr, realSize, CSI);
+        }
+#ifdef STAT
+        this->countMalloc(STAT_HUGE, CSI, realSize, count);
+#endif
+        return count;
+    }
+
+    // the lazy warm-up still sees one allocation at a time
+    size_t n = 0;
+    while (n < count && inLoop && tryPutToLazyPool(CSI, realSize)) {
+        if (this->fillBatch(*(globalBIBOP->size2BIBOP(realSize)), CSI, true, 1, out + n) == 0) {
+            return n;
+        }
+        this->sampledBatch(out + n, 1, realSize, CSI);
+        n++;
+#ifdef STAT
+        this->countMalloc(STAT_LAZY, CSI, realSize, 1);
+#endif
+    }
+    if (n == count) {
+        return count;
+    }
+
+    if (inLoop) {
+        IndividualBIBOP* currentBIBOP = getIndividualBIBOPbyCSI(CSI, realSize);
+        if (currentBIBOP == nullptr) {
+            errno = ENOMEM;
+            return n;
+        }
+        size_t filled = this->fillBatch(currentBIBOP, CSI, false, count - n, out + n);
+        this->sampledBatch(out + n, filled, realSize, CSI);
+#ifdef STAT
+        this->countMalloc(STAT_INDIVIDUAL, CSI, realSize, filled);
+#endif
+        n += filled;
+    } else {
+        size_t filled = this->fillBatch(*(globalBIBOP->size2BIBOP(realSize)), CSI, true, count - n, out + n);
+        this->sampledBatch(out + n, filled, realSize, CSI);
+#ifdef STAT
+        this->countMalloc(STAT_GLOBAL, CSI, realSize, filled);
+#endif
+        n += filled;
+    }
+
+    return n;
+}
+
+size_t MemoryManager::fillBatch(SingleBIBOP* bibop, size_t CSI, bool global, size_t count, void** out) {
+    size_t n = bibop->allocateBatch(count, out);
+    while (n < count) {
+        Debug("Need to extend BIBOP in batch: %p\n", bibop);
+        void* chunk = this->acquireIndividualDataPool();
+        if (chunk == nullptr) {
+            errno = ENOMEM;
+            break;
+        }
+        this->extendBIBOP(bibop, chunk);
+        this->prepareChunk(chunk, global ? SITE_DEFAULT : ((IndividualBIBOP*)bibop)->getPolicy());
+        if (!global) {
+            this->countChunk(CSI, 0);
+        }
+        n += bibop->allocateBatch(count - n, out + n);
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        auto* header = (RegularHeader*)out[i];
+        header->thread_id = thread_id;
+        header->bibop = bibop;
+        header->setRegular();
+        if (global) {
+            header->setGlobal();
+        } else {
+            header->setIndividual();
+        }
+        header->setAllocation();
+        header->CSI = CSI;
+        out[i] = (void*)((uint64_t)header + HEADER_SIZE);
+    }
+    return n;
 }
 
+// the remote frees are drained once for the whole batch; local objects are freed in place,
+// remote ones are chained per owner and pushed once
+void MemoryManager::freeBatch(void** ptrs, size_t n) {
+    this->handleFreeList();
+
+    ListElement* heads[MAX_MANAGER] = {};
+    ListElement* tails[MAX_MANAGER];
+    size_t counts[MAX_MANAGER];
+    for (size_t i = 0; i < n; i++) {
+        void* ptr = ptrs[i];
+        if (ptr == nullptr) {
+            continue;
+        }
+
+        auto* regularHeader = (RegularHeader*)((uint64_t)ptr - HEADER_SIZE);
+        if (((HugeHeader*)regularHeader)->isHuge()) {
+            MemoryManager::freeHugeMemory(ptr);
+            continue;
+        }
+        if (regularHeader->thread_id == this->thread_id) {
+            this->freeLocalMemory(ptr);
+            continue;
+        }
+
+        auto* element = (ListElement*)ptr;
+        uint16_t owner = regularHeader->thread_id;
+        element->nxt = heads[owner];
+        if (heads[owner] == nullptr) {
+            tails[owner] = element;
+            counts[owner] = 0;
+        }
+        counts[owner]++;
+        heads[owner] = element;
+    }
+
+    for (size_t owner = 0; owner < MAX_MANAGER; owner++) {
+        if (heads[owner] != nullptr) {
+            globalMemoryManager[owner]->freeOtherThreadMemory(heads[owner], tails[owner], counts[owner]);
+        }
+    }
+}
 
 IndividualBIBOP* MemoryManager::getIndividualBIBOPbyCSI(size_t CSI, size_t objectSize) {
     uint16_t BIBOPIndex = hash(CSI); // TODO: possibly a map?
     size_t SizeClassIndex = BIBOP::computeSizeIndex(objectSize);
+    latency_timer_t probeTimer(this, LATENCY_PROBE, false);
 
     for (size_t offset = 0; offset < INDIVIDUAL_BIBOP_MAX_N; offset++) {
+        if (offset == LATENCY_LONG_PROBE) {
+            probeTimer.start();
+        }
         size_t index = (BIBOPIndex + offset) % INDIVIDUAL_BIBOP_MAX_N;
         IndividualBIBOP_c_t *IB = &this->individualBIBOP[index];
-    //    Debug("current CSI: %zu, target CSI: %zu, location: %zu\n", IB->CSI, CSI, index);
+    //    Debug("current CSI: %zu, target CSI: %zu, location: %zu\n", IB->key - 1, CSI, index);
         // if current is the one we want
-        if (IB->CSI == CSI) {
-            if ((size_t)IB->ptr[SizeClassIndex] != 0xFFFFFFFFFFFFFFFFUL) {
+        if (IB->key == CSI + 1) {
+            if (IB->ptr[SizeClassIndex] != nullptr) {
                 Info2("Existing BIBOP with location %zu offset %zu\n", index, offset);
                 return IB->ptr[SizeClassIndex];
             } else {
                 Info2("New BIBOP with location %zu\n", index);
-                IB->ptr[SizeClassIndex] = this->AllocateIndividualBIBOP(MIN_BAG_SIZE << SizeClassIndex);
+                IndividualBIBOP* bibop = this->AllocateIndividualBIBOP(MIN_BAG_SIZE << SizeClassIndex, CSI);
+                if (bibop == nullptr) {
+                    return nullptr;
+                }
+                IB->ptr[SizeClassIndex] = bibop;
+                this->countChunk(CSI, 1);
 #ifdef STAT
-                *n_individual_pool += 1;
+                statAdd(&this->stats.individualPoolN, 1);
 #endif
                 return IB->ptr[SizeClassIndex];
             }
         }
 
         // if current is not allocated
-        if (IB->CSI == 0xFFFFFFFFFFFFFFFFUL) {
+        if (IB->key == 0) {
             Info2("New BIBOP with location %zu\n", index);
-            IB->ptr[SizeClassIndex] = this->AllocateIndividualBIBOP(MIN_BAG_SIZE << SizeClassIndex);
-            IB->CSI = CSI;
+            IndividualBIBOP* bibop = this->AllocateIndividualBIBOP(MIN_BAG_SIZE << SizeClassIndex, CSI);
+            if (bibop == nullptr) {
+                return nullptr;
+            }
+            IB->ptr[SizeClassIndex] = bibop;
+            IB->key = CSI + 1;
+            this->countChunk(CSI, 1);
 #ifdef STAT
-            *n_individual_pool += 1;
+            statAdd(&this->stats.individualPoolN, 1);
 #endif
             return IB->ptr[SizeClassIndex];
         }
@@ -259,68 +419,297 @@ GlobalBIBOP* MemoryManager::AllocateGlobalBIBOP(){
     auto* ptr = (GlobalBIBOP*)this->metadataPool->allocateMemory(sizeof(GlobalBIBOP));
     Debug("BIBOP to %p\n", ptr);
 
-    ptr->InitGlobalBIBOP();
+    ptr->InitGlobalBIBOP(this->colorBump, &this->bibopOptions);
+    this->colorBump += GLOBAL_BAG_N;
+    for (int i = 0; i < GLOBAL_BAG_N; i++) {
+        this->prepareChunk(ptr->getRegion(i), SITE_DEFAULT);
+        this->recordChunk(ptr->getBag(i));
+    }
     Debug("Type is set to %d\n", ptr->bibopType);
     return ptr;
 }
 
 void* MemoryManager::acquireIndividualDataPool() {
-    void* data = this->individualDataPool[this->individualDatPoolBump]->allocateMemory(INDIVIDUAL_BIBOP_SIZE);
+    latency_timer_t timer(this, LATENCY_EXTEND);
+    void* data = this->individualDataPool[this->individualDatPoolBump]->allocateMemory(this->bibopSize);
     if (data == nullptr) {
-        this->individualDatPoolBump++;
-        if (this->individualDatPoolBump >= INDIVIDUAL_DATA_POOL_N) {
+        // out of address space for this manager: the allocation fails instead of the process
+        if (this->individualDatPoolBump + 1 >= INDIVIDUAL_DATA_POOL_N) {
             Error("DataPool max reached (max=%d)\n", INDIVIDUAL_DATA_POOL_N);
-            exit(1);
+            return nullptr;
         }
+        SEMALLOC_PROBE2(pool_exhausted, this->thread_id, this->individualDatPoolBump);
+        this->individualDatPoolBump++;
 
         this->individualDataPool[this->individualDatPoolBump] =
                 MemoryPool::AllocateMemoryPool(INDIVIDUAL_DATA_POOL_SIZE);
-        data = this->individualDataPool[this->individualDatPoolBump]->allocateMemory(INDIVIDUAL_BIBOP_SIZE);
+        data = this->individualDataPool[this->individualDatPoolBump]->allocateMemory(this->bibopSize);
     }
 
     return data;
 }
 
-IndividualBIBOP* MemoryManager::AllocateIndividualBIBOP(size_t objectSize){
-    Debug("Allocate BIBOP of size %zx\n", INDIVIDUAL_BIBOP_SIZE);
+void MemoryManager::extendBIBOP(SingleBIBOP* bibop, void* chunk) {
+    bibop->ExtendSingleBIBOP((uint64_t)chunk, this->bibopSize, this->nextColor());
+    this->recordChunk(bibop);
+}
 
-    auto* ptr = (IndividualBIBOP*)this->metadataPool->allocateMemory(sizeof(IndividualBIBOP));
-    Debug("BIBOP to %p\n", ptr);
+// a chunk without a record, once the metadata pool is full, is left out of the heap walk
+void MemoryManager::recordChunk(SingleBIBOP* bibop) {
+    auto* record = (chunk_record_t*)this->metadataPool->allocateMemory(sizeof(chunk_record_t));
+    if (record != nullptr) {
+        bibop->recordChunk(record);
+    }
+}
+
+size_t MemoryManager::nextColor() {
+#ifdef BIBOP_COLORING
+    return this->coloring ? BIBOP_COLOR(this->colorBump++) : 0;
+#else
+    return 0;
+#endif
+}
+
+IndividualBIBOP* MemoryManager::AllocateIndividualBIBOP(size_t objectSize, size_t CSI){
+    latency_timer_t timer(this, LATENCY_NEW_BIBOP);
+    Debug("Allocate BIBOP of size %zx\n", this->bibopSize);
 
     void* data = this->acquireIndividualDataPool();
     Debug("Chunk allocated to BIBOP: %p\n", data);
+    if (data == nullptr) {
+        return nullptr;
+    }
 
-    ptr->InitIndividualBIBOP((uint64_t)data, objectSize, INDIVIDUAL_BIBOP_SIZE);
-    Debug("BIBOP base: %p, up to: %lx\n", data, (uint64_t)data + INDIVIDUAL_BIBOP_SIZE);
+    auto* ptr = (IndividualBIBOP*)this->metadataPool->allocateMemory(sizeof(IndividualBIBOP));
+    Debug("BIBOP to %p\n", ptr);
+
+    uint32_t policy = this->sitePolicy ? SitePolicy::lookup(CSI) : SITE_DEFAULT;
+    ptr->InitIndividualBIBOP((uint64_t)data, objectSize, this->bibopSize, &this->bibopOptions, this->nextColor(),
+                             policy, CSI);
+    this->recordChunk(ptr);
+    // published for the usage walk of other threads
+    ptr->nextBIBOP = this->individualList;
+    __atomic_store_n(&this->individualList, ptr, __ATOMIC_RELEASE);
+    this->prepareChunk(data, policy);
+    SEMALLOC_PROBE3(new_bibop, CSI, objectSize, ptr);
+    Debug("BIBOP base: %p, up to: %lx\n", data, (uint64_t)data + this->bibopSize);
     return ptr;
 }
 
+void MemoryManager::prepareChunk(void* chunk, uint32_t policy) {
+    if (policy & SITE_HUGEPAGE) {
+        madvise(chunk, this->bibopSize, MADV_HUGEPAGE);
+    }
+
+    size_t length = 0;
+    if (policy & SITE_PREFAULT) {
+        length = this->bibopSize < SITE_PREFAULT_SIZE ? this->bibopSize : SITE_PREFAULT_SIZE;
+    } else if (this->prefaultSize) {
+        length = this->takePrefaultBudget(this->prefaultSize);
+    }
+
+    if (length) {
+        MemoryPool::Prefault(chunk, length);
+    }
+}
+
+size_t MemoryManager::takePrefaultBudget(size_t length) {
+    static std::atomic<size_t> prefaultSpent;
+
+    size_t spent = prefaultSpent.fetch_add(length, std::memory_order_relaxed);
+    if (spent >= semallocOptions.prefaultBudget) {
+        return 0;
+    }
+    return length < semallocOptions.prefaultBudget - spent ? length : semallocOptions.prefaultBudget - spent;
+}
+
+size_t MemoryManager::prewarm(size_t realSize, size_t CSI, size_t count) {
+    this->handleFreeList();
+    if (realSize == 0 || realSize > BAG_THRESHOLD) {
+        return 0;
+    }
 
-void *MemoryManager::allocateHuge(size_t size) {
+    SingleBIBOP* bibop;
+    if (CSI != 0 && this->pinSite(CSI)) {
+        bibop = this->getIndividualBIBOPbyCSI(CSI, realSize);
+    } else {
+        bibop = *(globalBIBOP->size2BIBOP(realSize));
+    }
+    return bibop != nullptr ? bibop->prewarm(count) : 0;
+}
+
+
+void *MemoryManager::allocateHuge(size_t size, size_t CSI, size_t alignment) {
+    latency_timer_t timer(this, LATENCY_HUGE);
+    if (size > SIZE_MAX / 2 || alignment > SIZE_MAX / 4) {
+        errno = ENOMEM;
+        return nullptr;
+    }
     size_t new_size = (size + PAGE_SIZE - 1) & (~(PAGE_SIZE - 1));
+    size_t slack = alignment > PAGE_SIZE ? alignment : 0;
 
-    Debug("New size: %zu\n", new_size + PAGE_SIZE);
-    void* addr = mmap(nullptr, new_size + PAGE_SIZE, PROT_READ | PROT_WRITE,
+    Debug("New size: %zu\n", new_size + PAGE_SIZE + slack);
+    void* addr = mmap(nullptr, new_size + PAGE_SIZE + slack, PROT_READ | PROT_WRITE,
                       MAP_PRIVATE | MAP_ANON |MAP_NORESERVE, -1, 0);
 
-    if (addr == nullptr) {
+    if (addr == MAP_FAILED) {
         Error("mmap failed %p\n", addr);
-        exit(-1);
+        errno = ENOMEM;
+        return nullptr;
+    }
+
+    // cut the slack around an aligned mapping, so it is laid out as any other and frees the same way
+    if (slack) {
+        uint64_t data = ((uint64_t)addr + PAGE_SIZE + alignment - 1) & ~(alignment - 1);
+        size_t head = data - PAGE_SIZE - (uint64_t)addr;
+        size_t tail = slack - head;
+        if (head) {
+            munmap(addr, head);
+        }
+        if (tail) {
+            munmap((void*)(data + new_size), tail);
+        }
+        addr = (void*)(data - PAGE_SIZE);
     }
 
     void* data = (void*)((uint64_t)addr + PAGE_SIZE);
     auto* header = (HugeHeader*)((uint64_t)data - HEADER_SIZE);
     header->size = new_size;
+    header->setSite(CSI);
     header->setHuge();
+    hugeBytes.fetch_add(new_size + PAGE_SIZE, std::memory_order_relaxed);
+    hugeN.fetch_add(1, std::memory_order_relaxed);
+    SEMALLOC_PROBE3(huge_map, data, new_size, CSI);
+
+    if (this->isHeap) {
+        header->heap = this->thread_id;
+        auto* link = (HugeLink*)addr;
+        while (this->hugeLock.test_and_set(std::memory_order_acquire));
+        link->prev = nullptr;
+        link->nxt = this->hugeList;
+        if (this->hugeList != nullptr) {
+            this->hugeList->prev = link;
+        }
+        this->hugeList = link;
+        this->hugeLock.clear(std::memory_order_release);
+    }
 
     Debug("Allocated to %p\n", data);
     return data;
 }
 
 
+void MemoryManager::freeHugeMemory(void *ptr) {
+    auto* header = (HugeHeader*)((uint64_t)ptr - HEADER_SIZE);
+    auto* addr = (void*)((uint64_t)ptr - PAGE_SIZE);
+    if (header->heap) {
+        globalMemoryManager[header->heap]->unlinkHuge((HugeLink*)addr);
+    }
+    hugeBytes.fetch_sub(header->size + PAGE_SIZE, std::memory_order_relaxed);
+    hugeN.fetch_sub(1, std::memory_order_relaxed);
+#ifdef CSI_PROFILE
+    if (SiteProfile::enabled) {
+        SiteProfile::countHugeFree(header->getSite());
+    }
+#endif
+#ifdef HEAP_SAMPLING
+    if (header->isSampled()) {
+        HeapSampler::release(header);
+    }
+#endif
+    SEMALLOC_PROBE2(huge_unmap, ptr, header->size);
+    munmap(addr, header->size + PAGE_SIZE);
+}
+
+void MemoryManager::pinManagers() {
+    for (;;) {
+        while (managerRetiring.load(std::memory_order_acquire));
+        managerPins.fetch_add(1, std::memory_order_seq_cst);
+        if (!managerRetiring.load(std::memory_order_seq_cst)) {
+            return;
+        }
+        managerPins.fetch_sub(1, std::memory_order_release);
+    }
+}
+
+void MemoryManager::unpinManagers() {
+    managerPins.fetch_sub(1, std::memory_order_release);
+}
+
+void MemoryManager::lockManagers() {
+    while (managerRetiring.exchange(true, std::memory_order_seq_cst));
+    while (managerPins.load(std::memory_order_seq_cst) != 0);
+}
+
+void MemoryManager::unlockManagers() {
+    managerRetiring.store(false, std::memory_order_release);
+}
+
+void MemoryManager::unlinkHuge(HugeLink* link) {
+    while (this->hugeLock.test_and_set(std::memory_order_acquire));
+    if (link->prev != nullptr) {
+        link->prev->nxt = link->nxt;
+    } else {
+        this->hugeList = link->nxt;
+    }
+    if (link->nxt != nullptr) {
+        link->nxt->prev = link->prev;
+    }
+    this->hugeLock.clear(std::memory_order_release);
+}
+
+void MemoryManager::DestroyMemoryManager() {
+    // everything a heap owns sits in its pools, its bags and its huge list
+    while (this->hugeList != nullptr) {
+        auto* link = this->hugeList;
+        this->hugeList = link->nxt;
+        auto* header = (HugeHeader*)((uint64_t)link + PAGE_SIZE - HEADER_SIZE);
+        hugeBytes.fetch_sub(header->size + PAGE_SIZE, std::memory_order_relaxed);
+        hugeN.fetch_sub(1, std::memory_order_relaxed);
+        munmap(link, header->size + PAGE_SIZE);
+    }
+
+    ((GlobalBIBOP*)this->globalBIBOP)->DestroyGlobalBIBOP();
+    for (size_t i = 0; i <= this->individualDatPoolBump; i++) {
+        this->individualDataPool[i]->releaseMemoryPool();
+    }
+    this->metadataPool->releaseMemoryPool();
+#ifdef CSI_PROFILE
+    if (this->profile) {
+        SiteProfile::RetireTable(this->profile);
+    }
+#endif
+#ifdef HEAP_SAMPLING
+    // the objects of the heap go without a free
+    if (HeapSampler::enabled) {
+        HeapSampler::releaseOwner(this->thread_id);
+    }
+#endif
+    munmap(this, sizeof(MemoryManager));
+}
+
+#ifdef HEAP_SAMPLING
+void MemoryManager::takeSample(void* ptr, size_t realSize, size_t CSI) {
+    this->sampleCountdown = HeapSampler::nextInterval(&this->sampleSeed);
+    if (ptr == nullptr) {
+        return;
+    }
+
+    void* header = (void*)((uint64_t)ptr - HEADER_SIZE);
+    if (HeapSampler::sample(header, realSize, CSI, this->thread_id)) {
+        if (realSize > BAG_THRESHOLD) {
+            ((HugeHeader*)header)->setSampled();
+        } else {
+            ((RegularHeader*)header)->setSampled();
+        }
+    }
+}
+#endif
+
 void MemoryManager::freeOtherThreadMemory(void *ptr) {
     // convert head to metadata
     auto currentFreeObject = (ListElement*)ptr;
+    this->countRemotePush(1);
 
     auto curHead = this->FreeList.load();
     currentFreeObject->nxt = curHead;
@@ -331,8 +720,80 @@ void MemoryManager::freeOtherThreadMemory(void *ptr) {
     Debug("Now head ptr: %p\n", this->FreeList.load());
 }
 
+void MemoryManager::freeOtherThreadMemory(ListElement* head, ListElement* tail, size_t n) {
+    // splice a whole chain with a single CAS
+    this->countRemotePush(n);
+    auto curHead = this->FreeList.load();
+    tail->nxt = curHead;
+    while (!std::atomic_compare_exchange_weak(&(this->FreeList), &curHead, head)) {
+        curHead = this->FreeList.load();
+        tail->nxt = curHead;
+    }
+}
+
+
+size_t MemoryManager::trim(bool owner) {
+    if (owner) {
+        return this->trimLocal();
+    }
+
+    // no thread would serve a request on an exited thread's manager or an unused heap
+    if (!this->claim(MANAGER_BUSY)) {
+        this->trimRequested.store(true, std::memory_order_relaxed);
+        return 0;
+    }
+    this->trimRequested.store(false, std::memory_order_relaxed);
+    // the remote frees go back to their bags first, so their pages go as well
+    this->handleFreeList();
+    size_t released = this->trimLocal();
+    this->leave();
+    return released;
+}
+
+size_t MemoryManager::trimLocal() {
+    size_t released = ((GlobalBIBOP*)this->globalBIBOP)->trim();
+    for (auto* bibop = this->individualList; bibop != nullptr; bibop = bibop->nextBIBOP) {
+        released += bibop->trim();
+    }
+    Debug("Trimmed %zu bytes of manager %u\n", released, this->thread_id);
+    return released;
+}
+
+void MemoryManager::accountUsage(semalloc_usage_t* usage) {
+    ((GlobalBIBOP*)this->globalBIBOP)->accountUsage(&usage->global);
+    auto* bibop = __atomic_load_n(&this->individualList, __ATOMIC_ACQUIRE);
+    for (; bibop != nullptr; bibop = bibop->nextBIBOP) {
+        bibop->accountUsage(&usage->individual);
+    }
+}
+
+void MemoryManager::accountBags(usage_t* bags) {
+    for (size_t i = 0; i < GLOBAL_BAG_N; i++) {
+        ((GlobalBIBOP*)this->globalBIBOP)->getBag(i)->accountUsage(&bags[i]);
+    }
+    auto* bibop = __atomic_load_n(&this->individualList, __ATOMIC_ACQUIRE);
+    for (; bibop != nullptr; bibop = bibop->nextBIBOP) {
+        bibop->accountUsage(&bags[BIBOP::computeSizeIndex(bibop->getObjectSize())]);
+    }
+}
+
+void MemoryManager::accountHugeUsage(semalloc_usage_t* usage) {
+    usage->huge.arena += hugeBytes.load(std::memory_order_relaxed);
+    usage->huge.inUse += hugeBytes.load(std::memory_order_relaxed);
+    usage->huge.blocks += hugeN.load(std::memory_order_relaxed);
+}
 
 void MemoryManager::handleFreeList() {
+    if (this->trimRequested.load(std::memory_order_relaxed)) {
+        this->trimRequested.store(false, std::memory_order_relaxed);
+        this->trimLocal();
+    }
+    if (this->FreeList == nullptr) {
+        return;
+    }
+
+    latency_timer_t timer(this, LATENCY_DRAIN);
+    size_t drained = 0;
     while (this->FreeList != nullptr) {
         auto currentPtr = this->FreeList.load();
         auto nxt = currentPtr->nxt;
@@ -349,40 +810,119 @@ void MemoryManager::handleFreeList() {
             exit(-1);
         }
 
+        RegularHeader* slot = header->slot();
+#ifdef HEAP_SAMPLING
+        if (header->isSampled()) {
+            HeapSampler::release(slot);
+        }
+#endif
+#ifdef CSI_PROFILE
+        if (this->profile) {
+            SiteProfile::countFree(this->profile, slot->CSI);
+        }
+#endif
+        header->setFree();
+        slot->setFree();
+
         if (!header->isRegular()) {
             auto* bibop = (GlobalBIBOP*)header->bibop;
-            bibop->freeGlobalObject(header);
+            bibop->freeGlobalObject(slot);
         } else {
             auto* bibop = (IndividualBIBOP*)header->bibop;
-            bibop->freeIndividualObject(header);
+            bibop->freeIndividualObject(slot, slot->isGlobal());
         }
 
         Debug("Handle done: %p\n", currentPtr);
-        header->setFree();
+        drained++;
+#ifdef STAT
+        if (this->variant & ALLOC_COUNTED) {
+            statAdd(&this->stats.remoteFreeN, 1);
+        }
+#endif
     }
+    SEMALLOC_PROBE2(drain, this->thread_id, drained);
 }
 
 #ifdef LAZY_LOOP
-bool MemoryManager::tryPutToLazyPool(size_t CSI) {
+bool MemoryManager::tryPutToLazyPool(size_t CSI, size_t realSize) {
     /**
      * Lazy Identifiers:
-     *      1: first time seen
-     *      0: already exists
+     *      1: keep the allocation in the global bags
+     *      0: allocate from the CSI's individual BIBOP
      */
+    if (!this->lazyLoop && !this->sitePolicy) {
+        return MemoryBudget::underPressure();
+    }
+
+    this->allocTick++;
     uint16_t BIBOPIndex = hash(CSI); // TODO: possibly a map?
+    latency_timer_t probeTimer(this, LATENCY_PROBE, false);
     for (uint32_t i = 0; i < (INDIVIDUAL_DATA_POOL_N << 8); i++) {
+        if (i == LATENCY_LONG_PROBE) {
+            probeTimer.start();
+        }
         uint32_t index = (i + BIBOPIndex) % (INDIVIDUAL_DATA_POOL_N << 8);
-        if (this->lazyIdentifiers[index].CSI == CSI) {
-            if (this->lazyIdentifiers[index].occurCount < LAZY_OCCUR) {
-                this->lazyIdentifiers[index].occurCount++;
-                return true;
+        lazy_element_t* site = &this->lazyIdentifiers[index];
+        if (site->CSI == CSI) {
+            if (site->promoted) {
+                // under pressure only the pinned sites keep growing their BIBOPs
+                if (MemoryBudget::underPressure() && !(site->policy & SITE_DEDICATED)) {
+                    return true;
+                }
+                if (++site->windowCount < this->demoteWindow) {
+                    return false;
+                }
+                return this->tryDemote(site);
             }
-            return false;
+            return this->tryPromote(site, realSize);
         }
 
-        if (this->lazyIdentifiers[index].CSI == 0) {
-            this->lazyIdentifiers[index].CSI = CSI;
-            this->lazyIdentifiers[index].occurCount = 1;
+        if (site->CSI == 0) {
+            uint32_t policy = this->sitePolicy ? SitePolicy::lookup(CSI) : SITE_DEFAULT;
+            site->CSI = CSI;
+            site->policy = policy;
+            site->windowStart = this->allocTick;
+            if (policy & SITE_DEDICATED) {
+                site->promoted = 1;
+                return false;
+            }
+#ifdef SHARED_CSI_KNOWLEDGE
+            // another thread already warmed this site up, or demoted it and so delays the warm-up
+            if (!(policy & SITE_GLOBAL) && !MemoryBudget::underPressure() &&
+                CSIKnowledge::isPromoted(CSI, BIBOP::computeSizeIndex(realSize))) {
+                site->promoted = 1;
+                return false;
+            }
+            site->demotions = CSIKnowledge::demotions(CSI);
+#endif
+            return this->tryPromote(site, realSize);
+        }
+    }
+    Error("No enough space for CSI: %zu\n", CSI);
+    exit(1);
+}
+
+// promote the loop CSI now and never demote it; false if its policy keeps it global
+bool MemoryManager::pinSite(size_t CSI) {
+    if (!this->lazyLoop && !this->sitePolicy) {
+        return true;
+    }
+
+    uint16_t BIBOPIndex = hash(CSI);
+    for (uint32_t i = 0; i < (INDIVIDUAL_DATA_POOL_N << 8); i++) {
+        uint32_t index = (i + BIBOPIndex) % (INDIVIDUAL_DATA_POOL_N << 8);
+        lazy_element_t* site = &this->lazyIdentifiers[index];
+        if (site->CSI == 0) {
+            site->CSI = CSI;
+            site->policy = this->sitePolicy ? SitePolicy::lookup(CSI) : SITE_DEFAULT;
+        }
+
+        if (site->CSI == CSI) {
+            if (site->policy & SITE_GLOBAL) {
+                return false;
+            }
+            site->policy |= SITE_DEDICATED;
+            site->promoted = 1;
             return true;
         }
     }
@@ -390,8 +930,92 @@ bool MemoryManager::tryPutToLazyPool(size_t CSI) {
     exit(1);
 }
 
+bool MemoryManager::tryPromote(lazy_element_t* site, size_t realSize) {
+    if (site->policy & SITE_GLOBAL) {
+        return true;
+    }
+
+    if (site->occurCount < UINT8_MAX) {
+        site->occurCount++;
+    }
+    if (this->allocTick - site->windowStart > this->promoteWindow) {
+        site->windowStart = this->allocTick;
+        site->windowCount = 0;
+    }
+    site->windowCount++;
+
+    uint32_t backoff = site->demotions < LAZY_BACKOFF_MAX ? site->demotions : LAZY_BACKOFF_MAX;
+    if (site->occurCount > this->lazyOccur && site->windowCount >= (this->promoteCount << backoff) &&
+        !MemoryBudget::underPressure()) {
+        Info2("Promote CSI %zu\n", site->CSI);
+        SEMALLOC_PROBE3(promote, this->thread_id, site->CSI, realSize);
+        site->promoted = 1;
+        site->windowCount = 0;
+#ifdef SHARED_CSI_KNOWLEDGE
+        CSIKnowledge::publishPromotion(site->CSI, realSize, BIBOP::computeSizeIndex(realSize));
+#endif
+        return false;
+    }
+    return true;
+}
+
+bool MemoryManager::tryDemote(lazy_element_t* site) {
+    // end of a demotion window, the CSI keeps its BIBOP unless it stayed tiny for a while;
+    // a nursery has few objects live by design, and is cheaper than the global bags
+    site->windowCount = 0;
+    bool nursery = false;
+    if ((site->policy & SITE_DEDICATED) || this->countLiveObjects(site->CSI, &nursery) >= this->demoteLive ||
+        nursery) {
+        site->tinyN = 0;
+        return false;
+    }
+
+    if (++site->tinyN < LAZY_DEMOTE_TINY_N) {
+        return false;
+    }
+
+    Info2("Demote CSI %zu\n", site->CSI);
+    SEMALLOC_PROBE2(demote, this->thread_id, site->CSI);
+    site->promoted = 0;
+    site->tinyN = 0;
+    if (site->demotions < UINT8_MAX) {
+        site->demotions++;
+    }
+    site->windowStart = this->allocTick;
+#ifdef SHARED_CSI_KNOWLEDGE
+    CSIKnowledge::publishDemotion(site->CSI);
+#endif
+    return true;
+}
+
+size_t MemoryManager::countLiveObjects(size_t CSI, bool* nursery) {
+    uint16_t BIBOPIndex = hash(CSI);
+    for (size_t offset = 0; offset < INDIVIDUAL_BIBOP_MAX_N; offset++) {
+        IndividualBIBOP_c_t *IB = &this->individualBIBOP[(BIBOPIndex + offset) % INDIVIDUAL_BIBOP_MAX_N];
+        if (IB->key == CSI + 1) {
+            size_t live = 0;
+            for (auto* bibop : IB->ptr) {
+                if (bibop != nullptr) {
+                    live += bibop->getLiveN();
+                    *nursery |= bibop->inNursery();
+                }
+            }
+            return live;
+        }
+
+        if (IB->key == 0) {
+            break;
+        }
+    }
+    return 0;
+}
+
 #else
-bool MemoryManager::tryPutToLazyPool(size_t CSI) {
-    return false;
+bool MemoryManager::tryPutToLazyPool(size_t CSI, size_t realSize) {
+    return MemoryBudget::underPressure();
+}
+
+bool MemoryManager::pinSite(size_t CSI) {
+    return true;
 }
 #endif
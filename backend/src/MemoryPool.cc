@@ -25,4 +25,9 @@ void* MemoryPool::getBumpMemory() {
 
 void* MemoryPool::getPoolBase() {
     return this->baseMemory;
+}
+
+void MemoryPool::releaseMemoryPool() {
+    munmap(this->baseMemory, (size_t)this->boundaryMemory - (size_t)this->baseMemory);
+    munmap(this, sizeof(MemoryPool));
 }
\ No newline at end of file
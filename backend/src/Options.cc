@@ -0,0 +1,228 @@
+#include <atomic>
+#include "Options.hh"
+#include "SitePolicy.hh"
+#include "MemoryBudget.hh"
+#include "Profile.hh"
+#include "Clock.hh"
+#include "CallSite.hh"
+
+Options semallocOptions = {
+#ifdef LAZY_LOOP
+        true,
+#else
+        false,
+#endif
+        LAZY_OCCUR,
+        LAZY_PROMOTE_COUNT,
+        LAZY_PROMOTE_WINDOW,
+        LAZY_DEMOTE_LIVE,
+        LAZY_DEMOTE_WINDOW,
+#ifdef REGULAR_MEMORY_RELEASE
+        true,
+        MEMORY_RELEASE_THRESHOLD,
+#else
+        false,
+        SIZE_MAX,
+#endif
+        INDIVIDUAL_BIBOP_SIZE,
+#ifdef BIBOP_COLORING
+        true,
+#else
+        false,
+#endif
+        PREFAULT_SIZE,
+        PREFAULT_BUDGET,
+        0,
+        BUDGET_PRESSURE_AVG10,
+#ifdef STAT
+        true,
+#else
+        false,
+#endif
+        HEAP_SAMPLE_INTERVAL,
+        false,
+        0,
+        0,
+        0,
+        "",
+        "",
+        "",
+        "",
+        "",
+};
+
+static std::atomic<int> optionState; // 0: not parsed, 1: parsing, 2: done
+
+// no allocation here: we may be running inside the first malloc
+static bool parseSize(const char* begin, const char* end, size_t* value) {
+    if (begin == end) {
+        return false;
+    }
+
+    size_t result = 0;
+    const char* c = begin;
+    for (; c < end && *c >= '0' && *c <= '9'; c++) {
+        if (__builtin_mul_overflow(result, 10, &result) || __builtin_add_overflow(result, *c - '0', &result)) {
+            return false;
+        }
+    }
+
+    if (c < end) {
+        size_t shift;
+        switch (*c) {
+            case 'k': case 'K': shift = 10; break;
+            case 'm': case 'M': shift = 20; break;
+            case 'g': case 'G': shift = 30; break;
+            default: return false;
+        }
+        if (result > (SIZE_MAX >> shift)) {
+            return false;
+        }
+        result <<= shift;
+        c++;
+    }
+
+    *value = result;
+    return c == end;
+}
+
+static bool keyIs(const char* begin, const char* end, const char* key) {
+    size_t length = strlen(key);
+    return (size_t)(end - begin) == length && memcmp(begin, key, length) == 0;
+}
+
+static void copyPath(char* out, size_t size, const char* value, const char* valueEnd) {
+    size_t length = valueEnd - value;
+    if (length >= size) {
+        Error("SEMALLOC_OPTIONS: path too long (%zu)\n", length);
+        return;
+    }
+    memcpy(out, value, length);
+    out[length] = 0;
+}
+
+static void applyOption(const char* key, const char* keyEnd, const char* value, const char* valueEnd) {
+    if (keyIs(key, keyEnd, "policy")) {
+        copyPath(semallocOptions.policyFile, sizeof semallocOptions.policyFile, value, valueEnd);
+        return;
+    }
+    if (keyIs(key, keyEnd, "trace")) {
+        copyPath(semallocOptions.traceFile, sizeof semallocOptions.traceFile, value, valueEnd);
+        return;
+    }
+    if (keyIs(key, keyEnd, "profile")) {
+        copyPath(semallocOptions.profileFile, sizeof semallocOptions.profileFile, value, valueEnd);
+        return;
+    }
+    if (keyIs(key, keyEnd, "heap_profile")) {
+        copyPath(semallocOptions.heapProfileFile, sizeof semallocOptions.heapProfileFile, value, valueEnd);
+        return;
+    }
+    if (keyIs(key, keyEnd, "frag_report")) {
+        copyPath(semallocOptions.fragReportFile, sizeof semallocOptions.fragReportFile, value, valueEnd);
+        return;
+    }
+
+    size_t number;
+    if (!parseSize(value, valueEnd, &number)) {
+        Error("SEMALLOC_OPTIONS: bad value for %.*s\n", (int)(keyEnd - key), key);
+        return;
+    }
+
+    if (keyIs(key, keyEnd, "lazy_loop")) {
+        semallocOptions.lazyLoop = number != 0;
+    } else if (keyIs(key, keyEnd, "lazy_occur")) {
+        // occurCount is a byte
+        semallocOptions.lazyOccur = number < 255 ? number : 255;
+    } else if (keyIs(key, keyEnd, "promote_count")) {
+        semallocOptions.promoteCount = number;
+    } else if (keyIs(key, keyEnd, "promote_window")) {
+        semallocOptions.promoteWindow = number;
+    } else if (keyIs(key, keyEnd, "demote_live")) {
+        semallocOptions.demoteLive = number;
+    } else if (keyIs(key, keyEnd, "demote_window")) {
+        semallocOptions.demoteWindow = number;
+    } else if (keyIs(key, keyEnd, "memory_release")) {
+        semallocOptions.memoryRelease = number != 0;
+    } else if (keyIs(key, keyEnd, "release_threshold")) {
+        semallocOptions.releaseThreshold = number;
+    } else if (keyIs(key, keyEnd, "bibop_size")) {
+        if (number < PAGE_SIZE * 64 || number > INDIVIDUAL_BIBOP_SIZE || (number & (number - 1))) {
+            Error("SEMALLOC_OPTIONS: bibop_size must be a power of two in [%d, %lu]\n",
+                  PAGE_SIZE * 64, INDIVIDUAL_BIBOP_SIZE);
+            return;
+        }
+        semallocOptions.bibopSize = number;
+    } else if (keyIs(key, keyEnd, "coloring")) {
+        semallocOptions.coloring = number != 0;
+    } else if (keyIs(key, keyEnd, "prefault")) {
+        semallocOptions.prefaultSize = number;
+    } else if (keyIs(key, keyEnd, "prefault_budget")) {
+        semallocOptions.prefaultBudget = number;
+    } else if (keyIs(key, keyEnd, "budget")) {
+        semallocOptions.budget = number;
+    } else if (keyIs(key, keyEnd, "pressure")) {
+        semallocOptions.pressure = number;
+    } else if (keyIs(key, keyEnd, "stat")) {
+        semallocOptions.stat = number != 0;
+    } else if (keyIs(key, keyEnd, "sample_interval")) {
+        semallocOptions.sampleInterval = number ? number : 1;
+    } else if (keyIs(key, keyEnd, "latency")) {
+        semallocOptions.latency = number != 0;
+    } else if (keyIs(key, keyEnd, "live_stats")) {
+        semallocOptions.liveStats = number < UINT32_MAX ? number : UINT32_MAX;
+    } else if (keyIs(key, keyEnd, "auto_csi")) {
+        semallocOptions.autoCSI = number < AUTO_CSI_MAX_FRAMES ? number : AUTO_CSI_MAX_FRAMES;
+    } else if (keyIs(key, keyEnd, "nursery")) {
+        semallocOptions.nursery = number < UINT32_MAX ? number : UINT32_MAX;
+    } else {
+        Error("SEMALLOC_OPTIONS: unknown option %.*s\n", (int)(keyEnd - key), key);
+    }
+}
+
+void Options::InitOptions() {
+    int expected = 0;
+    if (!optionState.compare_exchange_strong(expected, 1, std::memory_order_acquire)) {
+        while (optionState.load(std::memory_order_acquire) != 2);
+        return;
+    }
+
+    const char* options = getenv("SEMALLOC_OPTIONS");
+    while (options != nullptr && *options) {
+        const char* key = options;
+        const char* end = strchr(options, ',');
+        if (end == nullptr) {
+            end = options + strlen(options);
+        }
+
+        const char* separator = (const char*)memchr(key, '=', end - key);
+        if (separator != nullptr) {
+            applyOption(key, separator, separator + 1, end);
+        } else if (end > key) {
+            Error("SEMALLOC_OPTIONS: missing value for %.*s\n", (int)(end - key), key);
+        }
+        options = *end ? end + 1 : end;
+    }
+
+    // the lazy pool tells the sites that repeat from the others
+    if (semallocOptions.autoCSI) {
+        semallocOptions.lazyLoop = true;
+    }
+    if (!semallocOptions.memoryRelease) {
+        semallocOptions.releaseThreshold = SIZE_MAX;
+    }
+    if (semallocOptions.policyFile[0]) {
+        SitePolicy::LoadSitePolicy(semallocOptions.policyFile);
+    }
+    MemoryBudget::InitMemoryBudget();
+    Clock::InitClock();
+    if (semallocOptions.profileFile[0] || semallocOptions.heapProfileFile[0] || semallocOptions.fragReportFile[0]) {
+        SiteProfile::InitProfile();
+    }
+    optionState.store(2, std::memory_order_release);
+}
+
+static void __attribute__((constructor))
+initOptionsAtLoad(void) {
+    Options::InitOptions();
+}
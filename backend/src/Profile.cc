@@ -0,0 +1,289 @@
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstddef>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "Profile.hh"
+#include "DumpWriter.hh"
+#include "MemoryManager.hh"
+#include "HeapSample.hh"
+#include "HeapWalk.hh"
+
+extern MemoryManager* globalMemoryManager[MAX_MANAGER];
+
+bool SiteProfile::enabled;
+site_profile_t* SiteProfile::sharedSites;
+
+site_profile_t* SiteProfile::AllocateTable() {
+    void* table = mmap(nullptr, PROFILE_SITE_N * sizeof(site_profile_t), PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANON | MAP_NORESERVE, -1, 0);
+    if (table == MAP_FAILED) {
+        Error("profile table mmap failed (%zu bytes)\n", PROFILE_SITE_N * sizeof(site_profile_t));
+        return nullptr;
+    }
+    return (site_profile_t*)table;
+}
+
+site_profile_t* SiteProfile::find(site_profile_t* table, size_t CSI) {
+    uint32_t key = PROFILE_KEY(CSI);
+    uint16_t index = hash(CSI);
+
+    for (uint32_t i = 0; i < PROFILE_SITE_N; i++) {
+        site_profile_t* site = &table[(uint16_t)(index + i)];
+        uint32_t current = __atomic_load_n(&site->key, __ATOMIC_ACQUIRE);
+        if (current == key) {
+            return site;
+        }
+
+        // the shared table and the dump's merge are the only ones with racing inserts
+        if (current == 0) {
+            if (__atomic_compare_exchange_n(&site->key, &current, key, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) ||
+                current == key) {
+                return site;
+            }
+        }
+    }
+
+    // a full table drops the counts of the sites that do not fit
+    return nullptr;
+}
+
+void SiteProfile::merge(site_profile_t* table, const site_profile_t* from) {
+    site_profile_t* site = find(table, from->key & ~0x80000000U);
+    if (site == nullptr) {
+        return;
+    }
+
+    if (__atomic_load_n(&from->loop, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&site->loop, 1, __ATOMIC_RELAXED);
+    }
+    auto* counters = (const size_t*)&from->mallocN;
+    auto* totals = (size_t*)&site->mallocN;
+    // live and peak live add up as two's complement like the others
+    for (size_t i = 0; i < (sizeof(site_profile_t) - offsetof(site_profile_t, mallocN)) / sizeof(size_t); i++) {
+        __atomic_fetch_add(totals + i, __atomic_load_n(counters + i, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    }
+}
+
+void SiteProfile::RetireTable(site_profile_t* table) {
+    for (size_t i = 0; i < PROFILE_SITE_N; i++) {
+        if (table[i].key) {
+            merge(sharedSites, &table[i]);
+        }
+    }
+    munmap(table, PROFILE_SITE_N * sizeof(site_profile_t));
+}
+
+void SiteProfile::countHugeMalloc(size_t CSI, bool loop, size_t bytes) {
+    site_profile_t* site = find(sharedSites, CSI);
+    if (site == nullptr) {
+        return;
+    }
+
+    if (loop) {
+        __atomic_store_n(&site->loop, 1, __ATOMIC_RELAXED);
+    }
+    __atomic_fetch_add(&site->mallocN, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&site->bytes, bytes, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&site->classN[PROFILE_HUGE_CLASS], 1, __ATOMIC_RELAXED);
+    int64_t live = __atomic_add_fetch(&site->live, 1, __ATOMIC_RELAXED);
+    int64_t peak = __atomic_load_n(&site->peakLive, __ATOMIC_RELAXED);
+    while (live > peak &&
+           !__atomic_compare_exchange_n(&site->peakLive, &peak, live, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+void SiteProfile::countHugeFree(size_t CSI) {
+    site_profile_t* site = find(sharedSites, CSI);
+    if (site == nullptr) {
+        return;
+    }
+
+    __atomic_fetch_add(&site->freeN, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_sub(&site->live, 1, __ATOMIC_RELAXED);
+}
+
+static void writeSite(dump_writer_t* out, const site_profile_t* site) {
+    out->put("{\"csi\":\"");
+    out->putHex(site->key & ~0x80000000U);
+    out->put(site->loop ? "\",\"loop\":true" : "\",\"loop\":false");
+    out->putField("mallocs", (int64_t)site->mallocN);
+    out->putField("frees", (int64_t)site->freeN);
+    out->putField("bytes", (int64_t)site->bytes);
+    out->putField("live", site->live);
+    out->putField("peak_live", site->peakLive);
+    out->putField("bibops", (int64_t)site->bibopN);
+    out->putField("chunks", (int64_t)site->chunkN);
+    out->put(",\"sizes\":{");
+
+    bool first = true;
+    for (size_t i = 0; i <= PROFILE_HUGE_CLASS; i++) {
+        if (site->classN[i] == 0) {
+            continue;
+        }
+        out->put(first ? "\"" : ",\"");
+        if (i == PROFILE_HUGE_CLASS) {
+            out->put("huge");
+        } else {
+            out->putNumber(MIN_BAG_SIZE << i);
+        }
+        out->put("\":");
+        out->putNumber((int64_t)site->classN[i]);
+        first = false;
+    }
+    out->put("}}");
+}
+
+void SiteProfile::Dump() {
+    static std::atomic<bool> dumping;
+    if (!enabled || dumping.exchange(true, std::memory_order_acquire)) {
+        return;
+    }
+
+    // sum all tables into a scratch one, then rank its sites
+    size_t tableSize = PROFILE_SITE_N * sizeof(site_profile_t);
+    size_t rankSize = PROFILE_SITE_N * sizeof(site_profile_t*);
+    auto* total = (site_profile_t*)mmap(nullptr, tableSize + rankSize, PROT_READ | PROT_WRITE,
+                                        MAP_PRIVATE | MAP_ANON | MAP_NORESERVE, -1, 0);
+    int fd = open(semallocOptions.profileFile, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (total == MAP_FAILED || fd < 0) {
+        Error("profile: cannot write %s\n", semallocOptions.profileFile);
+        if (total != MAP_FAILED) {
+            munmap(total, tableSize + rankSize);
+        }
+        dumping.store(false, std::memory_order_release);
+        return;
+    }
+
+    MemoryManager::pinManagers();
+    for (size_t id = 0; id <= MAX_MANAGER; id++) {
+        site_profile_t* table = sharedSites;
+        if (id < MAX_MANAGER) {
+            auto* manager = __atomic_load_n(&globalMemoryManager[id], __ATOMIC_ACQUIRE);
+            table = manager != nullptr ? manager->getProfile() : nullptr;
+        }
+        if (table == nullptr) {
+            continue;
+        }
+        for (size_t i = 0; i < PROFILE_SITE_N; i++) {
+            if (__atomic_load_n(&table[i].key, __ATOMIC_ACQUIRE)) {
+                merge(total, &table[i]);
+            }
+        }
+    }
+    MemoryManager::unpinManagers();
+
+    auto** ranked = (site_profile_t**)((uint64_t)total + tableSize);
+    size_t siteN = 0;
+    for (size_t i = 0; i < PROFILE_SITE_N; i++) {
+        if (total[i].key) {
+            ranked[siteN++] = &total[i];
+        }
+    }
+    std::sort(ranked, ranked + siteN, [](const site_profile_t* a, const site_profile_t* b) {
+        return a->bytes > b->bytes;
+    });
+
+    dump_writer_t out;
+    out.fd = fd;
+    out.n = 0;
+    out.put("{\"pid\":");
+    out.putNumber(getpid());
+    out.put(",\"sites\":[");
+    for (size_t i = 0; i < siteN; i++) {
+        out.put(i ? ",\n" : "\n");
+        writeSite(&out, ranked[i]);
+    }
+    out.put("\n]}\n");
+    out.flush();
+
+    close(fd);
+    munmap(total, tableSize + rankSize);
+    dumping.store(false, std::memory_order_release);
+}
+
+static void dumpAll() {
+    SiteProfile::Dump();
+#ifdef HEAP_SAMPLING
+    if (HeapSampler::enabled) {
+        HeapSampler::Dump(semallocOptions.heapProfileFile);
+    }
+#endif
+    if (semallocOptions.fragReportFile[0]) {
+        HeapWalk::Report(semallocOptions.fragReportFile);
+    }
+}
+
+// SIGUSR2 writes a byte, the dump thread reads it; the dumps pin the managers and report
+// errors with stdio, neither of which a signal handler may do
+static int dumpPipe[2] = {-1, -1};
+
+static void dumpOnSignal(int) {
+    int savedErrno = errno;
+    char request = 0;
+    // a full pipe already holds a request
+    ssize_t written = write(dumpPipe[1], &request, 1);
+    (void)written;
+    errno = savedErrno;
+}
+
+static void* dumpThread(void*) {
+    char request;
+    while (true) {
+        ssize_t n = read(dumpPipe[0], &request, 1);
+        if (n == 1) {
+            dumpAll();
+        } else if (n == 0 || errno != EINTR) {
+            return nullptr;
+        }
+    }
+}
+
+void SiteProfile::StartDumpThread() {
+    static std::atomic<bool> started;
+    if (dumpPipe[0] < 0 || started.exchange(true)) {
+        return;
+    }
+
+    pthread_t thread;
+    pthread_attr_t attributes;
+    pthread_attr_init(&attributes);
+    pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+    int error = pthread_create(&thread, &attributes, dumpThread, nullptr);
+    pthread_attr_destroy(&attributes);
+    if (error != 0) {
+        Error("profile: cannot start the dump thread (%d)\n", error);
+    }
+}
+
+void SiteProfile::InitProfile() {
+#if defined(CSI_PROFILE) && defined(STAT)
+    if (semallocOptions.profileFile[0]) {
+        sharedSites = AllocateTable();
+        enabled = sharedSites != nullptr;
+    }
+#endif
+#ifdef HEAP_SAMPLING
+    if (semallocOptions.heapProfileFile[0]) {
+        HeapSampler::InitHeapSampler();
+    }
+#endif
+
+    if (pipe2(dumpPipe, O_CLOEXEC) != 0) {
+        Error("profile: no pipe for the SIGUSR2 dump (%d)\n", errno);
+        return;
+    }
+    fcntl(dumpPipe[1], F_SETFL, O_NONBLOCK);
+
+    struct sigaction action = {};
+    action.sa_handler = dumpOnSignal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGUSR2, &action, nullptr);
+}
+
+static void __attribute__((destructor))
+dumpProfileAtExit(void) {
+    dumpAll();
+}
@@ -2,42 +2,391 @@
 // Created by r53wang on 4/4/23.
 //
 #include "SingleBIBOP.hh"
+#include "MemoryBudget.hh"
+#include "Probes.hh"
 
 void *SingleBIBOP::allocateObject() {
+#ifdef BITMAP_FREE_TRACKING
+    if (chunk->freeN) {
+        return takeSlot(chunk, &currentPage);
+    }
+    // slots freed into earlier chunks come next, as the free list would hand them out
+    if (partial != nullptr) {
+        chunk_t* owner = partial;
+        void* tmp = takeSlot(owner, &partialPage);
+        if (owner->freeN == 0) {
+            partial = owner->nxtPartial;
+            partialPage = SIZE_MAX;
+        }
+        return tmp;
+    }
+#else
     if (freeList.nxt) {
         node* tmp = freeList.nxt;
         freeList.nxt = freeList.nxt->nxt;
-        return tmp;
-    } else {
-        Debug("bump: %p\n", (void*)bump);
-        void* tmp = (void*)bump;
-        bump += objectSize;
-        Debug("Object allocate to %p\n", tmp);
-        if (bump - base >= capacity) {
-            Debug("Insufficient memory for size: %zu\n", objectSize);
-            return nullptr;
-        }
+        liveN++;
         return tmp;
     }
+#endif
+    Debug("bump: %p\n", (void*)bump);
+    void* tmp = (void*)bump;
+    bump += objectSize;
+    Debug("Object allocate to %p\n", tmp);
+    if (bump - base >= capacity) {
+        Debug("Insufficient memory for size: %zu\n", objectSize);
+        return nullptr;
+    }
+    liveN++;
+    carvedN++;
+    return tmp;
+}
+
+size_t SingleBIBOP::allocateBatch(size_t count, void** out) {
+#ifdef NURSERY
+    // a batch carves past the region's top, so it takes the free list
+    if (nurseryState == NURSERY_ON) {
+        this->leaveNursery();
+    }
+#endif
+    size_t n = 0;
+#ifdef BITMAP_FREE_TRACKING
+    while (n < count && chunk->freeN) {
+        out[n++] = allocateObject();
+    }
+#else
+    while (n < count && freeList.nxt) {
+        out[n++] = freeList.nxt;
+        freeList.nxt = freeList.nxt->nxt;
+    }
+    liveN += n;
+#endif
+
+    // carve the rest as one contiguous run; an object fits while its end stays below capacity
+    size_t fit = bump - base < capacity ? (base + capacity - bump - 1) / objectSize : 0;
+    size_t carve = count - n < fit ? count - n : fit;
+    for (size_t i = 0; i < carve; i++) {
+        out[n + i] = (void*)(bump + i * objectSize);
+    }
+    bump += carve * objectSize;
+    liveN += carve;
+    carvedN += carve;
+
+    Debug("Batch of %zu, carved %zu\n", count, carve);
+    return n + carve;
+}
+
+size_t SingleBIBOP::prewarm(size_t count) {
+    // free slots are handed out first and are resident already, so only the bump range is populated
+    size_t fit = bump - base < capacity ? (base + capacity - bump - 1) / objectSize : 0;
+    size_t n = count < fit ? count : fit;
+    if (n) {
+        uint64_t start = bump & ~(uint64_t)(PAGE_SIZE - 1);
+        MemoryPool::Prefault((void*)start, bump + n * objectSize - start);
+    }
+
+    Debug("Prewarmed %zu of %zu\n", n, count);
+    return n;
 }
 
 void SingleBIBOP::freeObject(void *ptr) {
+    liveN--;
+    this->recycleSlot(ptr);
+}
+
+// put a free slot back where allocateObject looks first
+void SingleBIBOP::recycleSlot(void* ptr) {
+#ifdef BITMAP_FREE_TRACKING
+    auto* owner = (chunk_t*)((uint64_t)ptr & ~(uint64_t)(options.chunkSize - 1));
+    size_t slot = ((uint64_t)ptr - owner->slotBase) / objectSize;
+    size_t page = slot >> 6;
+
+    uint64_t* word = &owner->freeMap()[page];
+    if (*word == 0) {
+        owner->summary[page >> 6] |= 1UL << (page & 63);
+        if ((page >> 6) < owner->summaryHint) {
+            owner->summaryHint = page >> 6;
+        }
+    }
+    *word |= 1UL << (slot & 63);
+    if (owner->freeN++ == 0 && owner != chunk) {
+        owner->nxtPartial = partial;
+        partial = owner;
+    }
+#ifdef REGULAR_MEMORY_RELEASE
+    // keep the page we allocate from, a loop that drains and refills it would madvise every round
+    if (*word == ~0UL && (options.memoryRelease || MemoryBudget::underPressure()) &&
+        (owner != chunk || page != currentPage)) {
+        purgePage(owner, page);
+    }
+#endif
+#else
     auto* convertedPtr = (node*)ptr;
     convertedPtr->nxt = freeList.nxt;
     freeList.nxt = convertedPtr;
+#endif
 #ifdef REGULAR_MEMORY_RELEASE
     auto size = this->getObjectSize();
 
-    if (size >= MEMORY_RELEASE_THRESHOLD) {
-        madvise((void*)((uint64_t)ptr + HEADER_SIZE), (size >> PAGE_SIZE_BIT) << PAGE_SIZE_BIT, MADV_DONTNEED);
+    // under memory pressure every whole page of a freed object goes back
+    if (size >= options.releaseThreshold || (size >= PAGE_SIZE && MemoryBudget::underPressure())) {
+        releaseSlot((uint64_t)ptr);
+    }
+#endif
+}
+
+#ifdef NURSERY
+// the nursery step of an individual allocation: a slot of the region, or nullptr for the usual path
+void* SingleBIBOP::allocateNursery() {
+    if (nurseryState == NURSERY_ON) {
+        if (bump + objectSize <= nurseryEnd) {
+            void* tmp = (void*)bump;
+            bump += objectSize;
+            liveN++;
+            if (bump > nurseryTop) {
+                nurseryTop = bump;
+                carvedN++;
+            }
+            return tmp;
+        }
+        this->leaveNursery();
+    } else if (nurseryState == NURSERY_WATCH) {
+        this->watchNursery();
+    }
+    return nullptr;
+}
+
+// the nursery step of an individual free of an armed BIBOP, after the count: false if the slot
+// goes to the free list
+bool SingleBIBOP::freeNursery() {
+    if (nurseryState == NURSERY_ON || (liveN == 0 && this->enterNursery())) {
+        if (liveN == 0) {
+            bump = nurseryStart;
+        }
+        return true;
+    }
+    return false;
+}
+
+void SingleBIBOP::watchNursery() {
+    if (liveN > watchLive) {
+        watchLive = liveN;
+    }
+    if (++watchN < ((uint32_t)NURSERY_WINDOW << nurseryBackoff)) {
+        return;
+    }
+
+    if (watchLive < options.nursery) {
+        Debug("Nursery armed: %p, at most %zu live\n", this, watchLive);
+        nurseryState = NURSERY_ARMED;
+    }
+    watchN = 0;
+    watchLive = 0;
+}
+
+// called with no object live: every carved slot is free
+bool SingleBIBOP::enterNursery() {
+    if (chunks == nullptr || chunks->nxt != nullptr) {
+        // a site that needed a second chunk is no nursery
+        nurseryState = NURSERY_OFF;
+        return false;
     }
+
+#ifdef BITMAP_FREE_TRACKING
+    memset(chunk->freeMap(), 0, chunk->pageN * sizeof(uint64_t));
+    memset(chunk->summary, 0, chunk->summaryN * sizeof(uint64_t));
+    chunk->freeN = 0;
+    chunk->summaryHint = chunk->summaryN;
+    currentPage = chunk->pageN;
+#else
+    freeList.nxt = nullptr;
 #endif
+    // a slot fits while its end stays below capacity
+    size_t length = (size_t)options.nursery * objectSize * 2;
+    length = length > NURSERY_REGION_SIZE ? length : NURSERY_REGION_SIZE;
+    uint64_t limit = base + capacity - 1;
+    nurseryStart = chunks->start;
+    nurseryEnd = limit - nurseryStart > length ? nurseryStart + length : limit;
+    nurseryTop = bump;
+    bump = nurseryStart;
+    nurseryState = NURSERY_ON;
+    SEMALLOC_PROBE2(nursery, this, objectSize - HEADER_SIZE);
+    Debug("Nursery on: %p\n", this);
+    return true;
 }
 
-void SingleBIBOP::ExtendSingleBIBOP(uint64_t _base, size_t _capacity) {
-    bump = _base;
+// the region is full with objects live: free its dead slots and watch again
+void SingleBIBOP::leaveNursery() {
+    uint64_t top = nurseryTop > bump ? nurseryTop : bump;
+    for (uint64_t slot = nurseryStart; slot < top; slot += objectSize) {
+        if (!((RegularHeader*)slot)->isAllocation()) {
+            this->recycleSlot((void*)slot);
+        }
+    }
+
+    SEMALLOC_PROBE2(nursery_leave, this, liveN);
+    Debug("Nursery off: %p, %zu live\n", this, liveN);
+    bump = top;
+    nurseryTop = 0;
+    nurseryState = NURSERY_WATCH;
+    if (nurseryBackoff < NURSERY_BACKOFF_MAX) {
+        nurseryBackoff++;
+    }
+}
+#endif
+
+void SingleBIBOP::ExtendSingleBIBOP(uint64_t _base, size_t _capacity, size_t _color) {
+    SEMALLOC_PROBE3(extend_bibop, this, _base, _capacity);
+    if (chunks != nullptr) {
+        __atomic_store_n(&chunks->end, carvedEnd(chunks->start), __ATOMIC_RELAXED);
+    }
+#ifdef BITMAP_FREE_TRACKING
+    // a chunk left with free slots, after a batch, is reused like any other earlier chunk
+    if (chunk->freeN) {
+        chunk->nxtPartial = partial;
+        partial = chunk;
+        partialPage = SIZE_MAX;
+    }
+#endif
+    InitChunk(_base, _capacity, _color);
+}
+
+void SingleBIBOP::InitChunk(uint64_t _base, size_t _capacity, size_t _color) {
     base = _base;
     capacity = _capacity;
+#ifdef BITMAP_FREE_TRACKING
+    // free slots of the previous chunk stay in its bitmap, allocated again through partial
+    chunk = (chunk_t*)_base;
+    chunk->pageN = (_capacity / objectSize + 63) >> 6;
+    chunk->freeN = 0;
+    chunk->summary = chunk->freeMap() + chunk->pageN;
+    chunk->summaryN = (chunk->pageN + 63) >> 6;
+    chunk->summaryHint = chunk->summaryN;
+    chunk->nxtPartial = nullptr;
+
+    auto metadataEnd = (uint64_t)(chunk->summary + chunk->summaryN);
+    chunk->slotBase = ((metadataEnd + PAGE_SIZE - 1) & ~(uint64_t)(PAGE_SIZE - 1)) + _color;
+    currentPage = chunk->pageN;
+    bump = chunk->slotBase;
+#else
+    bump = _base + _color;
+#endif
+}
+
+#ifdef BITMAP_FREE_TRACKING
+// a free slot of owner, from the fullest page unless the page we took from last has one left
+void* SingleBIBOP::takeSlot(chunk_t* owner, size_t* page) {
+    uint64_t* freeMap = owner->freeMap();
+    if (*page >= owner->pageN || freeMap[*page] == 0) {
+        *page = owner->findFullestPage();
+    }
+
+    uint64_t word = freeMap[*page];
+    size_t slot = (*page << 6) + __builtin_ctzll(word);
+    word &= word - 1;
+    freeMap[*page] = word;
+    if (word == 0) {
+        owner->summary[*page >> 6] &= ~(1UL << (*page & 63));
+    }
+    owner->freeN--;
+    liveN++;
+    return (void*)(owner->slotBase + slot * objectSize);
+}
+
+size_t SingleBIBOP::chunk_t::findFullestPage() {
+    // among the first few pages with free slots, take the one with the fewest
+    size_t best = pageN;
+    size_t bestFree = 65;
+    size_t candidates = 0;
+
+    for (size_t i = summaryHint; i < summaryN && candidates < BITMAP_CANDIDATE_N; i++) {
+        uint64_t word = summary[i];
+        if (word == 0 && candidates == 0) {
+            summaryHint = i + 1;
+        }
+
+        while (word && candidates < BITMAP_CANDIDATE_N) {
+            size_t page = (i << 6) + __builtin_ctzll(word);
+            auto n = (size_t)__builtin_popcountll(freeMap()[page]);
+            if (n < bestFree) {
+                best = page;
+                bestFree = n;
+            }
+            word &= word - 1;
+            candidates++;
+        }
+    }
+
+    return best;
+}
+
+size_t SingleBIBOP::purgePage(chunk_t* owner, size_t page) {
+    uint64_t start = owner->slotBase + (page << 6) * objectSize;
+    uint64_t end = start + 64 * objectSize;
+    start = (start + PAGE_SIZE - 1) & ~(uint64_t)(PAGE_SIZE - 1);
+    end &= ~(uint64_t)(PAGE_SIZE - 1);
+
+    if (end <= start) {
+        return 0;
+    }
+    Debug("Purge %p - %p\n", (void*)start, (void*)end);
+    SEMALLOC_PROBE2(release, start, end - start);
+    madvise((void*)start, end - start, MADV_DONTNEED);
+    return end - start;
+}
+#endif
+
+// give the whole pages of free slots back; only the owner may call it
+size_t SingleBIBOP::trim() {
+    size_t released = 0;
+#ifdef BITMAP_FREE_TRACKING
+    released += trimChunk(chunk);
+    for (chunk_t* owner = partial; owner != nullptr; owner = owner->nxtPartial) {
+        released += trimChunk(owner);
+    }
+#else
+    // a slot smaller than a page holds no whole page
+    if (objectSize > PAGE_SIZE) {
+        for (node* slot = freeList.nxt; slot != nullptr; slot = slot->nxt) {
+            released += releaseSlot((uint64_t)slot);
+        }
+    }
+#endif
+    return released;
+}
+
+#ifdef BITMAP_FREE_TRACKING
+size_t SingleBIBOP::trimChunk(chunk_t* owner) {
+    size_t released = 0;
+    uint64_t* freeMap = owner->freeMap();
+    for (size_t i = 0; i < owner->summaryN; i++) {
+        for (uint64_t word = owner->summary[i]; word; word &= word - 1) {
+            size_t page = (i << 6) + __builtin_ctzll(word);
+            if (freeMap[page] == ~0UL) {
+                released += purgePage(owner, page);
+                continue;
+            }
+            if (objectSize <= PAGE_SIZE) {
+                continue;
+            }
+            for (uint64_t slots = freeMap[page]; slots; slots &= slots - 1) {
+                size_t slot = (page << 6) + __builtin_ctzll(slots);
+                released += releaseSlot(owner->slotBase + slot * objectSize);
+            }
+        }
+    }
+    return released;
+}
+#endif
+
+size_t SingleBIBOP::releaseSlot(uint64_t slot) {
+    uint64_t start = (slot + HEADER_SIZE + PAGE_SIZE - 1) & ~(uint64_t)(PAGE_SIZE - 1);
+    uint64_t end = (slot + objectSize) & ~(uint64_t)(PAGE_SIZE - 1);
+    if (end <= start) {
+        return 0;
+    }
+    SEMALLOC_PROBE2(release, start, end - start);
+    madvise((void*)start, end - start, MADV_DONTNEED);
+    return end - start;
 }
 
 size_t SingleBIBOP::getObjectSize() {
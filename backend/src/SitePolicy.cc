@@ -0,0 +1,41 @@
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "SitePolicy.hh"
+
+const site_policy_entry_t* SitePolicy::entries;
+uint32_t SitePolicy::entryN;
+
+void SitePolicy::LoadSitePolicy(const char* path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        Error("Cannot open policy file %s\n", path);
+        return;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(site_policy_header_t)) {
+        Error("Bad policy file %s\n", path);
+        close(fd);
+        return;
+    }
+
+    void* file = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (file == MAP_FAILED) {
+        Error("Cannot map policy file %s\n", path);
+        return;
+    }
+
+    auto* header = (site_policy_header_t*)file;
+    size_t expected = sizeof(site_policy_header_t) + (size_t)header->n * sizeof(site_policy_entry_t);
+    if (memcmp(header->magic, SITE_POLICY_MAGIC, sizeof header->magic) != 0 || (size_t)st.st_size < expected) {
+        Error("Bad policy file %s\n", path);
+        munmap(file, st.st_size);
+        return;
+    }
+
+    entries = (const site_policy_entry_t*)(header + 1);
+    entryN = header->n;
+    Debug("Loaded %u site policies from %s\n", entryN, path);
+}
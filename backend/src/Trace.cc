@@ -0,0 +1,209 @@
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include "Trace.hh"
+#include "BIBOP.hh"
+
+trace_ring_t* EventTrace::rings[MAX_MANAGER];
+std::atomic<bool> EventTrace::enabled;
+
+static int traceFd = -1;
+static pthread_mutex_t traceLock = PTHREAD_MUTEX_INITIALIZER; // one flush at a time
+static std::atomic<bool> traceRunning;
+static pthread_t flusherThread;
+
+// the part of the file being written: [windowStart, windowStart + TRACE_WINDOW_SIZE)
+static char* window;
+static size_t windowStart;
+static size_t written;
+static bool full;          // the file cannot grow, what the rings still hold is dropped
+static uint64_t lostN;     // events dropped because the file was full
+
+static bool mapWindow(size_t offset) {
+    if (window != nullptr) {
+        munmap(window, TRACE_WINDOW_SIZE);
+        window = nullptr;
+    }
+
+    windowStart = offset & ~(size_t)(PAGE_SIZE - 1);
+    if (ftruncate(traceFd, windowStart + TRACE_WINDOW_SIZE) != 0) {
+        return false;
+    }
+    void* mapped = mmap(nullptr, TRACE_WINDOW_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, traceFd, windowStart);
+    if (mapped == MAP_FAILED) {
+        return false;
+    }
+    window = (char*)mapped;
+    return true;
+}
+
+static bool append(const void* data, size_t length) {
+    while (length) {
+        if (written >= windowStart + TRACE_WINDOW_SIZE && !mapWindow(written)) {
+            return false;
+        }
+
+        size_t room = windowStart + TRACE_WINDOW_SIZE - written;
+        size_t n = length < room ? length : room;
+        memcpy(window + (written - windowStart), data, n);
+        written += n;
+        data = (const char*)data + n;
+        length -= n;
+    }
+    return true;
+}
+
+void EventTrace::Start(const char* path) {
+    traceFd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (traceFd < 0) {
+        Error("Cannot open trace file %s\n", path);
+        return;
+    }
+
+    trace_header_t header = {};
+    memcpy(header.magic, TRACE_MAGIC, sizeof header.magic);
+    header.eventSize = sizeof(trace_event_t);
+    if (!mapWindow(0) || !append(&header, sizeof header)) {
+        Error("Cannot map trace file %s\n", path);
+        close(traceFd);
+        traceFd = -1;
+        return;
+    }
+
+    full = false;
+    lostN = 0;
+    traceRunning = true;
+    enabled.store(true, std::memory_order_release);
+    int error = pthread_create(&flusherThread, nullptr, flusher, nullptr);
+    if (error != 0) {
+        // no flusher: the rings are drained once, when the trace stops
+        Error("Cannot start the trace flusher (%d)\n", error);
+    }
+    Debug("Trace to %s\n", path);
+}
+
+trace_ring_t* EventTrace::acquireRing(size_t thread) {
+    auto* ring = (trace_ring_t*)mmap(nullptr, sizeof(trace_ring_t), PROT_READ | PROT_WRITE,
+                                     MAP_PRIVATE | MAP_ANON | MAP_NORESERVE, -1, 0);
+    if (ring == MAP_FAILED) {
+        return nullptr;
+    }
+    __atomic_store_n(&rings[thread], ring, __ATOMIC_RELEASE);
+    return ring;
+}
+
+void EventTrace::flush() {
+    pthread_mutex_lock(&traceLock);
+    for (auto& slot : rings) {
+        trace_ring_t* ring = __atomic_load_n(&slot, __ATOMIC_ACQUIRE);
+        if (ring == nullptr || traceFd < 0) {
+            continue;
+        }
+
+        uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        while (tail < head && !full) {
+            // up to the end of the ring, then from its start
+            uint64_t index = tail & (TRACE_RING_N - 1);
+            uint64_t n = head - tail < TRACE_RING_N - index ? head - tail : TRACE_RING_N - index;
+            size_t before = written;
+            if (!append(&ring->events[index], n * sizeof(trace_event_t))) {
+                // keep the whole events that made it, the header still gets written at the end
+                Error("Trace file full at %zu bytes\n", written);
+                uint64_t kept = (written - before) / sizeof(trace_event_t);
+                written = before + kept * sizeof(trace_event_t);
+                tail += kept;
+                full = true;
+                enabled.store(false, std::memory_order_relaxed);
+                break;
+            }
+            tail += n;
+        }
+        if (full) {
+            lostN += head - tail;
+            tail = head;
+        }
+        ring->tail.store(tail, std::memory_order_release);
+    }
+    pthread_mutex_unlock(&traceLock);
+}
+
+void* EventTrace::flusher(void*) {
+    struct timespec interval = {0, TRACE_FLUSH_MS * 1000000L};
+    while (traceRunning.load(std::memory_order_relaxed)) {
+        nanosleep(&interval, nullptr);
+        flush();
+    }
+    return nullptr;
+}
+
+void EventTrace::Stop() {
+    if (!traceRunning.exchange(false)) {
+        return;
+    }
+    enabled.store(false, std::memory_order_relaxed);
+    flush();
+
+    pthread_mutex_lock(&traceLock);
+    if (traceFd >= 0) {
+        uint64_t droppedN = 0;
+        for (auto* ring : rings) {
+            droppedN += ring ? ring->dropped.load(std::memory_order_relaxed) : 0;
+        }
+
+        // the first window may be gone, a failed remap of a full file leaves none
+        bool ownMapping = window == nullptr || windowStart != 0;
+        auto* header = (trace_header_t*)window;
+        if (ownMapping) {
+            header = (trace_header_t*)mmap(nullptr, PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, traceFd, 0);
+        }
+        if (header != MAP_FAILED) {
+            header->tscHz = Clock::tscHz();
+            header->eventN = (written - sizeof(trace_header_t)) / sizeof(trace_event_t);
+            header->droppedN = droppedN + lostN;
+            if (ownMapping) {
+                munmap(header, PAGE_SIZE);
+            }
+        }
+
+        if (window != nullptr) {
+            munmap(window, TRACE_WINDOW_SIZE);
+            window = nullptr;
+        }
+        if (ftruncate(traceFd, written) != 0) {
+            Error("Cannot truncate the trace file to %zu bytes\n", written);
+        }
+        close(traceFd);
+        traceFd = -1;
+    }
+    pthread_mutex_unlock(&traceLock);
+}
+
+void EventTrace::describe(trace_event_t* event, void* ptr, size_t thread) {
+    event->ptr = (uint64_t)ptr;
+    event->bibop = 0;
+    event->sizeClass = GLOBAL_BAG_N;
+    event->path = TRACE_PATH_NONE;
+    if (ptr == nullptr) {
+        return;
+    }
+
+    if (((HugeHeader*)((uint64_t)ptr - HEADER_SIZE))->isHuge()) {
+        event->path = TRACE_PATH_HUGE;
+        return;
+    }
+
+    auto* header = (RegularHeader*)((uint64_t)ptr - HEADER_SIZE);
+    event->bibop = (uint64_t)header->bibop;
+    event->sizeClass = BIBOP::computeSizeIndex(((SingleBIBOP*)header->bibop)->getObjectSize());
+    if (header->thread_id != thread) {
+        event->path = TRACE_PATH_REMOTE;
+    } else {
+        event->path = header->isGlobal() ? TRACE_PATH_GLOBAL : TRACE_PATH_INDIVIDUAL;
+    }
+}
+
+static void __attribute__((destructor))
+stopTraceAtExit(void) {
+    EventTrace::Stop();
+}
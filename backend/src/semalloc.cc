@@ -1,21 +1,158 @@
 //
 // Created by r53wang on 3/23/23.
 //
+#include <utility>
+#include <cerrno>
 #include "semalloc.hh"
 #include "threads.h"
+#include "Trace.hh"
+#include "CSIDirectory.hh"
 
-MemoryManager* globalMemoryManager[MAX_THREAD];
+MemoryManager* globalMemoryManager[MAX_MANAGER];
 __thread size_t tid;
 __thread size_t thread_id;
 std::atomic<size_t> thread_bump;
 
 #ifdef STAT
-    size_t* n_malloc;
-    size_t* n_individual_pool;
-    size_t* n_individual_allocation;
-    size_t* s_lazy_memory;
-    size_t* s_global_memory;
-    size_t* s_rec_memory;
+static semalloc_stats_t retiredStats; // counters of destroyed heaps
+#endif
+
+template<class Policy>
+static void* mallocWith(size_t size) {
+    MemoryManager* manager = globalMemoryManager[thread_id];
+    if (__builtin_expect(manager->sampleLatency<Policy>(), 0)) {
+        uint64_t start = readTSC();
+        void* ptr = manager->mallocMemory<Policy>(size);
+        manager->recordLatency(LATENCY_MALLOC, start);
+        return ptr;
+    }
+    return manager->mallocMemory<Policy>(size);
+}
+
+template<class Policy = runtime_policy_t>
+static void freeObject(void* ptr) {
+    Debug("ptr: %p thread %zu\n", ptr, thread_id);
+    if (ptr == nullptr) {
+        return;
+    }
+
+    // huge
+    auto* hugeHeader = (HugeHeader*)((uint64_t)ptr - HEADER_SIZE);
+    if (hugeHeader->isHuge()) {
+        MemoryManager::freeHugeMemory(ptr);
+        return;
+    }
+
+    // current thread
+    auto* regularHeader = (RegularHeader*)((uint64_t)ptr - HEADER_SIZE);
+    if (regularHeader->thread_id == thread_id) {
+        globalMemoryManager[thread_id]->freeRegularMemory<Policy>(ptr);
+        return;
+    }
+
+    // other thread
+    globalMemoryManager[regularHeader->thread_id]->freeOtherThreadMemory(ptr);
+}
+
+// the manager went to other threads with the exit, every object is remote now
+static void freeAfterExit(void* ptr) {
+    if (ptr == nullptr) {
+        return;
+    }
+
+    auto* hugeHeader = (HugeHeader*)((uint64_t)ptr - HEADER_SIZE);
+    if (hugeHeader->isHuge()) {
+        MemoryManager::freeHugeMemory(ptr);
+        return;
+    }
+
+    auto* regularHeader = (RegularHeader*)((uint64_t)ptr - HEADER_SIZE);
+    globalMemoryManager[regularHeader->thread_id]->freeOtherThreadMemory(ptr);
+}
+
+template<class Policy>
+static void freeWith(void* ptr) {
+    // the freeing thread's manager keeps the sample, whoever owns the object
+    MemoryManager* manager = globalMemoryManager[thread_id];
+    if (__builtin_expect(manager->sampleLatency<Policy>(), 0)) {
+        uint64_t start = readTSC();
+        freeObject<Policy>(ptr);
+        manager->recordLatency(LATENCY_FREE, start);
+        return;
+    }
+    freeObject<Policy>(ptr);
+}
+
+#ifdef LOG_TO_FILE
+static void* tracedMalloc(size_t size) {
+    uint64_t start = readTSC();
+    void* ptr = globalMemoryManager[thread_id]->mallocMemory(size);
+    trace_event_t event;
+    EventTrace::describe(&event, ptr, thread_id);
+    EventTrace::record(thread_id, &event, TRACE_MALLOC, size, start);
+    return ptr;
+}
+
+static void tracedFree(void* ptr) {
+    uint64_t start = readTSC();
+    trace_event_t event;
+    EventTrace::describe(&event, ptr, thread_id);
+    freeObject<runtime_policy_t>(ptr);
+    EventTrace::record(thread_id, &event, TRACE_FREE, 0, start);
+}
+#endif
+
+#if defined(DIRECT_ENTRY) && !defined(LOG_TO_FILE)
+/**
+ * libsemalloc.a calls the allocation path directly, so an LTO link can inline it into the
+ * wrapper and its callers; the features of the options are tested on each call instead of
+ * picked once with the variant.
+ */
+#define MALLOC_ENTRY mallocWith<runtime_policy_t>
+#define FREE_ENTRY freeWith<runtime_policy_t>
+#else
+static void* resolveMalloc(size_t size);
+static void resolveFree(void* ptr);
+
+/**
+ * css_malloc and css_free call the variant of the options through these, bound on the first
+ * call the way lazy PLT binding resolves a symbol. A GNU ifunc resolver would run while the
+ * library is relocated, before the environment can be read under BIND_NOW, so it cannot see
+ * SEMALLOC_OPTIONS.
+ */
+static void* (*mallocEntry)(size_t) = resolveMalloc;
+static void (*freeEntry)(void*) = resolveFree;
+
+template<size_t... Variant>
+static void bindEntries(std::index_sequence<Variant...>) {
+    static void* (*const mallocs[])(size_t) = {mallocWith<fixed_policy_t<Variant>>...};
+    static void (*const frees[])(void*) = {freeWith<fixed_policy_t<Variant>>...};
+    uint32_t variant = AllocPolicy::Select();
+#ifdef LOG_TO_FILE
+    if (EventTrace::enabled.load(std::memory_order_acquire)) {
+        __atomic_store_n(&freeEntry, &tracedFree, __ATOMIC_RELAXED);
+        __atomic_store_n(&mallocEntry, &tracedMalloc, __ATOMIC_RELAXED);
+        return;
+    }
+#endif
+    Debug("Allocation variant %u\n", variant);
+    __atomic_store_n(&freeEntry, frees[variant], __ATOMIC_RELAXED);
+    __atomic_store_n(&mallocEntry, mallocs[variant], __ATOMIC_RELAXED);
+}
+
+// the options are read by init_thread before either is called
+static void* resolveMalloc(size_t size) {
+    bindEntries(std::make_index_sequence<ALLOC_VARIANT_N>());
+    return mallocEntry(size);
+}
+
+static void resolveFree(void* ptr) {
+    bindEntries(std::make_index_sequence<ALLOC_VARIANT_N>());
+    freeEntry(ptr);
+}
+
+#define MALLOC_ENTRY __atomic_load_n(&mallocEntry, __ATOMIC_RELAXED)
+#define FREE_ENTRY __atomic_load_n(&freeEntry, __ATOMIC_RELAXED)
 #endif
 
 void* css_malloc(size_t size) {
@@ -25,37 +162,153 @@ void* css_malloc(size_t size) {
         init_thread();
     }
 
-    void* ptr = globalMemoryManager[thread_id]->mallocMemory(size);
+    void* ptr = MALLOC_ENTRY(size);
     Debug("ptr: %p, size: %zu, thread %zu\n", ptr, size, thread_id);
     return ptr;
 }
 
 void css_free(void* ptr) {
     if (tid != get_thread_id()) {
+        if (threadExited) {
+            freeAfterExit(ptr);
+            return;
+        }
         Debug("no manager at %zu\n", get_thread_id());
         init_thread();
     }
-    Debug("ptr: %p thread %zu\n", ptr, thread_id);
-    if (ptr == nullptr) {
+
+    FREE_ENTRY(ptr);
+}
+
+// sizes above BAG_THRESHOLD can only come from a huge mapping, so skip the header checks
+void css_free_sized(void* ptr, size_t size) {
+    Assert(ptr == nullptr || GET_REAL_SIZE(size) <= css_malloc_usable_size(ptr), "free_sized with a wrong size");
+    if (ptr != nullptr && GET_REAL_SIZE(size) > BAG_THRESHOLD) {
+        MemoryManager::freeHugeMemory(ptr);
         return;
     }
 
-    // huge
-    auto* hugeHeader = (HugeHeader*)((uint64_t)ptr - HEADER_SIZE);
-    if (hugeHeader->isHuge()) {
-        MemoryManager::freeHugeMemory(ptr);
+    css_free(ptr);
+}
+
+// an aligned object may sit inside a larger slot or in its own huge mapping, only its header tells
+void css_free_aligned_sized(void* ptr, size_t alignment, size_t size) {
+    Assert(ptr == nullptr || ((uint64_t)ptr % alignment == 0 && GET_REAL_SIZE(size) <= css_malloc_usable_size(ptr)),
+           "free_aligned_sized with a wrong alignment or size");
+    css_free(ptr);
+}
+
+// count objects of one loop site; csi is the identifier css_malloc would find in the upper size bits
+size_t css_malloc_batch(size_t count, size_t size, size_t csi, void** out) {
+    if (tid != get_thread_id()) {
+        init_thread();
+    }
+
+    size_t n = globalMemoryManager[thread_id]->mallocBatch(GET_REAL_SIZE(size), csi, true, count, out);
+    Debug("batch: %zu of size %zu, thread %zu\n", n, size, thread_id);
+    return n;
+}
+
+size_t semalloc_prewarm(size_t csi, size_t size, size_t count) {
+    if (tid != get_thread_id()) {
+        init_thread();
+    }
+
+    // the size may come with the CSI bits of a malloc request; a huge one is never prewarmed
+    size_t realSize = (size & CSI_HUGE_SIZE_BIT_MASK) ? size & CSI_HUGE_SIZE_SIZE_MASK : GET_REAL_SIZE(size);
+    size_t n = globalMemoryManager[thread_id]->prewarm(realSize, csi, count);
+    Debug("prewarm: %zu of %zu, size %zu, CSI %zu\n", n, count, realSize, csi);
+    return n;
+}
+
+void css_free_batch(void** ptrs, size_t n) {
+    if (tid != get_thread_id()) {
+        init_thread();
+    }
+
+    globalMemoryManager[thread_id]->freeBatch(ptrs, n);
+}
+
+semalloc_heap* semalloc_heap_create() {
+    // the counters and the calling thread's manager are set up on its first allocation
+    if (tid != get_thread_id()) {
+        init_thread();
+    }
+
+    for (uint16_t id = MAX_THREAD; id < MAX_MANAGER; id++) {
+        if (globalMemoryManager[id] != nullptr) {
+            continue;
+        }
+
+        auto* heap = MemoryManager::AllocateMemoryManager(id, true);
+        MemoryManager* expected = nullptr;
+        if (__atomic_compare_exchange_n(&globalMemoryManager[id], &expected, heap,
+                                        false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            Debug("heap %u created\n", id);
+            return heap;
+        }
+        heap->DestroyMemoryManager();
+    }
+
+    Error("Heap max reached (max=%d)\n", MAX_HEAP);
+    return nullptr;
+}
+
+void semalloc_heap_destroy(semalloc_heap* heap) {
+    if (heap == nullptr) {
+        return;
+    }
+
+    // no walk over the managers sees the heap between its slot and the retired counters
+    MemoryManager::lockManagers();
+    for (uint16_t id = MAX_THREAD; id < MAX_MANAGER; id++) {
+        if (globalMemoryManager[id] == heap) {
+            __atomic_store_n(&globalMemoryManager[id], nullptr, __ATOMIC_RELEASE);
+            break;
+        }
+    }
+#ifdef STAT
+    auto* counters = (const size_t*)heap->getStats();
+    for (size_t i = 0; i < STAT_FIELD_N; i++) {
+        __atomic_fetch_add((size_t*)&retiredStats + i, counters[i], __ATOMIC_RELAXED);
+    }
+#endif
+    heap->DestroyMemoryManager();
+    MemoryManager::unlockManagers();
+}
+
+void* semalloc_heap_malloc(semalloc_heap* heap, size_t size) {
+    heap->enter();
+    void* ptr = heap->mallocMemory(size);
+    heap->leave();
+    Debug("ptr: %p, size: %zu, heap %p\n", ptr, size, heap);
+    return ptr;
+}
+
+void semalloc_heap_free(semalloc_heap* heap, void* ptr) {
+    if (ptr == nullptr) {
         return;
     }
 
-    // current thread
     auto* regularHeader = (RegularHeader*)((uint64_t)ptr - HEADER_SIZE);
-    if (regularHeader->thread_id == thread_id) {
-        globalMemoryManager[thread_id]->freeRegularMemory(ptr);
+    if (!((HugeHeader*)regularHeader)->isHuge() && globalMemoryManager[regularHeader->thread_id] == heap) {
+        heap->enter();
+        heap->freeRegularMemory(ptr);
+        heap->leave();
         return;
     }
 
-    // other thread
-    globalMemoryManager[regularHeader->thread_id]->freeOtherThreadMemory(ptr);
+    css_free(ptr);
+}
+
+static void* reallocObject(void* ptr, size_t realSize, size_t CSI, bool inLoop);
+
+// the realloc of a narrow size, whose huge bit leaves no CSI
+static void* reallocNarrow(void* ptr, size_t size) {
+    if (size & CSI_HUGE_SIZE_BIT_MASK) {
+        return reallocObject(ptr, size & CSI_HUGE_SIZE_SIZE_MASK, 0, false);
+    }
+    return reallocObject(ptr, GET_REAL_SIZE(size), (size & CSI_BIT_MASK) >> 32, size & CSI_LOOP_BIT_MASK);
 }
 
 void *css_realloc(void *ptr, size_t size) {
@@ -65,14 +318,28 @@ void *css_realloc(void *ptr, size_t size) {
         init_thread();
     }
 
+#ifdef LOG_TO_FILE
+    if (EventTrace::enabled.load(std::memory_order_relaxed)) {
+        uint64_t start = readTSC();
+        void* newPtr = reallocNarrow(ptr, size);
+        trace_event_t event;
+        EventTrace::describe(&event, newPtr, thread_id);
+        EventTrace::record(thread_id, &event, TRACE_REALLOC, size, start);
+        return newPtr;
+    }
+#endif
+    return reallocNarrow(ptr, size);
+}
+
+static void* reallocObject(void* ptr, size_t realSize, size_t CSI, bool inLoop) {
     if (ptr == nullptr) {
-        void *newPtr = globalMemoryManager[thread_id]->mallocMemory(size);
+        void *newPtr = globalMemoryManager[thread_id]->mallocMemory(realSize, CSI, inLoop);
         Debug("Empty old ptr, allocated to %p\n", newPtr);
         return newPtr;
     }
 
-    if (size == 0) {
-        css_free(ptr);
+    if (realSize == 0) {
+        freeObject(ptr);
         return nullptr;
     }
 
@@ -80,13 +347,16 @@ void *css_realloc(void *ptr, size_t size) {
     auto* regularHeader = (RegularHeader*)((uint64_t)ptr - HEADER_SIZE);
 
     size_t oldSize = css_malloc_usable_size(ptr);
-    size_t realSize = GET_REAL_SIZE(size);
     Debug("Real size: %zu, old size: %zu\n", realSize, oldSize);
     if (realSize <= oldSize) {
         return ptr;
     }
 
-    void* newObject = globalMemoryManager[thread_id]->mallocMemory(size);
+    void* newObject = globalMemoryManager[thread_id]->mallocMemory(realSize, CSI, inLoop);
+    if (newObject == nullptr) {
+        // the old block stays valid, as realloc promises
+        return nullptr;
+    }
     memcpy(newObject, ptr, oldSize);
 
     // huge
@@ -111,31 +381,68 @@ void *css_realloc(void *ptr, size_t size) {
 
 void *css_calloc(size_t nmemb, size_t size) {
     Debug("calloc a: %zu, b: %zu\n", nmemb, size);
+    if (tid != get_thread_id()) {
+        init_thread();
+    }
+
     size_t realSize = GET_REAL_SIZE(size);
     size_t CSI = (size & CSI_BIT_MASK) >> 32;
+    size_t total;
+    if (__builtin_mul_overflow(nmemb, realSize, &total)) {
+        errno = ENOMEM;
+        return nullptr;
+    }
 
     Debug("calloc a: %zu, b: %zu\n", nmemb, realSize);
-    auto allocatedMemory = globalMemoryManager[thread_id]->mallocMemory(nmemb * realSize, CSI, size & CSI_LOOP_BIT_MASK);
-    memset(allocatedMemory, 0, nmemb * realSize);
+    auto allocatedMemory = globalMemoryManager[thread_id]->mallocMemory(total, CSI, size & CSI_LOOP_BIT_MASK);
+    if (allocatedMemory != nullptr) {
+        memset(allocatedMemory, 0, total);
+    }
 
     Debug("calloc allocated to %p\n", allocatedMemory);
     return allocatedMemory;
 }
 
+static void* alignedObject(size_t alignment, size_t realSize, size_t CSI, bool inLoop);
+
 void*css_memalign(size_t alignment, size_t size) {
     Debug("memalign align: %zu, size: %zu\n", alignment, size);
+    if (tid != get_thread_id()) {
+        init_thread();
+    }
+
+    if (size & CSI_HUGE_SIZE_BIT_MASK) {
+        return alignedObject(alignment, size & CSI_HUGE_SIZE_SIZE_MASK, 0, false);
+    }
+    return alignedObject(alignment, GET_REAL_SIZE(size), (size & CSI_BIT_MASK) >> 32, size & CSI_LOOP_BIT_MASK);
+}
+
+static void* alignedObject(size_t alignment, size_t realSize, size_t CSI, bool inLoop) {
     if (alignment & (alignment - 1)) {
         Error("Invalid alignment: %zu\n", alignment);
-        exit(-1);
+        errno = EINVAL;
+        return nullptr;
+    }
+    // every slot already starts on HEADER_SIZE
+    if (alignment <= HEADER_SIZE) {
+        return globalMemoryManager[thread_id]->mallocMemory(realSize, CSI, inLoop);
+    }
+    if (realSize > SIZE_MAX / 2 || alignment > SIZE_MAX / 8) {
+        errno = ENOMEM;
+        return nullptr;
     }
-
-    size_t realSize = GET_REAL_SIZE(size);
-    size_t CSI = (size & CSI_BIT_MASK) >> 32;
 
     size_t newSize = (realSize + HEADER_SIZE) / alignment * alignment + 2 * alignment;
-    void* addr = globalMemoryManager[thread_id]->mallocMemory(newSize, CSI, size & CSI_LOOP_BIT_MASK);
+    if (newSize > BAG_THRESHOLD) {
+        // a huge slot has no room for a regular header, so the mapping itself is aligned
+        void* addr = globalMemoryManager[thread_id]->mallocHugeAligned(realSize, CSI, alignment);
+        Debug("huge aligned: %p, realSize: %zu, alignment: %zu\n", addr, realSize, alignment);
+        return addr;
+    }
+
+    void* addr = globalMemoryManager[thread_id]->mallocMemory(newSize, CSI, inLoop);
     Debug("realSize: %zu, alignment: %zu, newSize: %zu, addr: %p\n", realSize, alignment, newSize, addr);
-    if ((uint64_t)addr % alignment == 0) {
+    if (addr == nullptr || (uint64_t)addr % alignment == 0) {
         return addr;
     }
 
@@ -146,27 +453,111 @@ void*css_memalign(size_t alignment, size_t size) {
     uint32_t offset = (uint64_t)newAddr - (uint64_t)addr;
     auto* newHeader = (RegularHeader*)((uint64_t)newAddr - HEADER_SIZE);
 
+    // the moved header lands on old object bytes; its padding is where free looks for the huge bit
+    memset(newHeader, 0, HEADER_SIZE);
     newHeader->thread_id = thread_id;
     newHeader->bibop = oldBIBOP;
     newHeader->memalign_offset = offset;
     newHeader->controlByte = oldHeader->controlByte;
+    newHeader->setAligned();
     newHeader->setAllocation();
-    oldHeader->setFree();
+    // the header at the start of the slot stays allocated, the heap walk reads the slots from there
 
     Debug("Allocated to %p\n", newAddr);
     return newAddr;
 }
 
-int css_posix_memalign(void** ptr, size_t a, size_t b) {
-    void* tmp = css_memalign(a, b);
-    *ptr = tmp;
+// POSIX wants the error returned and *ptr left alone on failure
+static int posixAligned(void** ptr, size_t realSize, void* object) {
+    if (object == nullptr && realSize != 0) {
+        return ENOMEM;
+    }
+    *ptr = object;
     return 0;
 }
 
+static bool validPosixAlignment(size_t alignment) {
+    return alignment % sizeof(void*) == 0 && (alignment & (alignment - 1)) == 0 && alignment != 0;
+}
+
+int css_posix_memalign(void** ptr, size_t a, size_t b) {
+    if (!validPosixAlignment(a)) {
+        return EINVAL;
+    }
+    size_t realSize = (b & CSI_HUGE_SIZE_BIT_MASK) ? b & CSI_HUGE_SIZE_SIZE_MASK : GET_REAL_SIZE(b);
+    return posixAligned(ptr, realSize, css_memalign(a, b));
+}
+
 void* css_aligned_alloc(size_t a, size_t b) {
     return css_memalign(a, b);
 }
 
+// the wide-CSI convention: the size is a plain size and the site comes as its own context
+void* css_malloc_wide(size_t size, uint64_t context) {
+    if (tid != get_thread_id()) {
+        init_thread();
+    }
+
+    uint32_t CSI = CSIDirectory::lookup(context);
+    void* ptr = globalMemoryManager[thread_id]->mallocMemory(size, CSI, context & WIDE_CONTEXT_LOOP_BIT);
+    Debug("wide ptr: %p, size: %zu, CSI %u, thread %zu\n", ptr, size, CSI, thread_id);
+    return ptr;
+}
+
+void* css_calloc_wide(size_t nmemb, size_t size, uint64_t context) {
+    size_t total;
+    if (__builtin_mul_overflow(nmemb, size, &total)) {
+        errno = ENOMEM;
+        return nullptr;
+    }
+
+    void* ptr = css_malloc_wide(total, context);
+    if (ptr != nullptr) {
+        memset(ptr, 0, total);
+    }
+    return ptr;
+}
+
+void* css_realloc_wide(void* ptr, size_t size, uint64_t context) {
+    if (tid != get_thread_id()) {
+        init_thread();
+    }
+
+    return reallocObject(ptr, size, CSIDirectory::lookup(context), context & WIDE_CONTEXT_LOOP_BIT);
+}
+
+void* css_memalign_wide(size_t alignment, size_t size, uint64_t context) {
+    if (tid != get_thread_id()) {
+        init_thread();
+    }
+
+    return alignedObject(alignment, size, CSIDirectory::lookup(context), context & WIDE_CONTEXT_LOOP_BIT);
+}
+
+int css_posix_memalign_wide(void** ptr, size_t alignment, size_t size, uint64_t context) {
+    if (!validPosixAlignment(alignment)) {
+        return EINVAL;
+    }
+    return posixAligned(ptr, size, css_memalign_wide(alignment, size, context));
+}
+
+void semalloc_csi_directory_stats(semalloc_csi_directory_stats_t* stats) {
+    CSIDirectory::getStats(stats);
+}
+
+
+size_t css_good_size(size_t size) {
+    size_t realSize = GET_REAL_SIZE(size);
+    if (realSize == 0) {
+        return 0;
+    }
+
+    if (realSize > BAG_THRESHOLD) {
+        return (realSize + PAGE_SIZE - 1) & (~(PAGE_SIZE - 1));
+    }
+
+    return MIN_BAG_SIZE << BIBOP::computeSizeIndex(realSize);
+}
 
 size_t css_malloc_usable_size(void* ptr) {
     auto* hugeHeader = (HugeHeader*)((uint64_t)ptr - HEADER_SIZE);
@@ -179,4 +570,118 @@ size_t css_malloc_usable_size(void* ptr) {
     }
 
     return size;
-}
\ No newline at end of file
+}
+
+int css_trim() {
+    if (tid != get_thread_id()) {
+        init_thread();
+    }
+
+    size_t released = globalMemoryManager[thread_id]->trim(true);
+    MemoryManager::managers_pinned_t pinned;
+    for (size_t id = 0; id < MAX_MANAGER; id++) {
+        auto* manager = __atomic_load_n(&globalMemoryManager[id], __ATOMIC_ACQUIRE);
+        if (manager != nullptr && id != thread_id) {
+            released += manager->trim(false);
+        }
+    }
+
+    Debug("trim: %zu bytes released by thread %zu\n", released, thread_id);
+    return released != 0;
+}
+
+void css_usage(semalloc_usage_t* usage) {
+    memset(usage, 0, sizeof(semalloc_usage_t));
+    MemoryManager::managers_pinned_t pinned;
+    for (auto& slot : globalMemoryManager) {
+        auto* manager = __atomic_load_n(&slot, __ATOMIC_ACQUIRE);
+        if (manager != nullptr) {
+            manager->accountUsage(usage);
+        }
+    }
+    MemoryManager::accountHugeUsage(usage);
+}
+
+void css_malloc_stats(FILE* out) {
+    semalloc_usage_t usage;
+    css_usage(&usage);
+
+    const char* names[] = {"global bags", "individual BIBOPs", "huge mappings"};
+    const usage_t* kinds[] = {&usage.global, &usage.individual, &usage.huge};
+    for (int i = 0; i < 3; i++) {
+        fprintf(out, "%s:\n", names[i]);
+        fprintf(out, "arena bytes     = %10zu\n", kinds[i]->arena);
+        fprintf(out, "in use bytes    = %10zu\n", kinds[i]->inUse);
+        fprintf(out, "free bytes      = %10zu\n", kinds[i]->free);
+    }
+    fprintf(out, "Total (incl. mmap):\n");
+    fprintf(out, "system bytes    = %10zu\n", usage.global.arena + usage.individual.arena + usage.huge.arena);
+    fprintf(out, "in use bytes    = %10zu\n", usage.global.inUse + usage.individual.inUse + usage.huge.inUse);
+    fprintf(out, "max mmap regions = %10zu\n", usage.huge.blocks);
+}
+
+int css_malloc_info(FILE* out) {
+    semalloc_usage_t usage;
+    css_usage(&usage);
+
+    // the layout of glibc's malloc_info, one <heap> per kind of storage
+    const char* names[] = {"global", "individual", "huge"};
+    const usage_t* kinds[] = {&usage.global, &usage.individual, &usage.huge};
+    fprintf(out, "<malloc version=\"semalloc-1\">\n");
+    for (int i = 0; i < 3; i++) {
+        fprintf(out, "<heap nr=\"%d\" name=\"%s\">\n", i, names[i]);
+        // blocks of the huge kind are mappings in use, not free ones
+        size_t freeN = kinds[i] == &usage.huge ? 0 : kinds[i]->blocks;
+        fprintf(out, "<total type=\"free\" count=\"%zu\" size=\"%zu\"/>\n", freeN, kinds[i]->free);
+        fprintf(out, "<system type=\"current\" size=\"%zu\"/>\n", kinds[i]->arena);
+        fprintf(out, "<aspace type=\"inuse\" size=\"%zu\"/>\n", kinds[i]->inUse);
+        fprintf(out, "</heap>\n");
+    }
+    fprintf(out, "<total type=\"mmap\" count=\"%zu\" size=\"%zu\"/>\n", usage.huge.blocks, usage.huge.arena);
+    fprintf(out, "<system type=\"current\" size=\"%zu\"/>\n",
+            usage.global.arena + usage.individual.arena + usage.huge.arena);
+    fprintf(out, "</malloc>\n");
+    return 0;
+}
+
+void semalloc_stats_snapshot(semalloc_stats_t* stats) {
+    memset(stats, 0, sizeof(semalloc_stats_t));
+#ifdef STAT
+    MemoryManager::managers_pinned_t pinned;
+    auto* total = (size_t*)stats;
+    for (size_t i = 0; i < STAT_FIELD_N; i++) {
+        total[i] = __atomic_load_n((size_t*)&retiredStats + i, __ATOMIC_RELAXED);
+    }
+
+    for (auto& slot : globalMemoryManager) {
+        auto* manager = __atomic_load_n(&slot, __ATOMIC_ACQUIRE);
+        if (manager == nullptr) {
+            continue;
+        }
+
+        auto* counters = (const size_t*)manager->getStats();
+        for (size_t i = 0; i < STAT_FIELD_N; i++) {
+            total[i] += __atomic_load_n(counters + i, __ATOMIC_RELAXED);
+        }
+        stats->managerN++;
+    }
+    stats->tscHz = Clock::tscHz();
+#endif
+}
+
+int semalloc_heap_profile_dump(const char* path) {
+#ifdef HEAP_SAMPLING
+    return HeapSampler::Dump(path != nullptr ? path : semallocOptions.heapProfileFile) ? 0 : -1;
+#else
+    return -1;
+#endif
+}
+
+int semalloc_heap_walk(semalloc_walk_callback callback, void* arg) {
+    return HeapWalk::Walk(callback, arg);
+}
+
+int semalloc_fragmentation_report(const char* path) {
+    path = path != nullptr ? path : semallocOptions.fragReportFile;
+    return path[0] && HeapWalk::Report(path) ? 0 : -1;
+}
@@ -5,7 +5,9 @@
 
 #include <stdio.h>
 #include "semalloc.hh"
-#include <dlfcn.h>
+#include "CallSite.hh"
+#include <new>
+#include <cerrno>
 
 #ifdef STAT
 static void __attribute__((destructor))
@@ -14,200 +16,247 @@ finalizer(void) {
 }
 #endif
 
-static void* css_valloc(size_t s) {
-    fprintf(stderr, "Not supported with css_valloc %zu\n", s);
-    return NULL;
-}
+/**
+ * The malloc family and operator new/delete are defined here directly, each a tail call into
+ * semalloc.cc. The shared library goes on through the entry bound to the variant of the options;
+ * libsemalloc.a calls the allocation path directly (DIRECT_ENTRY), so an LTO link of it can
+ * inline the fast path. The __libc_ names glibc exports for its own allocator are aliases, so
+ * code calling them does not hand our objects to glibc.
+ */
+
+// the CSI of the calling site, if the auto_csi option is on and the size does not have one
+#define TAG(size) CallSite::tag(size, __builtin_return_address(0), __builtin_frame_address(0))
 
-static void* css_pvalloc(size_t s) {
-    fprintf(stderr, "Not supported with css_pvalloc %zu\n", s);
-    return NULL;
+void* malloc(size_t size) {
+    return css_malloc(TAG(size));
 }
 
-// static void* css_alloca(size_t s) {
-//     fprintf(stderr, "Not supported with css_alloca %zu\n", s);
-//     return NULL;
-// }
+void free(void* ptr) {
+    css_free(ptr);
+}
 
-static void* (*real_malloc)(size_t) = css_malloc;
-static void (*real_free)(void*) = css_free;
-static void* (*real_realloc)(void*, size_t) = css_realloc;
-static void* (*real_memalign)(size_t, size_t) = css_memalign;
-static void* (*real_calloc)(size_t, size_t) = css_calloc;
-static void* (*real_valloc)(size_t) = css_valloc;
-static void* (*real_aligned_alloc)(size_t, size_t) = css_aligned_alloc;
-static void* (*real_pvalloc)(size_t) = css_pvalloc;
-// static void* (*real_alloca)(size_t) = css_alloca;
-static int (*real_posix_memalign)(void**, size_t, size_t) = css_posix_memalign;
-static size_t (*real_malloc_usable_size)(void*) = css_malloc_usable_size;
+void* realloc(void* ptr, size_t size) {
+    return css_realloc(ptr, TAG(size));
+}
 
+void* calloc(size_t nmemb, size_t size) {
+    return css_calloc(nmemb, TAG(size));
+}
 
-static void mtrace_init(void)
-{
-    real_malloc = reinterpret_cast<void*(*)(size_t)>(dlsym(RTLD_NEXT, "malloc"));
-    if (NULL == real_malloc) {
-        fprintf(stderr, "Error in `dlsym`: %s\n", dlerror());
+void* reallocarray(void* ptr, size_t nmemb, size_t size) {
+    size_t total;
+    if (__builtin_mul_overflow(nmemb, size, &total)) {
+        errno = ENOMEM;
+        return NULL;
     }
+    return css_realloc(ptr, TAG(total));
+}
 
-    real_free = reinterpret_cast<void(*)(void*)>(dlsym(RTLD_NEXT, "free"));
-    if (NULL == real_free) {
-        fprintf(stderr, "Error in `dlsym`: %s\n", dlerror());
-    }
+void* memalign(size_t alignment, size_t size) {
+    return css_memalign(alignment, TAG(size));
+}
 
-    real_realloc = reinterpret_cast<void*(*)(void*, size_t)>(dlsym(RTLD_NEXT, "realloc"));
-    if (NULL == real_realloc) {
-        fprintf(stderr, "Error in `dlsym`: %s\n", dlerror());
-    }
+void* aligned_alloc(size_t alignment, size_t size) {
+    return css_aligned_alloc(alignment, TAG(size));
+}
 
-    real_memalign = reinterpret_cast<void*(*)(size_t, size_t)>(dlsym(RTLD_NEXT, "memalign"));
-    if (NULL == real_memalign) {
-        fprintf(stderr, "Error in `dlsym`: %s\n", dlerror());
-    }
+int posix_memalign(void** ptr, size_t alignment, size_t size) {
+    return css_posix_memalign(ptr, alignment, TAG(size));
+}
+
+void* valloc(size_t size) {
+    return css_memalign(PAGE_SIZE, TAG(size));
+}
+
+void* pvalloc(size_t size) {
+    return css_memalign(PAGE_SIZE, TAG((size + PAGE_SIZE - 1) & ~(size_t)(PAGE_SIZE - 1)));
+}
+
+size_t malloc_usable_size(void* ptr) {
+    return css_malloc_usable_size(ptr);
+}
+
+extern "C" {
+void* __libc_malloc(size_t size) __attribute__((alias("malloc")));
+void __libc_free(void* ptr) __attribute__((alias("free")));
+void* __libc_realloc(void* ptr, size_t size) __attribute__((alias("realloc")));
+void* __libc_calloc(size_t nmemb, size_t size) __attribute__((alias("calloc")));
+void* __libc_memalign(size_t alignment, size_t size) __attribute__((alias("memalign")));
+void* __libc_valloc(size_t size) __attribute__((alias("valloc")));
+void* __libc_pvalloc(size_t size) __attribute__((alias("pvalloc")));
+}
+
+// not in the headers of every libc, so their C names are given here
+extern "C" {
+// C23 sized deallocation
+void free_sized(void* ptr, size_t size) {
+    css_free_sized(ptr, size);
+}
+
+void free_aligned_sized(void* ptr, size_t alignment, size_t size) {
+    css_free_aligned_sized(ptr, alignment, size);
+}
+
+// size queries, so growable containers can round their capacity up to a whole slot
+size_t malloc_good_size(size_t size) {
+    return css_good_size(size);
+}
 
-    real_calloc = reinterpret_cast<void*(*)(size_t, size_t)>(dlsym(RTLD_NEXT, "calloc"));
-    if (NULL == real_calloc) {
-        fprintf(stderr, "Error in `dlsym`: %s\n", dlerror());
+// the jemalloc MALLOCX_* flags are accepted but not interpreted
+size_t nallocx(size_t size, int flags) {
+    return css_good_size(size);
+}
+}
+
+// glibc's introspection, answered from the BIBOPs
+int malloc_trim(size_t pad) {
+    (void)pad;
+    return css_trim();
+}
+
+struct mallinfo2 mallinfo2() {
+    semalloc_usage_t usage;
+    css_usage(&usage);
+
+    struct mallinfo2 info = {};
+    info.arena = usage.global.arena + usage.individual.arena;
+    info.ordblks = usage.global.blocks + usage.individual.blocks;
+    info.hblks = usage.huge.blocks;
+    info.hblkhd = usage.huge.arena;
+    info.uordblks = usage.global.inUse + usage.individual.inUse;
+    info.fordblks = usage.global.free + usage.individual.free;
+    return info;
+}
+
+void malloc_stats() {
+    css_malloc_stats(stderr);
+}
+
+int malloc_info(int options, FILE* fp) {
+    if (options != 0) {
+        errno = EINVAL;
+        return -1;
     }
+    return css_malloc_info(fp);
+}
 
-    real_malloc_usable_size = reinterpret_cast<size_t(*)(void*)>(dlsym(RTLD_NEXT, "malloc_usable_size"));
-    if (NULL == real_malloc_usable_size) {
-        fprintf(stderr, "Error in `dlsym`: %s\n", dlerror());
+// C++: operator new calls the new_handler until it gets memory, the nothrow forms return NULL
+template<class Allocate>
+static void* retryNew(bool nothrow, Allocate allocate) {
+    while (true) {
+        void* p = allocate();
+        if (__builtin_expect(p != NULL, 1)) {
+            return p;
+        }
+
+        std::new_handler handler = std::get_new_handler();
+        if (handler == NULL) {
+            if (nothrow) {
+                return NULL;
+            }
+            throw std::bad_alloc();
+        }
+        if (!nothrow) {
+            handler();
+            continue;
+        }
+        try {
+            handler();
+        } catch (...) {
+            return NULL;
+        }
     }
+}
 
-    real_valloc = reinterpret_cast<void*(*)(size_t)>(dlsym(RTLD_NEXT, "valloc"));
-    real_aligned_alloc = reinterpret_cast<void*(*)(size_t, size_t)>(dlsym(RTLD_NEXT, "aligned_alloc"));
-    real_pvalloc = reinterpret_cast<void*(*)(size_t)>(dlsym(RTLD_NEXT, "pvalloc"));
-    real_posix_memalign = reinterpret_cast<int(*)(void**, size_t, size_t)>(dlsym(RTLD_NEXT, "posix_memalign"));
-    // real_alloca = reinterpret_cast<void*(*)(size_t)>(dlsym(RTLD_NEXT, "alloca"));
+static void* newObject(size_t size, size_t alignment, bool nothrow) {
+    // every new returns a distinct pointer, even for 0 bytes
+    size = GET_REAL_SIZE(size) ? size : size | 1;
+    return retryNew(nothrow, [=] { return alignment ? css_memalign(alignment, size) : css_malloc(size); });
 }
 
+// operator new and new[] of the wide-CSI convention, see css_malloc_wide
+extern "C" void* css_new_wide(size_t size, uint64_t context) {
+    return retryNew(false, [=] { return css_malloc_wide(size ? size : 1, context); });
+}
 
-void *malloc(size_t size)
-{
-    if(real_malloc==NULL) {
-        mtrace_init();
-    }
+void* operator new(size_t size) {
+    return newObject(TAG(size), 0, false);
+}
 
-    void *p = NULL;
-#ifdef WRAPPER_INFO
-    fprintf(stderr, "wrapper malloc(%zu) = ", size);
-#endif
-    p = real_malloc(size);
-#ifdef WRAPPER_INFO
-    fprintf(stderr, "%p\n ", p);
-#endif
+void* operator new[](size_t size) {
+    return newObject(TAG(size), 0, false);
+}
 
-    return p;
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    return newObject(TAG(size), 0, true);
 }
 
-void free(void* ptr)
-{
-    if(real_free==NULL) {
-        mtrace_init();
-    }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+    return newObject(TAG(size), 0, true);
+}
 
-    void *p = NULL;
-#ifdef WRAPPER_INFO
-    fprintf(stderr, "wrapper free(%p)\n", ptr);
-#endif
-    real_free(ptr);
+void* operator new(size_t size, std::align_val_t alignment) {
+    return newObject(TAG(size), (size_t)alignment, false);
 }
 
+void* operator new[](size_t size, std::align_val_t alignment) {
+    return newObject(TAG(size), (size_t)alignment, false);
+}
 
-void* realloc(void* ptr, size_t size)
-{
-    if(real_realloc==NULL) {
-        mtrace_init();
-    }
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return newObject(TAG(size), (size_t)alignment, true);
+}
 
-    void *p = NULL;
-#ifdef WRAPPER_INFO
-    fprintf(stderr, "wrapper realloc(%p, %zu) = ", ptr, size);
-#endif
-    p = real_realloc(ptr, size);
-#ifdef WRAPPER_INFO
-    fprintf(stderr, "%p\n ", p);
-#endif
-    return p;
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return newObject(TAG(size), (size_t)alignment, true);
 }
 
-void* memalign(size_t alignment, size_t size)
-{
-    if(real_memalign==NULL) {
-        mtrace_init();
-    }
+void operator delete(void* ptr) noexcept {
+    css_free(ptr);
+}
 
-    void *p = NULL;
-#ifdef WRAPPER_INFO
-    fprintf(stderr, "wrapper memalign(%zu, %zu) = ", alignment, size);
-#endif
-    p =  real_memalign(alignment, size);
-#ifdef WRAPPER_INFO
-    fprintf(stderr, "%p\n ", p);
-#endif
-    return p;
+void operator delete[](void* ptr) noexcept {
+    css_free(ptr);
 }
 
-void* calloc(size_t nmemb, size_t size)
-{
-    if(real_calloc==NULL) {
-        mtrace_init();
-    }
+void operator delete(void* ptr, const std::nothrow_t&) noexcept {
+    css_free(ptr);
+}
 
-    void *p = NULL;
-#ifdef WRAPPER_INFO
-    fprintf(stderr, "wrapper calloc(%zu, %zu) = ", nmemb, size);
-#endif
-    p = real_calloc(nmemb, size);
-#ifdef WRAPPER_INFO
-    fprintf(stderr, "%p\n ", p);
-#endif
-    return p;
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept {
+    css_free(ptr);
 }
 
-void* valloc(size_t s) {
-    return css_valloc(s);
+void operator delete(void* ptr, size_t size) noexcept {
+    css_free_sized(ptr, size);
 }
 
-void* aligned_alloc(size_t s, size_t s2) {
-    return css_aligned_alloc(s, s2);
+void operator delete[](void* ptr, size_t size) noexcept {
+    css_free_sized(ptr, size);
 }
 
-void* pvalloc(size_t s) {
-    return css_pvalloc(s);
+void operator delete(void* ptr, std::align_val_t alignment) noexcept {
+    css_free(ptr);
 }
 
-// void *alloca(size_t s) {
-//     return css_alloca(s);
-// }
+void operator delete[](void* ptr, std::align_val_t alignment) noexcept {
+    css_free(ptr);
+}
 
-int posix_memalign(void** ptr, size_t s, size_t s2) {
-#ifdef WRAPPER_INFO
-    fprintf(stderr, "wrapper posix_mamalign (%zu, %zu) = ", s, s2);
-#endif
-    int tmp = css_posix_memalign(ptr, s, s2);
-#ifdef WRAPPER_INFO
-    fprintf(stderr, "%p\n ", *ptr);
-#endif
-    return tmp;
+void operator delete(void* ptr, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    css_free(ptr);
 }
 
-size_t malloc_usable_size(void *ptr)
-{
-    if(real_malloc_usable_size==NULL) {
-        mtrace_init();
-    }
+void operator delete[](void* ptr, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    css_free(ptr);
+}
 
-    size_t s = 0;
-#ifdef WRAPPER_INFO
-    fprintf(stderr, "wrapper malloc_usable_size(%p) = ", ptr);
-#endif
-    s = real_malloc_usable_size(ptr);
-#ifdef WRAPPER_INFO
-    fprintf(stderr, "%zu\n ", s);
-#endif
+void operator delete(void* ptr, size_t size, std::align_val_t alignment) noexcept {
+    css_free_aligned_sized(ptr, (size_t)alignment, size);
+}
 
-    return s;
+void operator delete[](void* ptr, size_t size, std::align_val_t alignment) noexcept {
+    css_free_aligned_sized(ptr, (size_t)alignment, size);
 }
 
 #endif
\ No newline at end of file
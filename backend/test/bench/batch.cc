@@ -0,0 +1,33 @@
+// Allocates and frees N nodes of one loop site, per object and in one batch.
+#include "semalloc.hh"
+#include "bench.hh"
+
+#define MAX_N (1 << 20)
+
+void* nodes[MAX_N];
+
+int main() {
+    size_t csi = 1;
+    for (size_t n = 1000; n <= 1000000; n *= 10) {
+        csi++;
+        double start = now_ms();
+        for (size_t i = 0; i < n; i++) {
+            nodes[i] = css_malloc(loop_size(32, csi));
+        }
+        for (size_t i = 0; i < n; i++) {
+            css_free(nodes[i]);
+        }
+        double elapsed = now_ms() - start;
+        fprintf(stdout, "n=%-8zu ", n);
+        REPORT("per-object", elapsed, n);
+
+        csi++;
+        start = now_ms();
+        css_malloc_batch(n, 32, csi, nodes);
+        css_free_batch(nodes, n);
+        elapsed = now_ms() - start;
+        fprintf(stdout, "n=%-8zu ", n);
+        REPORT("batch", elapsed, n);
+    }
+    return 0;
+}
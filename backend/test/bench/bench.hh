@@ -0,0 +1,22 @@
+#ifndef semalloc_BENCH_HH
+#define semalloc_BENCH_HH
+#include <chrono>
+#include <cstdio>
+#include "defines.hh"
+
+// encode a CSI and the loop bit into the size, the way the instrumented binaries do
+static inline size_t loop_size(size_t size, size_t CSI) {
+    return size | (CSI << 32) | CSI_LOOP_BIT_MASK;
+}
+
+static inline double now_ms() {
+    return std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+#define REPORT(name, ms, n) \
+  do { \
+    fprintf(stdout, "%-32s %10.3f ms %8.2f ns/op\n", name, ms, (ms) * 1e6 / (double)(n)); \
+  } while(0)
+
+#endif //semalloc_BENCH_HH
@@ -0,0 +1,44 @@
+// Allocates a few objects from many loop CSIs and walks them round-robin, so every
+// step touches the head of a different BIBOP. Without coloring all heads share one
+// cache set; compare a run with SEMALLOC_OPTIONS=coloring=0 against the default.
+#include "semalloc.hh"
+#include "bench.hh"
+
+#define CSI_N 256
+#define OBJECT_N 2
+#define ROUND_N 200000
+
+void* objects[CSI_N][OBJECT_N];
+
+int main() {
+    for (size_t csi = 1; csi <= CSI_N; csi++) {
+        // warm up the lazy pool so the CSI gets its own BIBOP
+        for (int i = 0; i < LAZY_OCCUR; i++) {
+            css_free(css_malloc(loop_size(48, csi)));
+        }
+        for (int i = 0; i < OBJECT_N; i++) {
+            objects[csi - 1][i] = css_malloc(loop_size(48, csi));
+        }
+    }
+
+    volatile size_t sink = 0;
+    double start = now_ms();
+    for (int r = 0; r < ROUND_N; r++) {
+        for (int i = 0; i < OBJECT_N; i++) {
+            for (int csi = 0; csi < CSI_N; csi++) {
+                auto* obj = (size_t*)objects[csi][i];
+                obj[0] += r;
+                sink += obj[0];
+            }
+        }
+    }
+    double elapsed = now_ms() - start;
+    REPORT("coloring/round-robin", elapsed, (size_t)ROUND_N * OBJECT_N * CSI_N);
+
+    for (auto& csi : objects) {
+        for (auto* obj : csi) {
+            css_free(obj);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,49 @@
+// Frees a random half of a loop CSI's objects, allocates them again and walks the new
+// objects in allocation order. A LIFO free list hands slots back in free order, the
+// bitmaps hand them back page by page; compare runs with BITMAP_FREE_TRACKING on and off.
+#include <algorithm>
+#include <random>
+#include "semalloc.hh"
+#include "bench.hh"
+
+#define OBJECT_N (1 << 20)
+#define ROUND_N 20
+
+void* objects[OBJECT_N];
+size_t order[OBJECT_N];
+
+int main() {
+    for (size_t i = 0; i < OBJECT_N; i++) {
+        objects[i] = css_malloc(loop_size(48, 1));
+        order[i] = i;
+    }
+
+    std::mt19937_64 rng(42);
+    std::shuffle(order, order + OBJECT_N, rng);
+
+    double start = now_ms();
+    for (size_t i = 0; i < OBJECT_N / 2; i++) {
+        css_free(objects[order[i]]);
+    }
+    for (size_t i = 0; i < OBJECT_N / 2; i++) {
+        objects[order[i]] = css_malloc(loop_size(48, 1));
+    }
+    double elapsed = now_ms() - start;
+    REPORT("locality/free+malloc", elapsed, (size_t)OBJECT_N);
+
+    volatile size_t sink = 0;
+    start = now_ms();
+    for (int r = 0; r < ROUND_N; r++) {
+        for (size_t i = 0; i < OBJECT_N / 2; i++) {
+            auto* obj = (size_t*)objects[order[i]];
+            sink += obj[0]++;
+        }
+    }
+    elapsed = now_ms() - start;
+    REPORT("locality/walk", elapsed, (size_t)ROUND_N * OBJECT_N / 2);
+
+    for (auto* obj : objects) {
+        css_free(obj);
+    }
+    return 0;
+}
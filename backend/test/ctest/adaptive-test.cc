@@ -0,0 +1,50 @@
+#include <stdio.h>
+#include "semalloc.hh"
+#include "test.hh"
+
+#define HOT_N 5000
+
+void* hot[HOT_N];
+
+static bool isGlobal(void* ptr) {
+    return ((RegularHeader*)((uint64_t)ptr - HEADER_SIZE))->controlByte & 0x02;
+}
+
+int main() {
+    // a site allocating once in a while next to a busy one stays in the global bags
+    for (int round = 0; round < 4; round++) {
+        for (auto& ptr : hot) {
+            ptr = css_malloc(LOOP(32, 101));
+        }
+        void* cold = css_malloc(LOOP(32, 100));
+        if (!isGlobal(cold)) {
+            printf("cold site promoted in round %d\n", round);
+            return 1;
+        }
+        if (isGlobal(hot[HOT_N - 1])) {
+            printf("hot site not promoted in round %d\n", round);
+            return 1;
+        }
+        for (auto* ptr : hot) {
+            css_free(ptr);
+        }
+    }
+
+    // a busy site that never has more than one live object is demoted again
+    bool promoted = false;
+    bool demoted = false;
+    for (int i = 0; i < 3 * LAZY_DEMOTE_WINDOW; i++) {
+        void* ptr = css_malloc(LOOP(32, 102));
+        if (!isGlobal(ptr)) {
+            promoted = true;
+        } else if (promoted) {
+            demoted = true;
+        }
+        css_free(ptr);
+    }
+    if (!promoted || !demoted) {
+        printf("promoted %d, demoted %d\n", promoted, demoted);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,72 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "semalloc.hh"
+#include "test.hh"
+
+#define OBJECT_N 200
+
+// only the GLIBC_OVERRIDE build defines it, and only it tags the sizes
+extern "C" size_t malloc_good_size(size_t size) __attribute__((weak));
+
+static RegularHeader* header(void* ptr) {
+    return (RegularHeader*)((uint64_t)ptr - HEADER_SIZE);
+}
+
+static void* __attribute__((noinline)) allocate() {
+    return malloc(48);
+}
+
+// the same malloc, reached from two callers
+static void* __attribute__((noinline)) fromA() {
+    void* ptr = allocate();
+    asm volatile("" ::: "memory");
+    return ptr;
+}
+
+static void* __attribute__((noinline)) fromB() {
+    void* ptr = allocate();
+    asm volatile("" ::: "memory");
+    return ptr;
+}
+
+int main() {
+    if (malloc_good_size == nullptr) {
+        printf("no override, nothing to test\n");
+        return SKIP_RETURN;
+    }
+
+    static void* a[OBJECT_N];
+    static void* b[OBJECT_N];
+    for (size_t i = 0; i < OBJECT_N; i++) {
+        a[i] = fromA();
+        b[i] = fromB();
+    }
+
+    // the repeating sites end up in BIBOPs of their own
+    RegularHeader* lastA = header(a[OBJECT_N - 1]);
+    RegularHeader* lastB = header(b[OBJECT_N - 1]);
+    if (lastA->isGlobal() || lastB->isGlobal()) {
+        printf("repeating site still in the global bags\n");
+        return 1;
+    }
+    if (lastA->CSI == 0 || lastA->CSI == lastB->CSI || header(a[OBJECT_N - 2])->CSI != lastA->CSI) {
+        printf("CSIs %u and %u\n", lastA->CSI, lastB->CSI);
+        return 1;
+    }
+
+    // one allocation of a new site stays global
+    void* once = malloc(48);
+    if (!header(once)->isGlobal()) {
+        printf("single allocation promoted\n");
+        return 1;
+    }
+
+    free(once);
+    for (size_t i = 0; i < OBJECT_N; i++) {
+        free(a[i]);
+        free(b[i]);
+    }
+    printf("auto csi ok\n");
+    return 0;
+}
@@ -0,0 +1,61 @@
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include "semalloc.hh"
+#include "test.hh"
+
+#define N 4096
+void* ptrs[N];
+
+static bool isGlobal(void* ptr) {
+    return ((RegularHeader*)((uint64_t)ptr - HEADER_SIZE))->isGlobal();
+}
+
+int main() {
+    // past the warm-up, so the whole batch comes from the BIBOP of the site
+    for (int i = 0; i < N; i++) {
+        void* ptr = css_malloc(LOOP(40, 7));
+        bool promoted = !isGlobal(ptr);
+        css_free(ptr);
+        if (promoted) {
+            break;
+        }
+    }
+
+    size_t n = css_malloc_batch(N, 40, 7, ptrs);
+    if (n != N) {
+        printf("expected %d objects, got %zu\n", N, n);
+        return 1;
+    }
+
+    for (int i = 0; i < N; i++) {
+        if (ptrs[i] == nullptr || css_malloc_usable_size(ptrs[i]) < 40) {
+            printf("bad object %d: %p\n", i, ptrs[i]);
+            return 1;
+        }
+        memset(ptrs[i], 0xAB, 40);
+    }
+
+    css_free_batch(ptrs, N);
+
+    // the freed slots come back to the same site, before its bump pointer moves
+    std::sort(ptrs, ptrs + N);
+    static void* again[N];
+    if (css_malloc_batch(N, 40, 7, again) != N) {
+        printf("second batch short\n");
+        return 1;
+    }
+    for (int i = 0; i < N; i++) {
+        if (!std::binary_search(ptrs, ptrs + N, again[i])) {
+            printf("%p is not a slot of the freed batch\n", again[i]);
+            return 1;
+        }
+    }
+    std::sort(again, again + N);
+    if (std::adjacent_find(again, again + N) != again + N) {
+        printf("a slot was handed out twice\n");
+        return 1;
+    }
+    css_free_batch(again, N);
+    return 0;
+}
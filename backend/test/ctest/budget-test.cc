@@ -0,0 +1,52 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "semalloc.hh"
+#include "test.hh"
+
+#define OBJECT_N (2 * BUDGET_POLL_ALLOCATIONS)
+
+void* objects[OBJECT_N];
+
+static bool isGlobal(void* ptr) {
+    return ((RegularHeader*)((uint64_t)ptr - HEADER_SIZE))->controlByte & 0x02;
+}
+
+int main() {
+    // the site is promoted early, then steered back into the global bags once the poll sees the RSS
+    for (auto& ptr : objects) {
+        ptr = css_malloc(LOOP(64, 500));
+    }
+    if (!isGlobal(objects[OBJECT_N - 1])) {
+        printf("promoted site still grows under pressure\n");
+        return 1;
+    }
+
+    // and no new site is promoted
+    for (int i = 0; i < 100; i++) {
+        void* ptr = css_malloc(LOOP(64, 501));
+        if (!isGlobal(ptr)) {
+            printf("site promoted under pressure\n");
+            return 1;
+        }
+    }
+
+    // freed pages are returned even below the release threshold
+    auto* page = (char*)css_malloc(4 * PAGE_SIZE);
+    memset(page, 1, 4 * PAGE_SIZE);
+    css_free(page);
+    auto* inner = (char*)(((uint64_t)page + PAGE_SIZE - 1) & ~(uint64_t)(PAGE_SIZE - 1));
+    unsigned char vec[2];
+    mincore(inner, 2 * PAGE_SIZE, vec);
+    if ((vec[0] | vec[1]) & 1) {
+        printf("freed pages still resident\n");
+        return 1;
+    }
+
+    for (auto* ptr : objects) {
+        css_free(ptr);
+    }
+    return 0;
+}
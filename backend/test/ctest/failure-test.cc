@@ -0,0 +1,67 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include "semalloc.hh"
+
+#define HUGE_FAILING ((1UL << 62) | CSI_HUGE_SIZE_BIT_MASK) // no address space holds it
+
+// calloc is the first call of this thread, so it has to set the thread up itself
+static void* firstCalloc(void*) {
+    auto* ptr = (char*)css_calloc(16, 8);
+    bool zeroed = ptr != nullptr && ptr[0] == 0 && ptr[127] == 0;
+    css_free(ptr);
+    return (void*)zeroed;
+}
+
+int main() {
+    pthread_t thread;
+    void* zeroed = nullptr;
+    pthread_create(&thread, nullptr, firstCalloc, nullptr);
+    pthread_join(thread, &zeroed);
+    if (!zeroed) {
+        printf("calloc on a new thread\n");
+        return 1;
+    }
+
+    volatile size_t half = SIZE_MAX / 2;
+    errno = 0;
+    if (css_calloc(half, 4) != nullptr || errno != ENOMEM) {
+        printf("overflowing calloc\n");
+        return 1;
+    }
+
+    // a failed realloc leaves the old block alone
+    auto* old = (char*)css_malloc(64);
+    memset(old, 7, 64);
+    if (css_realloc(old, HUGE_FAILING) != nullptr || old[63] != 7) {
+        printf("failed realloc\n");
+        return 1;
+    }
+    css_free(old);
+
+    void* untouched = &thread;
+    void* ptr = untouched;
+    if (css_posix_memalign(&ptr, 24, 64) != EINVAL || css_posix_memalign(&ptr, 4, 64) != EINVAL
+        || css_posix_memalign(&ptr, 0, 64) != EINVAL || ptr != untouched) {
+        printf("posix_memalign took a bad alignment\n");
+        return 1;
+    }
+    if (css_posix_memalign(&ptr, 64, HUGE_FAILING) != ENOMEM || ptr != untouched
+        || css_posix_memalign_wide(&ptr, 4096, 1UL << 62, 0x1234) != ENOMEM || ptr != untouched) {
+        printf("posix_memalign failed without ENOMEM\n");
+        return 1;
+    }
+    if (css_memalign(48, 64) != nullptr || css_memalign(1UL << 20, HUGE_FAILING) != nullptr) {
+        printf("memalign\n");
+        return 1;
+    }
+
+    if (css_posix_memalign(&ptr, 64, 100) != 0 || (uint64_t)ptr % 64) {
+        printf("posix_memalign\n");
+        return 1;
+    }
+    css_free(ptr);
+    printf("failures ok\n");
+    return 0;
+}
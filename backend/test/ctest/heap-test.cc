@@ -0,0 +1,129 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "semalloc.hh"
+#include "test.hh"
+
+#define N 1000
+#define BIG_N 4096
+#define BIG_SIZE 16000 // BIG_N objects take about 64 MiB
+void* ptrs[N];
+void* other[N];
+void* big[BIG_N];
+
+static size_t residentBytes() {
+    size_t pages = 0, resident = 0;
+    FILE* statm = fopen("/proc/self/statm", "r");
+    if (statm == nullptr || fscanf(statm, "%zu %zu", &pages, &resident) != 2) {
+        return 0;
+    }
+    fclose(statm);
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+static RegularHeader* header(void* ptr) {
+    return (RegularHeader*)((uint64_t)ptr - HEADER_SIZE);
+}
+
+// two heaps at once never share a BIBOP or hand out each other's freed slots
+static int separation() {
+    semalloc_heap* first = semalloc_heap_create();
+    semalloc_heap* second = semalloc_heap_create();
+    if (first == nullptr || second == nullptr || first == second) {
+        printf("no two heaps\n");
+        return 1;
+    }
+
+    for (int i = 0; i < N; i++) {
+        ptrs[i] = semalloc_heap_malloc(first, LOOP(64, 5));
+        other[i] = semalloc_heap_malloc(second, LOOP(64, 5));
+    }
+    for (int i = 0; i < N; i++) {
+        for (int j = 0; j < N; j += 97) {
+            if (header(ptrs[i])->bibop == header(other[j])->bibop) {
+                printf("heaps share the BIBOP %p\n", header(ptrs[i])->bibop);
+                return 1;
+            }
+        }
+        if (header(ptrs[i])->thread_id == header(other[i])->thread_id) {
+            printf("heaps share the owner %u\n", header(ptrs[i])->thread_id);
+            return 1;
+        }
+    }
+
+    void* freed = ptrs[N / 2];
+    semalloc_heap_free(first, freed);
+    void* again = semalloc_heap_malloc(second, LOOP(64, 5));
+    if (again == freed) {
+        printf("the second heap reused a slot of the first\n");
+        return 1;
+    }
+    if (semalloc_heap_malloc(first, LOOP(64, 5)) != freed) {
+        printf("the first heap did not reuse its own slot\n");
+        return 1;
+    }
+
+    semalloc_heap_destroy(first);
+    semalloc_heap_destroy(second);
+    return 0;
+}
+
+// an empty heap costs next to no memory, and destroying a full one gives its memory back
+static int release() {
+    size_t before = residentBytes();
+    semalloc_heap* heap = semalloc_heap_create();
+    size_t created = residentBytes();
+    if (created > before + (4UL << 20)) {
+        printf("an empty heap takes %zu KiB\n", (created - before) >> 10);
+        return 1;
+    }
+
+    for (int i = 0; i < BIG_N; i++) {
+        big[i] = semalloc_heap_malloc(heap, LOOP(BIG_SIZE, 9 + i % 4));
+        memset(big[i], 1, BIG_SIZE);
+    }
+    size_t full = residentBytes();
+    semalloc_heap_destroy(heap);
+    size_t destroyed = residentBytes();
+    if (full < created + (BIG_N * (size_t)BIG_SIZE) / 2 || destroyed > created + (4UL << 20)) {
+        printf("resident: %zu KiB empty, %zu KiB full, %zu KiB destroyed\n",
+               created >> 10, full >> 10, destroyed >> 10);
+        return 1;
+    }
+    return 0;
+}
+
+int main() {
+    if (separation() != 0 || release() != 0) {
+        return 1;
+    }
+
+    for (int round = 0; round < 3; round++) {
+        semalloc_heap* heap = semalloc_heap_create();
+        if (heap == nullptr) {
+            printf("no heap\n");
+            return 1;
+        }
+
+        for (int i = 0; i < N; i++) {
+            ptrs[i] = semalloc_heap_malloc(heap, (16 + i) + (3UL << 32) + 0x4000000000000000UL);
+            memset(ptrs[i], i, 16 + i);
+        }
+        semalloc_heap_free(heap, ptrs[0]);
+
+        // objects of a heap can also be freed through the regular entry point
+        css_free(ptrs[1]);
+
+        void* huge = semalloc_heap_malloc(heap, 1UL << 20);
+        memset(huge, 1, 1UL << 20);
+        void* freed = semalloc_heap_malloc(heap, 1UL << 20);
+        semalloc_heap_free(heap, freed);
+
+        // everything else goes at once
+        semalloc_heap_destroy(heap);
+    }
+
+    void* ptr = css_malloc(32);
+    css_free(ptr);
+    return 0;
+}
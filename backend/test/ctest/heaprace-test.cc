@@ -0,0 +1,69 @@
+#include <stdio.h>
+#include <pthread.h>
+#include "semalloc.hh"
+
+#define ROUND_N 300
+#define OBJECT_N 200
+
+static volatile bool done;
+
+// heaps come and go while the main thread walks and counts every manager
+static void* churn(void*) {
+    for (int round = 0; round < ROUND_N; round++) {
+        semalloc_heap* heap = semalloc_heap_create();
+        for (int i = 0; i < OBJECT_N; i++) {
+            semalloc_heap_malloc(heap, 64 + i);
+        }
+        semalloc_heap_malloc(heap, 2 * BAG_THRESHOLD);
+        semalloc_heap_destroy(heap);
+    }
+    done = true;
+    return nullptr;
+}
+
+static int countSlot(const semalloc_walk_chunk_t*, void*, int, void* arg) {
+    (*(size_t*)arg)++;
+    return 0;
+}
+
+static size_t allocations(const semalloc_stats_t* stats) {
+    size_t n = 0;
+    for (size_t path = 0; path < STAT_PATH_N; path++) {
+        n += stats->mallocN[path];
+    }
+    return n;
+}
+
+int main() {
+    pthread_t thread;
+    pthread_create(&thread, nullptr, churn, nullptr);
+
+    // a destroyed heap's counters move to the retired ones, never both counted nor neither
+    size_t last = 0;
+    size_t walks = 0;
+    while (!done) {
+        semalloc_stats_t stats;
+        semalloc_stats_snapshot(&stats);
+        if (allocations(&stats) < last) {
+            printf("allocations went back from %zu to %zu\n", last, allocations(&stats));
+            return 1;
+        }
+        last = allocations(&stats);
+
+        semalloc_usage_t usage;
+        css_usage(&usage);
+        size_t slots = 0;
+        semalloc_heap_walk(countSlot, &slots);
+        walks++;
+    }
+    pthread_join(thread, nullptr);
+
+    semalloc_stats_t stats;
+    semalloc_stats_snapshot(&stats);
+    if (allocations(&stats) < (size_t)ROUND_N * (OBJECT_N + 1)) {
+        printf("%zu allocations after %d heaps\n", allocations(&stats), ROUND_N);
+        return 1;
+    }
+    printf("%zu walks\n", walks);
+    return 0;
+}
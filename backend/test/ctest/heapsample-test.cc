@@ -0,0 +1,75 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "semalloc.hh"
+#include "test.hh"
+
+#define OBJECT_N 1000
+
+void* objects[OBJECT_N];
+char profile[1 << 20];
+
+// live and cumulative samples of one CSI; the process may sample other allocations too
+static bool readProfile(const char* path, size_t csi, size_t counts[4]) {
+    if (semalloc_heap_profile_dump(path) != 0) {
+        return false;
+    }
+    FILE* f = fopen(path, "r");
+    size_t n = fread(profile, 1, sizeof profile - 1, f);
+    profile[n] = 0;
+    fclose(f);
+    if (strncmp(profile, "heap profile: ", 14) != 0 || strstr(profile, "\nMAPPED_LIBRARIES:\n") == nullptr) {
+        return false;
+    }
+
+    char suffix[32];
+    snprintf(suffix, sizeof suffix, "# csi 0x%zx", csi);
+    memset(counts, 0, 4 * sizeof(size_t));
+    for (char* line = strchr(profile, '\n') + 1; *line != 0 && *line != '\n'; line = strchr(line, '\n') + 1) {
+        size_t bucket[4];
+        char* end = strchr(line, '\n');
+        if (sscanf(line, "%zu: %zu [%zu: %zu] @", &bucket[0], &bucket[1], &bucket[2], &bucket[3]) == 4 &&
+            (size_t)(end - line) > strlen(suffix) && strncmp(end - strlen(suffix), suffix, strlen(suffix)) == 0) {
+            for (int i = 0; i < 4; i++) {
+                counts[i] += bucket[i];
+            }
+        }
+    }
+    return true;
+}
+
+int main() {
+    char path[64];
+    snprintf(path, sizeof path, "/tmp/semalloc-heap-%d.prof", getpid());
+    for (auto& ptr : objects) {
+        ptr = css_malloc(LOOP(1024, 700));
+    }
+    css_free(css_malloc(LOOP(1 << 20, 701)));
+
+    size_t counts[4];
+    size_t huge[4];
+    if (!readProfile(path, 700, counts) || !readProfile(path, 701, huge)) {
+        printf("no heap profile\n%.200s", profile);
+        return 1;
+    }
+    // about one sample per 4K of the 1M allocated, all of them live, and the freed huge object
+    if (counts[2] < 100 || counts[2] > 600 || counts[0] != counts[2] || huge[0] != 0 || huge[2] != 1) {
+        printf("unexpected samples %zu live of %zu, huge %zu of %zu\n", counts[0], counts[2], huge[0], huge[2]);
+        return 1;
+    }
+
+    // frees retire the samples, the cumulative counts stay
+    for (auto& ptr : objects) {
+        css_free(ptr);
+    }
+    size_t after[4];
+    if (!readProfile(path, 700, after) || after[0] != 0 || after[1] != 0 || after[2] != counts[2]) {
+        printf("samples not retired: %zu live\n", after[0]);
+        return 1;
+    }
+    unlink(path);
+
+    printf("heap profile ok, %zu samples\n", counts[2]);
+    return 0;
+}
@@ -0,0 +1,96 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "semalloc.hh"
+#include "test.hh"
+
+#define OBJECT_N 1000
+
+void* objects[OBJECT_N];
+
+struct count_t {
+    size_t allocatedN;
+    size_t slotN;
+};
+
+// the first objects of a loop site go to the global bag, before it is promoted
+static int countSite(const semalloc_walk_chunk_t* chunk, void* ptr, int allocated, void* arg) {
+    auto* count = (count_t*)arg;
+    auto* header = (RegularHeader*)((uint64_t)ptr - HEADER_SIZE);
+    if (chunk->individual ? chunk->CSI == 1000 : allocated && header->CSI == 1000) {
+        count->slotN++;
+        count->allocatedN += allocated;
+    }
+    return 0;
+}
+
+struct find_t {
+    uint64_t target;
+    int allocated;
+};
+
+static int findSlot(const semalloc_walk_chunk_t* chunk, void* ptr, int allocated, void* arg) {
+    auto* find = (find_t*)arg;
+    auto slot = (uint64_t)ptr - HEADER_SIZE;
+    if (find->target >= slot && find->target < slot + chunk->slotSize) {
+        find->allocated = allocated;
+        return 1;
+    }
+    return 0;
+}
+
+static int slotState(void* ptr) {
+    find_t find = {(uint64_t)ptr, -1};
+    return semalloc_heap_walk(findSlot, &find) ? find.allocated : -1;
+}
+
+int main() {
+    for (auto& ptr : objects) {
+        ptr = css_malloc(LOOP(64, 1000));
+    }
+    for (size_t i = 0; i < OBJECT_N; i += 2) {
+        css_free(objects[i]);
+    }
+
+    count_t count = {};
+    semalloc_heap_walk(countSite, &count);
+    if (count.allocatedN != OBJECT_N / 2) {
+        printf("%zu of %zu slots allocated\n", count.allocatedN, count.slotN);
+        return 1;
+    }
+
+    // the aligned object is not at the start of its slot
+    void* aligned = css_memalign(256, 100);
+    if (slotState(aligned) != 1) {
+        printf("aligned object not allocated\n");
+        return 1;
+    }
+    css_free(aligned);
+    if (slotState(aligned) != 0) {
+        printf("aligned object still allocated\n");
+        return 1;
+    }
+
+    char path[64];
+    snprintf(path, sizeof path, "/tmp/semalloc-frag-%d.json", getpid());
+    if (semalloc_fragmentation_report(path) != 0) {
+        printf("no report\n");
+        return 1;
+    }
+    FILE* file = fopen(path, "r");
+    static char report[1 << 20];
+    size_t n = file ? fread(report, 1, sizeof report - 1, file) : 0;
+    report[n] = 0;
+    if (file) {
+        fclose(file);
+    }
+    unlink(path);
+    if (strstr(report, "\"csi\":\"0x3e8\"") == nullptr || strstr(report, "\"totals\"") == nullptr) {
+        printf("site missing from the report\n");
+        return 1;
+    }
+
+    printf("heap walk ok\n");
+    return 0;
+}
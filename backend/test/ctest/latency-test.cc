@@ -0,0 +1,65 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "semalloc.hh"
+#include "test.hh"
+
+#define OBJECT_N 6400
+
+void* objects[OBJECT_N];
+
+static size_t count(const size_t* histogram) {
+    size_t n = 0;
+    for (size_t i = 0; i < LATENCY_BUCKET_N; i++) {
+        n += histogram[i];
+    }
+    return n;
+}
+
+int main() {
+    // a bucket starts at most 1/8 below its values
+    for (uint64_t ticks = 1; ticks < (1UL << 40); ticks = ticks * 3 + 1) {
+        uint64_t low = latencyBucketValue(latencyBucket(ticks));
+        if (low > ticks || (ticks < (1UL << LATENCY_MAX_BIT) && ticks - low > ticks / 8)) {
+            printf("bucket of %lu starts at %lu\n", ticks, low);
+            return 1;
+        }
+    }
+
+    semalloc_stats_t before;
+    semalloc_stats_snapshot(&before);
+
+    for (auto& ptr : objects) {
+        ptr = css_malloc(LOOP(48, 700));
+    }
+    for (auto& ptr : objects) {
+        css_free(ptr);
+    }
+    for (int i = 0; i < 3; i++) {
+        css_free(css_malloc(1 << 20));
+    }
+
+    semalloc_stats_t stats;
+    semalloc_stats_snapshot(&stats);
+    size_t mallocN = count(stats.latency[LATENCY_MALLOC]) - count(before.latency[LATENCY_MALLOC]);
+    size_t freeN = count(stats.latency[LATENCY_FREE]) - count(before.latency[LATENCY_FREE]);
+    if (mallocN < OBJECT_N / LATENCY_SAMPLE_PERIOD || freeN < OBJECT_N / LATENCY_SAMPLE_PERIOD) {
+        printf("%zu mallocs and %zu frees timed\n", mallocN, freeN);
+        return 1;
+    }
+    if (count(stats.latency[LATENCY_HUGE]) - count(before.latency[LATENCY_HUGE]) < 3 ||
+        count(stats.latency[LATENCY_NEW_BIBOP]) - count(before.latency[LATENCY_NEW_BIBOP]) < 1) {
+        printf("slow paths not timed\n");
+        return 1;
+    }
+
+    double p50 = latencyPercentile(stats.latency[LATENCY_MALLOC], stats.tscHz, 0.5);
+    double p99 = latencyPercentile(stats.latency[LATENCY_MALLOC], stats.tscHz, 0.99);
+    if (stats.tscHz == 0 || p50 <= 0 || p99 < p50) {
+        printf("malloc p50 %.0f ns, p99 %.0f ns at %zu Hz\n", p50, p99, stats.tscHz);
+        return 1;
+    }
+
+    printf("latency ok: malloc p50 %.0f ns, p99 %.0f ns\n", p50, p99);
+    return 0;
+}
@@ -0,0 +1,85 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "semalloc.hh"
+#include "test.hh"
+#include "LiveStats.hh"
+
+#define OBJECT_N 1000
+#define REMOTE_N 100
+
+void* objects[OBJECT_N];
+void* remote[REMOTE_N];
+live_page_t page;
+
+static void* freeRemote(void*) {
+    for (auto* ptr : remote) {
+        css_free(ptr);
+    }
+    return nullptr;
+}
+
+// two publications after now
+static bool readFresh(const live_page_t* shared) {
+    usleep(30 * 1000);
+    return liveStatsRead(shared, &page);
+}
+
+static size_t backlog() {
+    size_t n = 0;
+    for (uint32_t i = 0; i < page.threadN; i++) {
+        n += page.threads[i].remoteBacklog;
+    }
+    return n;
+}
+
+int main() {
+    for (auto& ptr : objects) {
+        ptr = css_malloc(LOOP(64, 900));
+    }
+    for (auto& ptr : remote) {
+        ptr = css_malloc(48);
+    }
+    pthread_t thread;
+    pthread_create(&thread, nullptr, freeRemote, nullptr);
+    pthread_join(thread, nullptr);
+
+    char name[32];
+    liveStatsName(name, getpid());
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        printf("no segment %s\n", name);
+        return 1;
+    }
+    auto* shared = (const live_page_t*)mmap(nullptr, sizeof(live_page_t), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (shared == MAP_FAILED || memcmp(shared->magic, LIVE_STATS_MAGIC, 8) != 0 || !readFresh(shared)) {
+        printf("bad page\n");
+        return 1;
+    }
+
+    // the remote frees wait for this thread's next malloc
+    if (page.threadN < 2 || backlog() < REMOTE_N || page.rss == 0) {
+        printf("%u threads, backlog %zu, rss %zu\n", page.threadN, backlog(), page.rss);
+        return 1;
+    }
+    bool found = false;
+    for (uint32_t i = 0; i < page.siteN; i++) {
+        found |= page.sites[i].CSI == 900 && page.sites[i].inUse >= OBJECT_N * 64;
+    }
+    if (!found || page.bags[BIBOP::computeSizeIndex(64)].usage.inUse < OBJECT_N * 64) {
+        printf("loop site or its bag missing\n");
+        return 1;
+    }
+
+    css_free(css_malloc(48));
+    if (!readFresh(shared) || backlog() != 0) {
+        printf("backlog %zu after the drain\n", backlog());
+        return 1;
+    }
+
+    printf("live stats ok\n");
+    return 0;
+}
@@ -7,7 +7,7 @@ void* ptr;
 
 int main() {
     for (int i = 0; i < 10; i++) {
-        ptr = css_malloc(16 + i + 0xF000000000000000UL);
+        ptr = css_malloc(16 + i + 0x7000000000000000UL);
         css_free(ptr);
     }
     return 0;
@@ -0,0 +1,78 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+#include "semalloc.hh"
+#include "test.hh"
+
+// only the GLIBC_OVERRIDE build defines it
+extern "C" size_t malloc_good_size(size_t size) __attribute__((weak));
+
+static bool ours(void* ptr) {
+    auto* header = (RegularHeader*)((uint64_t)ptr - HEADER_SIZE);
+    return header->isAllocation() && css_malloc_usable_size(ptr) >= 1;
+}
+
+int main() {
+    if (malloc_good_size == nullptr) {
+        printf("no override, nothing to test\n");
+        return SKIP_RETURN;
+    }
+
+    void* pointers[] = {
+            ::operator new(40),
+            ::operator new[](40),
+            ::operator new(40, std::nothrow),
+            ::operator new[](40, std::nothrow),
+            ::operator new(0),
+            malloc(40),
+            calloc(4, 10),
+            valloc(40),
+            reallocarray(nullptr, 4, 10),
+    };
+    for (auto* ptr : pointers) {
+        if (ptr == nullptr || !ours(ptr)) {
+            printf("%p is not a semalloc object\n", ptr);
+            return 1;
+        }
+    }
+    ::operator delete(pointers[0]);
+    ::operator delete[](pointers[1]);
+    ::operator delete(pointers[2], std::nothrow);
+    ::operator delete[](pointers[3], std::nothrow);
+    ::operator delete(pointers[4], (size_t)0);
+    for (size_t i = 5; i < sizeof pointers / sizeof pointers[0]; i++) {
+        free(pointers[i]);
+    }
+
+    // large sizes and large alignments go past BAG_THRESHOLD once memalign over-allocates
+    size_t sizes[] = {100, BAG_THRESHOLD / 2, 120000, 2 * BAG_THRESHOLD};
+    for (size_t alignment = 32; alignment <= (1UL << 20); alignment <<= 1) {
+        for (size_t size : sizes) {
+            void* aligned = ::operator new(size, std::align_val_t(alignment));
+            void* quiet = ::operator new[](size, std::align_val_t(alignment), std::nothrow);
+            void* posix = nullptr;
+            if ((uint64_t)aligned % alignment || (uint64_t)quiet % alignment ||
+                posix_memalign(&posix, alignment, size) != 0 || (uint64_t)posix % alignment) {
+                printf("%zu bytes not aligned to %zu\n", size, alignment);
+                return 1;
+            }
+            memset(aligned, 1, size);
+            memset(quiet, 2, size);
+            ::operator delete(aligned, size, std::align_val_t(alignment));
+            ::operator delete[](quiet, std::align_val_t(alignment), std::nothrow);
+            free(posix);
+        }
+    }
+
+    volatile size_t huge = SIZE_MAX / 2;
+    if (reallocarray(nullptr, huge, 4) != nullptr) {
+        printf("overflowing reallocarray succeeded\n");
+        return 1;
+    }
+
+    auto* object = new int[16]();
+    delete[] object;
+    printf("new and delete ok\n");
+    return 0;
+}
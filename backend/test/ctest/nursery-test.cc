@@ -0,0 +1,86 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "semalloc.hh"
+#include "test.hh"
+
+#define ROUND_N 4096
+#define LONG_N 8192 // more than a region of 256K holds
+
+static RegularHeader* header(void* ptr) {
+    return (RegularHeader*)((uint64_t)ptr - HEADER_SIZE);
+}
+
+static SingleBIBOP* bibopOf(void* ptr) {
+    return (SingleBIBOP*)header(ptr)->bibop;
+}
+
+int main() {
+    // two objects per round, both dead by its end
+    void* first = nullptr;
+    void* last = nullptr;
+    for (size_t i = 0; i < ROUND_N; i++) {
+        auto* a = (uint64_t*)css_malloc(LOOP(64, 77));
+        auto* b = (uint64_t*)css_malloc(LOOP(64, 77));
+        *a = i;
+        *b = ~i;
+        if (*a != i) {
+            printf("objects of a round overlap\n");
+            return 1;
+        }
+        if (i == ROUND_N - 2) {
+            first = a;
+        }
+        if (i == ROUND_N - 1) {
+            last = a;
+        }
+        css_free(b);
+        css_free(a);
+    }
+    SingleBIBOP* bibop = bibopOf(last);
+    if (header(last)->isGlobal() || !bibop->inNursery()) {
+        printf("short-lived site is no nursery\n");
+        return 1;
+    }
+    if (first != last) {
+        printf("nursery not reset: %p then %p\n", first, last);
+        return 1;
+    }
+
+    // objects that outlive the prediction take the BIBOP back to its free list
+    static uint64_t* kept[LONG_N];
+    for (size_t i = 0; i < LONG_N; i++) {
+        kept[i] = (uint64_t*)css_malloc(LOOP(64, 77));
+        if (kept[i] == nullptr) {
+            printf("allocation %zu failed\n", i);
+            return 1;
+        }
+        *kept[i] = i;
+    }
+    if (bibop->inNursery()) {
+        printf("nursery kept long-lived objects\n");
+        return 1;
+    }
+    for (size_t i = 0; i < LONG_N; i++) {
+        if (*kept[i] != i) {
+            printf("object %zu overwritten\n", i);
+            return 1;
+        }
+        css_free(kept[i]);
+    }
+
+    // a site with many live objects is watched and stays off
+    static void* many[ROUND_N];
+    for (size_t i = 0; i < ROUND_N; i++) {
+        many[i] = css_malloc(LOOP(64, 78));
+    }
+    for (size_t i = 0; i < ROUND_N; i++) {
+        css_free(many[i]);
+    }
+    if (bibopOf(many[ROUND_N - 1])->inNursery()) {
+        printf("long-lived site became a nursery\n");
+        return 1;
+    }
+    printf("nursery ok\n");
+    return 0;
+}
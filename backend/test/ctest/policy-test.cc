@@ -0,0 +1,54 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "semalloc.hh"
+#include "test.hh"
+#include "SitePolicy.hh"
+
+static bool isGlobal(void* ptr) {
+    return ((RegularHeader*)((uint64_t)ptr - HEADER_SIZE))->controlByte & 0x02;
+}
+
+int main(int argc, char** argv) {
+    const char* path = "policy-test.pol";
+    if (argc > 1 && strcmp(argv[1], "write") == 0) {
+        // policies are read before the first manager is set up, so the policy-test-file fixture
+        // writes them before the test runs
+        int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+        site_policy_header_t header = {{'S', 'E', 'M', 'P', 'O', 'L', '0', '1'}, 2, 0};
+        site_policy_entry_t entries[2] = {
+                {5, 5, 0xFFFF, SITE_DEDICATED | SITE_PREFAULT},
+                {6, 6, 0xFFFF, SITE_GLOBAL},
+        };
+        write(fd, &header, sizeof header);
+        write(fd, entries, sizeof entries);
+        close(fd);
+        return 0;
+    }
+    unlink(path);
+
+    // any recursion hash of site 5 skips the warm-up
+    void* dedicated = css_malloc(LOOP(32, 5 | (3 << 16)));
+    if (isGlobal(dedicated)) {
+        printf("dedicated site went to the global bags\n");
+        return 1;
+    }
+
+    for (int i = 0; i < 10; i++) {
+        void* ptr = css_malloc(LOOP(32, 6));
+        if (!isGlobal(ptr)) {
+            printf("global site got promoted after %d allocations\n", i);
+            return 1;
+        }
+    }
+
+    // the default still warms up
+    void* lazy = css_malloc(LOOP(32, 7));
+    if (!isGlobal(lazy)) {
+        printf("default site skipped the warm-up\n");
+        return 1;
+    }
+    return 0;
+}
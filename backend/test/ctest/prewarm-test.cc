@@ -0,0 +1,67 @@
+#include <stdio.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "semalloc.hh"
+#include "test.hh"
+
+#define WARM_N 1000
+
+void* objects[WARM_N];
+
+static size_t residentPages(void* start, size_t length) {
+    uint64_t begin = (uint64_t)start & ~(uint64_t)(PAGE_SIZE - 1);
+    size_t pageN = ((uint64_t)start + length - begin + PAGE_SIZE - 1) / PAGE_SIZE;
+    unsigned char vec[pageN];
+    mincore((void*)begin, pageN * PAGE_SIZE, vec);
+
+    size_t n = 0;
+    for (size_t i = 0; i < pageN; i++) {
+        n += vec[i] & 1;
+    }
+    return n;
+}
+
+int main() {
+    // a prewarmed site is promoted at once and its next objects are resident before they are used
+    if (semalloc_prewarm(300, 200, WARM_N) != WARM_N) {
+        printf("prewarm did not cover the request\n");
+        return 1;
+    }
+
+    void* first = css_malloc(LOOP(200, 300));
+    auto* header = (RegularHeader*)((uint64_t)first - HEADER_SIZE);
+    if (header->controlByte & 0x02) {
+        printf("prewarmed site is not promoted\n");
+        return 1;
+    }
+
+    size_t span = WARM_N * 256;
+    size_t resident = residentPages(header, span);
+    size_t expected = (span + PAGE_SIZE - 1) / PAGE_SIZE;
+    if (resident < expected) {
+        printf("%zu of %zu pages resident\n", resident, expected);
+        return 1;
+    }
+
+    // a size with the CSI bits of its malloc request warms the same bag, a huge one nothing
+    if (semalloc_prewarm(301, LOOP(200, 301), 10) != 10) {
+        printf("prewarm did not strip the CSI bits\n");
+        return 1;
+    }
+    if (semalloc_prewarm(0, CSI_HUGE_SIZE_BIT_MASK + (1UL << 32) + 200, 10) != 0) {
+        printf("prewarm took a huge size for a small one\n");
+        return 1;
+    }
+
+    // the pinned site is never demoted, however few objects it keeps
+    css_free(first);
+    for (int i = 0; i < 3 * LAZY_DEMOTE_WINDOW; i++) {
+        void* ptr = css_malloc(LOOP(200, 300));
+        if (((RegularHeader*)((uint64_t)ptr - HEADER_SIZE))->controlByte & 0x02) {
+            printf("pinned site demoted\n");
+            return 1;
+        }
+        css_free(ptr);
+    }
+    return 0;
+}
@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <string.h>
+#include "semalloc.hh"
+#include "test.hh"
+
+// every probe Probes.hh documents, with its argument count
+static const struct {
+    const char* name;
+    int argN;
+} probes[] = {
+        {"new_bibop", 3}, {"extend_bibop", 3}, {"pool_exhausted", 2}, {"huge_map", 3},
+        {"huge_unmap", 2}, {"promote", 3}, {"demote", 2}, {"nursery", 2},
+        {"nursery_leave", 2}, {"drain", 2}, {"release", 2},
+};
+#define PROBE_N (sizeof probes / sizeof probes[0])
+
+static bool libraryPath(char* path, size_t size) {
+    FILE* maps = fopen("/proc/self/maps", "r");
+    if (maps == nullptr) {
+        return false;
+    }
+    char line[4096];
+    bool found = false;
+    while (!found && fgets(line, sizeof line, maps)) {
+        char* file = strchr(line, '/');
+        if (file != nullptr && strstr(file, "libsemalloc") != nullptr) {
+            file[strcspn(file, "\n")] = '\0';
+            snprintf(path, size, "%s", file);
+            found = true;
+        }
+    }
+    fclose(maps);
+    return found;
+}
+
+int main() {
+#if !defined(USDT_PROBES) || !(defined(__x86_64__) || defined(__aarch64__))
+    printf("probes are compiled out\n");
+    return SKIP_RETURN;
+#else
+    // a call into the library keeps it linked and mapped
+    css_free(css_malloc(32));
+    char path[4096];
+    if (!libraryPath(path, sizeof path)) {
+        printf("libsemalloc is not mapped\n");
+        return 1;
+    }
+
+    char command[4200];
+    snprintf(command, sizeof command, "readelf -n '%s' 2>/dev/null", path);
+    FILE* notes = popen(command, "r");
+    if (notes == nullptr) {
+        return SKIP_RETURN;
+    }
+
+    // the notes of the provider, as sdt tools read them: Provider, Name, Location and Base, Arguments
+    int seen[PROBE_N] = {};
+    char line[1024];
+    bool ours = false;
+    int current = -1;
+    unsigned long base = 0;
+    size_t noteN = 0;
+    while (fgets(line, sizeof line, notes)) {
+        char value[256];
+        unsigned long location, noteBase;
+        const char* field;
+        if ((field = strstr(line, "Provider: ")) != nullptr && sscanf(field, "Provider: %255s", value) == 1) {
+            ours = strcmp(value, "semalloc") == 0;
+            current = -1;
+        } else if (ours && (field = strstr(line, "Name: ")) != nullptr && sscanf(field, "Name: %255s", value) == 1) {
+            for (size_t i = 0; i < PROBE_N; i++) {
+                if (strcmp(value, probes[i].name) == 0) {
+                    current = (int)i;
+                }
+            }
+            if (current < 0) {
+                printf("undocumented probe %s\n", value);
+                return 1;
+            }
+            noteN++;
+        } else if (ours && current >= 0 && (field = strstr(line, "Location: ")) != nullptr &&
+                   sscanf(field, "Location: %lx, Base: %lx", &location, &noteBase) == 2) {
+            // one base for the whole object, or the tools compute a wrong load offset
+            if (location == 0 || noteBase == 0 || (base != 0 && noteBase != base)) {
+                printf("probe %s at %lx, base %lx\n", probes[current].name, location, noteBase);
+                return 1;
+            }
+            base = noteBase;
+        } else if (ours && current >= 0 && strstr(line, "Arguments:") != nullptr) {
+            int argN = 0;
+            for (const char* arg = strstr(line, "8@"); arg != nullptr; arg = strstr(arg + 2, "8@")) {
+                argN++;
+            }
+            if (argN != probes[current].argN) {
+                printf("probe %s has %d arguments, not %d\n", probes[current].name, argN, probes[current].argN);
+                return 1;
+            }
+            seen[current]++;
+        }
+    }
+    if (pclose(notes) != 0 && noteN == 0) {
+        printf("no readelf\n");
+        return SKIP_RETURN;
+    }
+
+    for (size_t i = 0; i < PROBE_N; i++) {
+        if (seen[i] == 0) {
+            printf("probe %s is missing from .note.stapsdt\n", probes[i].name);
+            return 1;
+        }
+    }
+    return 0;
+#endif
+}
@@ -0,0 +1,107 @@
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "semalloc.hh"
+#include "test.hh"
+
+#define SITE(size, csi) ((size) + ((size_t)(csi) << 32))
+#define OBJECT_N 1000
+
+void* objects[OBJECT_N];
+char profile[1 << 16];
+
+static pthread_t mainThread;
+static volatile bool signalling;
+
+static void* signaller(void*) {
+    while (signalling) {
+        pthread_kill(mainThread, SIGUSR2);
+        usleep(100);
+    }
+    return nullptr;
+}
+
+// SIGUSR2 that lands while its thread holds the managers exclusively must not wait for them
+static int destroyUnderSignals() {
+    mainThread = pthread_self();
+    signalling = true;
+    pthread_t thread;
+    pthread_create(&thread, nullptr, signaller, nullptr);
+    for (int i = 0; i < 300; i++) {
+        semalloc_heap* heap = semalloc_heap_create();
+        semalloc_heap_free(heap, semalloc_heap_malloc(heap, 64));
+        semalloc_heap_destroy(heap);
+    }
+    signalling = false;
+    pthread_join(thread, nullptr);
+    return 0;
+}
+
+int main() {
+    char path[64];
+    if (!testOption("profile", path, sizeof path)) {
+        printf("no profile option\n");
+        return 1;
+    }
+
+    for (auto& ptr : objects) {
+        ptr = css_malloc(LOOP(64, 600));
+    }
+    for (int i = 0; i < 400; i++) {
+        css_free(objects[i]);
+    }
+    void* huge = css_malloc(SITE(256 << 10, 601));
+    css_free(huge);
+    // the free of an aligned object finds the site in the header at the start of its slot
+    css_free(css_memalign(256, SITE(100, 602)));
+
+    // the dump thread writes the profile; wait for the end of the JSON
+    unlink(path);
+    raise(SIGUSR2);
+    size_t n = 0;
+    for (int i = 0; i < 500 && (n < 3 || strcmp(profile + n - 3, "]}\n") != 0); i++) {
+        usleep(10000);
+        FILE* f = fopen(path, "r");
+        if (f != nullptr) {
+            n = fread(profile, 1, sizeof profile - 1, f);
+            profile[n] = 0;
+            fclose(f);
+        }
+    }
+    if (n == 0) {
+        printf("no profile written\n");
+        return 1;
+    }
+    unlink(path);
+
+    // ranked by bytes: the huge site first
+    const char* first = strstr(profile, "\"csi\"");
+    if (first == nullptr || strncmp(first, "\"csi\":\"0x259\"", 13) != 0) {
+        printf("huge site not ranked first\n%s", profile);
+        return 1;
+    }
+    const char* expected[] = {
+            "{\"csi\":\"0x258\",\"loop\":true,\"mallocs\":1000,\"frees\":400,\"bytes\":80000,\"live\":600,\"peak_live\":1000",
+            "\"csi\":\"0x259\",\"loop\":false,\"mallocs\":1,\"frees\":1,",
+            "\"csi\":\"0x25a\",\"loop\":false,\"mallocs\":1,\"frees\":1,\"bytes\":",
+    };
+    for (auto* site : expected) {
+        if (strstr(profile, site) == nullptr) {
+            printf("missing %s\n%s", site, profile);
+            return 1;
+        }
+    }
+    if (strstr(profile, "\"bibops\":1,\"chunks\":1,\"sizes\":{\"64\":") == nullptr) {
+        printf("loop site has no BIBOP\n%s", profile);
+        return 1;
+    }
+
+    if (destroyUnderSignals() != 0) {
+        return 1;
+    }
+    printf("profile ok\n");
+    return 0;
+}
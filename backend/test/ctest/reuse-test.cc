@@ -0,0 +1,50 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include "semalloc.hh"
+
+#define N 1000
+#define CHUNK_N 400 // objects of 2000 bytes, more than three chunks of 256K
+void* ptrs[N];
+void* chunked[CHUNK_N];
+
+int main() {
+    // freed slots of a loop BIBOP are handed out again before the bump pointer moves
+    for (int i = 0; i < N; i++) {
+        ptrs[i] = css_malloc(32 + 0x4000000500000000UL);
+    }
+    void* victim = ptrs[N / 2];
+    css_free(victim);
+
+    void* again = css_malloc(32 + 0x4000000500000000UL);
+    if (again != victim) {
+        printf("expected %p, got %p\n", victim, again);
+        return 1;
+    }
+
+    for (int i = 0; i < N; i++) {
+        css_free(ptrs[i]);
+    }
+
+    // the same holds for slots of chunks the BIBOP has moved on from; the first allocations
+    // warm the site up in the global bags
+    for (int i = 0; i < N; i++) {
+        ptrs[i] = css_malloc(2000 + 0x4000000600000000UL);
+        if (i >= N - CHUNK_N) {
+            chunked[i - (N - CHUNK_N)] = ptrs[i];
+        }
+    }
+    for (int i = 0; i < CHUNK_N / 2; i++) {
+        css_free(chunked[i]);
+    }
+    std::sort(chunked, chunked + CHUNK_N / 2);
+    for (int i = 0; i < CHUNK_N / 2; i++) {
+        void* reused = css_malloc(2000 + 0x4000000600000000UL);
+        if (!std::binary_search(chunked, chunked + CHUNK_N / 2, reused)) {
+            printf("object %d of an earlier chunk not reused, got %p\n", i, reused);
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,79 @@
+#include <stdio.h>
+#include <pthread.h>
+#include "semalloc.hh"
+#include "test.hh"
+
+#define WARM_N 64
+
+void* warm[WARM_N];
+
+static bool isGlobal(void* ptr) {
+    return ((RegularHeader*)((uint64_t)ptr - HEADER_SIZE))->controlByte & 0x02;
+}
+
+static void* worker(void* result) {
+    // the first allocation of a site the main thread promoted skips the warm-up
+    void* known = css_malloc(LOOP(48, 200));
+    void* unknown = css_malloc(LOOP(48, 201));
+    void* otherClass = css_malloc(LOOP(1000, 202)); // promoted with 48-byte objects
+    *(int*)result = !isGlobal(known) && isGlobal(unknown) && isGlobal(otherClass);
+    css_free(known);
+    css_free(unknown);
+    css_free(otherClass);
+    return nullptr;
+}
+
+static void* demotedWorker(void* result) {
+    // the demotion on the main thread retracted the promotion, the site warms up again
+    void* demoted = css_malloc(LOOP(48, 203));
+    *(int*)result = isGlobal(demoted);
+    css_free(demoted);
+    return nullptr;
+}
+
+int main() {
+    for (auto& ptr : warm) {
+        ptr = css_malloc(LOOP(48, 200));
+    }
+    for (int i = 0; i < WARM_N; i++) {
+        css_free(css_malloc(LOOP(48, 202)));
+    }
+    if (isGlobal(warm[WARM_N - 1])) {
+        printf("site not promoted on the main thread\n");
+        return 1;
+    }
+
+    int result = 0;
+    pthread_t thread;
+    pthread_create(&thread, nullptr, worker, &result);
+    pthread_join(thread, nullptr);
+    if (!result) {
+        printf("promotion not inherited by the new thread\n");
+        return 1;
+    }
+
+    for (auto* ptr : warm) {
+        css_free(ptr);
+    }
+
+    // a busy site that never has more than one live object is promoted, then demoted
+    bool promoted = false;
+    bool demoted = false;
+    for (int i = 0; i < 3 * LAZY_DEMOTE_WINDOW && !demoted; i++) {
+        void* ptr = css_malloc(LOOP(48, 203));
+        promoted |= !isGlobal(ptr);
+        demoted = promoted && isGlobal(ptr);
+        css_free(ptr);
+    }
+    if (!demoted) {
+        printf("site not demoted on the main thread (promoted %d)\n", promoted);
+        return 1;
+    }
+    pthread_create(&thread, nullptr, demotedWorker, &result);
+    pthread_join(thread, nullptr);
+    if (!result) {
+        printf("demotion not inherited by the new thread\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,38 @@
+#include <stdio.h>
+#include <string.h>
+#include "semalloc.hh"
+
+int main() {
+    // an allocation of the good size lands in the slot the good size promises
+    for (size_t size = 1; size < (1UL << 20); size = size * 3 / 2 + 1) {
+        size_t good = css_good_size(size);
+        void* ptr = css_malloc(good);
+        if (good < size || css_malloc_usable_size(ptr) != good) {
+            printf("size %zu: good %zu, usable %zu\n", size, good, css_malloc_usable_size(ptr));
+            return 1;
+        }
+        css_free_sized(ptr, good);
+    }
+
+    void* ptr = css_memalign(64, 100);
+    css_free_aligned_sized(ptr, 64, 100);
+
+    // across BAG_THRESHOLD the over-allocation of memalign turns huge, the mapping is aligned instead
+    for (size_t alignment = 16; alignment <= (1UL << 20); alignment <<= 2) {
+        for (size_t size = BAG_THRESHOLD / 4; size <= 2 * BAG_THRESHOLD; size += BAG_THRESHOLD / 4 + 1696) {
+            void* sized = css_memalign(alignment, size);
+            void* posix = nullptr;
+            int error = css_posix_memalign(&posix, alignment, size);
+            if (sized == nullptr || error != 0 || (uint64_t)sized % alignment || (uint64_t)posix % alignment
+                || css_malloc_usable_size(sized) < size || css_malloc_usable_size(posix) < size) {
+                printf("alignment %zu, size %zu: %p and %p\n", alignment, size, sized, posix);
+                return 1;
+            }
+            memset(sized, 1, size);
+            memset(posix, 2, size);
+            css_free_aligned_sized(sized, alignment, size);
+            css_free(posix);
+        }
+    }
+    return 0;
+}
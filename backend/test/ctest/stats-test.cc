@@ -0,0 +1,51 @@
+#include <stdio.h>
+#include <pthread.h>
+#include "semalloc.hh"
+#include "test.hh"
+
+#define OBJECT_N 1000
+
+static void* worker(void*) {
+    void* objects[OBJECT_N];
+    for (auto& ptr : objects) {
+        ptr = css_malloc(100);
+    }
+    for (auto* ptr : objects) {
+        css_free(ptr);
+    }
+    return nullptr;
+}
+
+int main() {
+    // main takes its manager first, a worker exiting before that would hand main its own
+    css_free(css_malloc(16));
+    semalloc_stats_t before;
+    semalloc_stats_snapshot(&before);
+
+    // the counters of a thread are summed while it may still be running
+    pthread_t thread;
+    pthread_create(&thread, nullptr, worker, nullptr);
+    for (int i = 0; i < OBJECT_N; i++) {
+        css_free(css_malloc(LOOP(100, 600)));
+    }
+    css_free(css_malloc(2 * BAG_THRESHOLD));
+    pthread_join(thread, nullptr);
+
+    semalloc_stats_t after;
+    semalloc_stats_snapshot(&after);
+
+    size_t global = after.mallocN[STAT_GLOBAL] - before.mallocN[STAT_GLOBAL];
+    size_t loop = after.mallocN[STAT_LAZY] + after.mallocN[STAT_INDIVIDUAL] -
+                  before.mallocN[STAT_LAZY] - before.mallocN[STAT_INDIVIDUAL];
+    size_t sizeClass = after.classN[BIBOP::computeSizeIndex(100)] - before.classN[BIBOP::computeSizeIndex(100)];
+    size_t frees = after.freeN + after.remoteFreeN - before.freeN - before.remoteFreeN;
+    if (global < OBJECT_N || loop < OBJECT_N || sizeClass < 2 * OBJECT_N || frees < 2 * OBJECT_N ||
+        after.mallocN[STAT_HUGE] - before.mallocN[STAT_HUGE] < 1 ||
+        after.mallocBytes[STAT_GLOBAL] - before.mallocBytes[STAT_GLOBAL] < OBJECT_N * (100 + HEADER_SIZE) ||
+        after.managerN < 2) {
+        printf("global %zu, loop %zu, class %zu, frees %zu, managers %zu\n",
+               global, loop, sizeClass, frees, after.managerN);
+        return 1;
+    }
+    return 0;
+}
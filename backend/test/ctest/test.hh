@@ -0,0 +1,32 @@
+#ifndef semalloc_TEST_HH
+#define semalloc_TEST_HH
+#include <stdlib.h>
+#include <string.h>
+#include "defines.hh"
+
+// a size carrying a loop CSI, the way the instrumented binaries pass it
+#define LOOP(size, csi) ((size) + ((size_t)(csi) << 32) + CSI_LOOP_BIT_MASK)
+
+#define SKIP_RETURN 77 // SKIP_RETURN_CODE in CMakeLists.txt
+
+// the value of an option in the SEMALLOC_OPTIONS CMakeLists.txt runs the test with
+static inline bool testOption(const char* key, char* value, size_t size) {
+    const char* options = getenv("SEMALLOC_OPTIONS");
+    size_t keyLength = strlen(key);
+    for (const char* option = options; option != nullptr; option = strchr(option, ',')) {
+        option += *option == ',';
+        if (strncmp(option, key, keyLength) == 0 && option[keyLength] == '=') {
+            const char* start = option + keyLength + 1;
+            size_t length = strcspn(start, ",");
+            if (length >= size) {
+                return false;
+            }
+            memcpy(value, start, length);
+            value[length] = 0;
+            return true;
+        }
+    }
+    return false;
+}
+
+#endif //semalloc_TEST_HH
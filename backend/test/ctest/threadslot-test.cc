@@ -0,0 +1,86 @@
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "semalloc.hh"
+
+#define ROUND_N (3 * MAX_THREAD)
+#define HEAP_N 100
+
+void* left[ROUND_N];
+void* heapObjects[HEAP_N];
+
+static RegularHeader* header(void* ptr) {
+    return (RegularHeader*)((uint64_t)ptr - HEADER_SIZE);
+}
+
+// a short-lived thread: some churn, and one object it leaves behind
+static void* shortLived(void* arg) {
+    for (int i = 0; i < 100; i++) {
+        css_free(css_malloc(48));
+    }
+    *(void**)arg = css_malloc(48);
+    return nullptr;
+}
+
+static pthread_barrier_t allStarted;
+
+static void* blocked(void*) {
+    css_free(css_malloc(48));
+    pthread_barrier_wait(&allStarted);
+    return nullptr;
+}
+
+int main() {
+    semalloc_heap* heap = semalloc_heap_create();
+    for (auto& ptr : heapObjects) {
+        ptr = semalloc_heap_malloc(heap, 64);
+    }
+    uint16_t heapID = header(heapObjects[0])->thread_id;
+
+    // exited threads leave their managers to the next ones, so many more threads than slots run
+    for (auto& ptr : left) {
+        pthread_t thread;
+        if (pthread_create(&thread, nullptr, shortLived, &ptr) != 0 || pthread_join(thread, nullptr) != 0) {
+            printf("thread failed\n");
+            return 1;
+        }
+        if (header(ptr)->thread_id >= MAX_THREAD) {
+            printf("thread took manager %u, a heap slot\n", header(ptr)->thread_id);
+            return 1;
+        }
+    }
+    for (auto* ptr : left) {
+        css_free(ptr);
+    }
+
+    // and the heap kept its manager
+    for (auto* ptr : heapObjects) {
+        if (header(ptr)->thread_id != heapID || heapID < MAX_THREAD) {
+            printf("heap object moved from manager %u to %u\n", heapID, header(ptr)->thread_id);
+            return 1;
+        }
+        semalloc_heap_free(heap, ptr);
+    }
+    semalloc_heap_destroy(heap);
+
+    // more threads alive at once than there are slots stop the process with a message
+    pid_t child = fork();
+    if (child == 0) {
+        pthread_barrier_init(&allStarted, nullptr, MAX_THREAD + 1);
+        pthread_t threads[MAX_THREAD];
+        for (auto& thread : threads) {
+            pthread_create(&thread, nullptr, blocked, nullptr);
+        }
+        pthread_barrier_wait(&allStarted);
+        _exit(0);
+    }
+    int status;
+    waitpid(child, &status, 0);
+    if (!WIFSIGNALED(status) || WTERMSIG(status) != SIGABRT) {
+        printf("thread %d did not abort\n", MAX_THREAD + 1);
+        return 1;
+    }
+    return 0;
+}
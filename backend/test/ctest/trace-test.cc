@@ -0,0 +1,76 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "semalloc.hh"
+#include "test.hh"
+#include "Trace.hh"
+
+#define N 100000
+#define SIZE 48
+#define SITE 7
+
+static void* ptrs[N];
+
+int main() {
+    char path[64];
+    if (!testOption("trace", path, sizeof path)) {
+        printf("no trace option\n");
+        return 1;
+    }
+
+    for (int i = 0; i < N; i++) {
+        ptrs[i] = css_malloc(SIZE + ((size_t)SITE << 32));
+    }
+    for (int i = 0; i < N; i++) {
+        css_free(ptrs[i]);
+    }
+    // writes the header, as the exit would
+    EventTrace::Stop();
+
+    FILE* file = fopen(path, "rb");
+    if (file == nullptr) {
+        printf("no trace, the library is built without LOG_TO_FILE\n");
+        return SKIP_RETURN;
+    }
+    struct stat st;
+    fstat(fileno(file), &st);
+    unlink(path);
+
+    trace_header_t header;
+    if (fread(&header, sizeof header, 1, file) != 1 ||
+        memcmp(header.magic, TRACE_MAGIC, sizeof header.magic) != 0 ||
+        header.eventSize != sizeof(trace_event_t)) {
+        printf("bad trace header\n");
+        return 1;
+    }
+    if (header.tscHz == 0 || (size_t)st.st_size != sizeof header + header.eventN * sizeof(trace_event_t)) {
+        printf("trace not finished: %lu Hz, %lu events in %ld bytes\n", header.tscHz, header.eventN, st.st_size);
+        return 1;
+    }
+
+    // every event is either in the file or counted as dropped; an override build also traces
+    // what libc allocates
+    uint64_t mallocN = 0;
+    trace_event_t event;
+    for (uint64_t i = 0; i < header.eventN; i++) {
+        if (fread(&event, sizeof event, 1, file) != 1) {
+            printf("event %lu missing\n", i);
+            return 1;
+        }
+        if (event.type == TRACE_MALLOC && event.CSI == SITE) {
+            if (event.size != SIZE || event.ptr == 0 || event.path == TRACE_PATH_NONE) {
+                printf("malloc event %lu: size %u, ptr %lx, path %u\n", i, event.size, event.ptr, event.path);
+                return 1;
+            }
+            mallocN++;
+        }
+    }
+    fclose(file);
+
+    if (mallocN > N || header.eventN + header.droppedN < 2 * N) {
+        printf("%lu mallocs of %lu events, %lu dropped\n", mallocN, header.eventN, header.droppedN);
+        return 1;
+    }
+    return 0;
+}
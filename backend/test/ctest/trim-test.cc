@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include "semalloc.hh"
+
+#define OBJECT_N 48 // less than a bitmap run, which free would purge
+#define OBJECT_SIZE (3 * PAGE_SIZE) // below the release threshold, so free keeps the pages
+
+static size_t residentPages(void** objects) {
+    size_t n = 0;
+    for (int i = 0; i < OBJECT_N; i++) {
+        // the whole pages inside the object
+        auto start = ((uint64_t)objects[i] + PAGE_SIZE - 1) & ~(uint64_t)(PAGE_SIZE - 1);
+        unsigned char vec[2];
+        mincore((void*)start, 2 * PAGE_SIZE, vec);
+        n += (vec[0] & 1) + (vec[1] & 1);
+    }
+    return n;
+}
+
+static void fill(void** objects) {
+    for (int i = 0; i < OBJECT_N; i++) {
+        objects[i] = css_malloc(OBJECT_SIZE);
+        memset(objects[i], 1, OBJECT_SIZE);
+    }
+}
+
+void* remote[OBJECT_N];
+volatile int stage;
+
+static void* worker(void*) {
+    fill(remote);
+    for (auto* ptr : remote) {
+        css_free(ptr);
+    }
+    stage = 1;
+    while (stage != 2);
+    // the trim request of the main thread is served here
+    css_free(css_malloc(16));
+    stage = 3;
+    return nullptr;
+}
+
+void* exited[OBJECT_N];
+
+static void* exitingWorker(void*) {
+    fill(exited);
+    for (auto* ptr : exited) {
+        css_free(ptr);
+    }
+    return nullptr;
+}
+
+int main() {
+    void* objects[OBJECT_N];
+    fill(objects);
+    void* huge = css_malloc(4 * BAG_THRESHOLD);
+
+    semalloc_usage_t before;
+    css_usage(&before);
+    if (before.global.inUse < OBJECT_N * OBJECT_SIZE || before.huge.blocks < 1 ||
+        before.huge.arena < 4 * BAG_THRESHOLD) {
+        printf("usage misses the live objects\n");
+        return 1;
+    }
+
+    for (auto* ptr : objects) {
+        css_free(ptr);
+    }
+    css_free(huge);
+
+    semalloc_usage_t after;
+    css_usage(&after);
+    if (before.global.inUse - after.global.inUse < OBJECT_N * OBJECT_SIZE ||
+        after.global.free < OBJECT_N * OBJECT_SIZE || after.huge.blocks != before.huge.blocks - 1) {
+        printf("usage misses the frees\n");
+        return 1;
+    }
+
+    if (residentPages(objects) == 0) {
+        printf("free already released the pages\n");
+        return 1;
+    }
+    if (css_trim() != 1 || residentPages(objects) != 0) {
+        printf("local trim left %zu pages\n", residentPages(objects));
+        return 1;
+    }
+
+    // another thread's pages go once it allocates again
+    pthread_t thread;
+    pthread_create(&thread, nullptr, worker, nullptr);
+    while (stage != 1);
+    if (residentPages(remote) == 0) {
+        printf("remote free already released the pages\n");
+        return 1;
+    }
+    css_trim();
+    stage = 2;
+    while (stage != 3);
+    pthread_join(thread, nullptr);
+    if (residentPages(remote) != 0) {
+        printf("remote trim left %zu pages\n", residentPages(remote));
+        return 1;
+    }
+
+    // nobody allocates on the manager of an exited thread or on an unused heap, css_trim trims them
+    pthread_create(&thread, nullptr, exitingWorker, nullptr);
+    pthread_join(thread, nullptr);
+    semalloc_heap* heap = semalloc_heap_create();
+    void* heapObjects[OBJECT_N];
+    for (auto& ptr : heapObjects) {
+        ptr = semalloc_heap_malloc(heap, OBJECT_SIZE);
+        memset(ptr, 1, OBJECT_SIZE);
+    }
+    for (auto* ptr : heapObjects) {
+        semalloc_heap_free(heap, ptr);
+    }
+    if (residentPages(exited) == 0 || residentPages(heapObjects) == 0) {
+        printf("exit or heap free already released the pages\n");
+        return 1;
+    }
+    if (css_trim() != 1 || residentPages(exited) != 0 || residentPages(heapObjects) != 0) {
+        printf("idle trim left %zu pages of the exited thread, %zu of the heap\n",
+               residentPages(exited), residentPages(heapObjects));
+        return 1;
+    }
+    semalloc_heap_destroy(heap);
+    return 0;
+}
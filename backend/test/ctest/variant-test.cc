@@ -0,0 +1,47 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "semalloc.hh"
+#include "test.hh"
+
+#define OBJECT_N 100
+
+void* objects[OBJECT_N];
+
+int main() {
+    // neither the counters nor the lazy pool are in the variant css_malloc is bound to
+    if (AllocPolicy::Select() & (ALLOC_COUNTED | ALLOC_LAZY)) {
+        printf("variant %u\n", AllocPolicy::Select());
+        return 1;
+    }
+
+    // without the lazy pool the first object of a loop already has its BIBOP
+    for (auto& ptr : objects) {
+        ptr = css_malloc(LOOP(64, 800));
+    }
+    for (auto* ptr : objects) {
+        if (((RegularHeader*)((uint64_t)ptr - HEADER_SIZE))->isGlobal()) {
+            printf("loop object %p in a global bag\n", ptr);
+            return 1;
+        }
+    }
+    for (auto* ptr : objects) {
+        css_free(ptr);
+    }
+
+    semalloc_stats_t stats;
+    semalloc_stats_snapshot(&stats);
+    for (size_t path = 0; path < STAT_PATH_N; path++) {
+        if (stats.mallocN[path]) {
+            printf("%zu mallocs counted on path %zu\n", stats.mallocN[path], path);
+            return 1;
+        }
+    }
+    if (stats.freeN) {
+        printf("%zu frees counted\n", stats.freeN);
+        return 1;
+    }
+
+    printf("variant ok\n");
+    return 0;
+}
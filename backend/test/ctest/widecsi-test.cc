@@ -0,0 +1,121 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "semalloc.hh"
+#include "CallSite.hh"
+
+#define OBJECT_N 200
+
+// two sites the narrow encoding merges: the same low 16 bits of CSTV and the same recursion hash
+#define CONTEXT_A (0x10005UL | (3UL << 48) | WIDE_CONTEXT_LOOP_BIT)
+#define CONTEXT_B (0x20005UL | (3UL << 48) | WIDE_CONTEXT_LOOP_BIT)
+
+// contexts whose mixed keys share the top bits land on one probe run; the last one overflows it
+static uint64_t collidingContext(size_t i) {
+    uint64_t inverse = AUTO_CSI_MULTIPLIER;
+    for (size_t k = 0; k < 5; k++) {
+        inverse *= 2 - AUTO_CSI_MULTIPLIER * inverse;
+    }
+    // keep only keys with the empty-slot bit set, the loop bit clear and the top recursion-hash bit set
+    for (uint64_t low = i << 20;; low++) {
+        uint64_t key = ((0x2AAAAAUL << 42) | low) * inverse;
+        if ((key >> 61) == 0b101) {
+            return key;
+        }
+    }
+}
+
+static RegularHeader* header(void* ptr) {
+    return (RegularHeader*)((uint64_t)ptr - HEADER_SIZE);
+}
+
+int main() {
+    if (CSIDirectory::narrow(CONTEXT_A) != CSIDirectory::narrow(CONTEXT_B)) {
+        printf("narrow CSIs differ\n");
+        return 1;
+    }
+
+    static void* a[OBJECT_N];
+    static void* b[OBJECT_N];
+    for (size_t i = 0; i < OBJECT_N; i++) {
+        a[i] = css_malloc_wide(48, CONTEXT_A);
+        b[i] = css_malloc_wide(48, CONTEXT_B);
+    }
+
+    RegularHeader* lastA = header(a[OBJECT_N - 1]);
+    RegularHeader* lastB = header(b[OBJECT_N - 1]);
+    if (lastA->isGlobal() || lastB->isGlobal() || lastA->bibop == lastB->bibop) {
+        printf("wide sites share a BIBOP\n");
+        return 1;
+    }
+    if (lastA->CSI < WIDE_CSI_BASE || lastA->CSI == lastB->CSI || header(a[OBJECT_N - 2])->CSI != lastA->CSI) {
+        printf("CSIs %u and %u\n", lastA->CSI, lastB->CSI);
+        return 1;
+    }
+
+    semalloc_csi_directory_stats_t stats;
+    semalloc_csi_directory_stats(&stats);
+    if (stats.contexts != 2 || stats.narrowShared != 1 || stats.overflowN != 0) {
+        printf("directory stats %zu %zu %zu\n", stats.contexts, stats.narrowShared, stats.overflowN);
+        return 1;
+    }
+
+    // a context that finds no slot keeps its narrow CSI, but never one from the dense range
+    uint32_t last = 0;
+    for (size_t i = 0; i <= CSI_DIRECTORY_PROBE_N; i++) {
+        last = CSIDirectory::lookup(collidingContext(i));
+    }
+    semalloc_csi_directory_stats(&stats);
+    if (stats.overflowN != 1 || last >= WIDE_CSI_BASE ||
+        last != CSIDirectory::narrow(collidingContext(CSI_DIRECTORY_PROBE_N))) {
+        printf("overflowed context got CSI %u (%zu overflows)\n", last, stats.overflowN);
+        return 1;
+    }
+
+    // a narrow site with the top recursion-hash bit set stays apart from the first wide site
+    static void* narrowSite[OBJECT_N];
+    for (auto& ptr : narrowSite) {
+        ptr = css_malloc(48 + ((size_t)(1U << 29) << 32) + CSI_LOOP_BIT_MASK);
+    }
+    if (header(narrowSite[OBJECT_N - 1])->CSI == lastA->CSI ||
+        header(narrowSite[OBJECT_N - 1])->bibop == lastA->bibop) {
+        printf("narrow CSI %u shares the wide site\n", header(narrowSite[OBJECT_N - 1])->CSI);
+        return 1;
+    }
+    for (auto* ptr : narrowSite) {
+        css_free(ptr);
+    }
+
+    // the rest of the family takes the same context
+    auto* grown = (char*)css_realloc_wide(nullptr, 16, CONTEXT_A);
+    grown[15] = 'x';
+    grown = (char*)css_realloc_wide(grown, 4096, CONTEXT_A);
+    void* zeroed = css_calloc_wide(8, 8, CONTEXT_B);
+    void* aligned = css_memalign_wide(256, 100, CONTEXT_B);
+    if (grown[15] != 'x' || ((char*)zeroed)[63] != 0 || (uint64_t)aligned % 256) {
+        printf("wide realloc, calloc or memalign broken\n");
+        return 1;
+    }
+    volatile size_t huge = SIZE_MAX / 2;
+    if (css_calloc_wide(huge, 4, CONTEXT_A) != nullptr) {
+        printf("overflowing calloc succeeded\n");
+        return 1;
+    }
+
+    // no 4 GiB cap: the size is not shared with the CSI
+    void* big = css_malloc_wide((5UL << 30), CONTEXT_A & ~WIDE_CONTEXT_LOOP_BIT);
+    if (big != nullptr && css_malloc_usable_size(big) < (5UL << 30)) {
+        printf("wide size truncated to %zu\n", css_malloc_usable_size(big));
+        return 1;
+    }
+
+    css_free(big);
+    css_free(aligned);
+    css_free(zeroed);
+    css_free(grown);
+    for (size_t i = 0; i < OBJECT_N; i++) {
+        css_free(a[i]);
+        css_free(b[i]);
+    }
+    printf("wide csi ok\n");
+    return 0;
+}
@@ -0,0 +1,75 @@
+#!/usr/bin/env python3
+"""
+Compile a text policy description into the policy file semalloc maps at start-up
+(SEMALLOC_OPTIONS=policy=FILE).
+
+One rule per line, the first matching rule wins, '#' starts a comment:
+
+    CSI[-CSI_HIGH][/MASK]  POLICY[,POLICY...]
+
+    0x1234                 dedicated          # exact CSI, including the recursion hash
+    0x1234/0xFFFF          dedicated,prefault # any recursion hash of call site 0x1234
+    0x2000-0x2FFF/0xFFFF   global
+    0x40                   hugepage
+
+Policies: global, dedicated, prefault, hugepage.
+"""
+import struct
+import sys
+
+MAGIC = b"SEMPOL01"
+POLICIES = {"global": 1, "dedicated": 2, "prefault": 4, "hugepage": 8}
+FULL_MASK = 0x3FFFFFFF
+
+
+def parse_rule(line, number):
+    fields = line.split()
+    if len(fields) != 2:
+        raise ValueError(f"line {number}: expected 'CSI POLICY'")
+
+    sites, policies = fields
+    mask = FULL_MASK
+    if "/" in sites:
+        sites, mask_text = sites.split("/")
+        mask = int(mask_text, 0)
+
+    if "-" in sites:
+        low_text, high_text = sites.split("-")
+        low, high = int(low_text, 0), int(high_text, 0)
+    else:
+        low = high = int(sites, 0)
+
+    policy = 0
+    for name in policies.split(","):
+        if name not in POLICIES:
+            raise ValueError(f"line {number}: unknown policy '{name}'")
+        policy |= POLICIES[name]
+
+    if policy & POLICIES["global"] and policy & POLICIES["dedicated"]:
+        raise ValueError(f"line {number}: global and dedicated exclude each other")
+    return low & mask, high & mask, mask, policy
+
+
+def main():
+    if len(sys.argv) != 3:
+        print(f"usage: {sys.argv[0]} RULES.txt OUTPUT.pol", file=sys.stderr)
+        return 1
+
+    rules = []
+    with open(sys.argv[1]) as f:
+        for number, line in enumerate(f, 1):
+            line = line.split("#")[0].strip()
+            if line:
+                rules.append(parse_rule(line, number))
+
+    with open(sys.argv[2], "wb") as f:
+        f.write(MAGIC + struct.pack("<II", len(rules), 0))
+        for rule in rules:
+            f.write(struct.pack("<IIII", *rule))
+
+    print(f"{len(rules)} rules written to {sys.argv[2]}")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,73 @@
+#!/usr/bin/env python3
+"""
+Decode the binary event trace semalloc writes when it is built with LOG_TO_FILE
+and started with SEMALLOC_OPTIONS=trace=FILE.
+
+    semalloc-trace.py TRACE.bin            # CSV on stdout
+    semalloc-trace.py --json TRACE.bin     # one JSON object per line
+
+Timestamps and latencies are raw TSC ticks in the file; they are converted to
+nanoseconds with the tick rate the allocator records when the trace stops.
+"""
+import json
+import struct
+import sys
+
+MAGIC = b"SEMTRC01"
+HEADER = struct.Struct("<8sIIQQQ24x")
+EVENT = struct.Struct("<QQQIIIHBBB7x")
+TYPES = ["malloc", "free", "realloc"]
+PATHS = ["global", "individual", "huge", "remote", "none"]
+FIELDS = ["time_ns", "type", "thread", "ptr", "size", "csi", "path", "size_class", "bibop", "latency_ns"]
+
+
+def read_events(path):
+    with open(path, "rb") as f:
+        magic, event_size, _, tsc_hz, event_n, dropped_n = HEADER.unpack(f.read(HEADER.size))
+        if magic != MAGIC or event_size != EVENT.size:
+            raise ValueError(f"{path}: not a semalloc trace")
+
+        scale = 1e9 / tsc_hz if tsc_hz else 1.0
+        data = f.read(event_n * EVENT.size)
+
+    # each thread flushes its own ring, so the file is only ordered per thread
+    events = sorted(EVENT.iter_unpack(data[:len(data) - len(data) % EVENT.size]))
+    first = events[0][0] if events else 0
+    for tsc, ptr, bibop, size, csi, latency, thread, kind, where, size_class in events:
+        yield {
+            "time_ns": int((tsc - first) * scale),
+            "type": TYPES[kind] if kind < len(TYPES) else kind,
+            "thread": thread,
+            "ptr": hex(ptr),
+            "size": size,
+            "csi": hex(csi),
+            "path": PATHS[where] if where < len(PATHS) else where,
+            "size_class": size_class,
+            "bibop": hex(bibop),
+            "latency_ns": int(latency * scale),
+        }
+
+    if dropped_n:
+        print(f"{path}: {dropped_n} events dropped", file=sys.stderr)
+
+
+def main():
+    args = sys.argv[1:]
+    as_json = "--json" in args
+    args = [arg for arg in args if arg != "--json"]
+    if len(args) != 1:
+        print(f"usage: {sys.argv[0]} [--json] TRACE.bin", file=sys.stderr)
+        return 1
+
+    if not as_json:
+        print(",".join(FIELDS))
+    for event in read_events(args[0]):
+        if as_json:
+            print(json.dumps(event))
+        else:
+            print(",".join(str(event[field]) for field in FIELDS))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
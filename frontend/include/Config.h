@@ -58,6 +58,22 @@ const map<string, uint16_t> HeapFunctionSizeParameterIndex = {
 #define HUGE_BIT_REVERSE 0x7FFFFFFFFFFFFFFFUL
 #define CSI_MASK         0x0000FFFF00000000UL
 
+// Pass the site to the runtime as a separate 64-bit context instead of the upper half of the size:
+// no 4 GiB cap, and 48 bits of CSTV instead of CSI_BIT. The context is laid out like the upper half
+// of a narrow size, CSTV in the low bits, recursion hash and loop bit where they are above.
+//#define WIDE_CSI
+#define WIDE_CSTV_MASK   0x0000FFFFFFFFFFFFUL
+const map<string, string> WideHeapFunctions = {
+        {"malloc", "css_malloc_wide"},
+        {"realloc", "css_realloc_wide"},
+        {"calloc", "css_calloc_wide"},
+        {"posix_memalign", "css_posix_memalign_wide"},
+        {"memalign", "css_memalign_wide"},
+        {"_Znwm", "css_new_wide"},
+        {"_Znam", "css_new_wide"},
+        {"aligned_alloc", "css_memalign_wide"}
+};
+
 const string CSTrackVariableName = "semallocCSTrack";
 const string CSSRecursiveStackName = "CSSRecursiveStack";
 const string CSSRecursiveOffsetTrackName = "CSSRecursiveOffsetTrack";
@@ -91,6 +91,12 @@ private:
 
     void UpdateHMFInterface();
 
+#ifdef WIDE_CSI
+    // Replace one HMF call with its wide-CSI entry point, the context as an extra last argument
+    void UpdateHMFCallWide(CallPath* CalledInstance, const string& FunctionName, llvm::Constant* CSTrackVariable,
+                           llvm::Constant* CSSRecursiveHash, llvm::Constant* CSSLoopLayerTrack);
+#endif
+
     // Find all functions that calls HMF
     void MarkOnlyRelevantFunctions();
 
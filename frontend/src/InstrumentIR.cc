@@ -456,6 +456,10 @@ void InstrumentIRPass::UpdateHMFInterface() {
 
         // function marked
         for (auto CalledInstance: *(*this->FunctionMap)[FunctionName]) {
+#ifdef WIDE_CSI
+            UpdateHMFCallWide(CalledInstance, FunctionName, CSTrackVariable, CSSRecursiveHash, CSSLoopLayerTrack);
+            continue;
+#endif
             uint16_t SizeParamIndex = HeapFunctionSizeParameterIndex.find(FunctionName)->second;
             llvm::Value* SizeParam = CalledInstance->call_inst->getOperand(SizeParamIndex);
 
@@ -528,6 +532,46 @@ void InstrumentIRPass::UpdateHMFInterface() {
 }
 
 
+#ifdef WIDE_CSI
+void InstrumentIRPass::UpdateHMFCallWide(CallPath* CalledInstance, const string& FunctionName,
+                                         llvm::Constant* CSTrackVariable, llvm::Constant* CSSRecursiveHash,
+                                         llvm::Constant* CSSLoopLayerTrack) {
+    auto* Call = llvm::dyn_cast<llvm::CallBase>(CalledInstance->call_inst);
+    auto* Int64Ty = llvm::Type::getInt64Ty(M->getContext());
+    llvm::IRBuilder<> builder(Call);
+
+    // context = RH + (CSTV & WIDE_CSTV_MASK), with the loop bit if any loop layer is open
+    auto* loadRH = builder.CreateLoad(Int64Ty, CSSRecursiveHash, "loadRH");
+    auto* loadCSTV = builder.CreateLoad(Int64Ty, CSTrackVariable, "loadCSTV");
+    auto* maskCSTV = builder.CreateAnd(loadCSTV, llvm::ConstantInt::get(Int64Ty, WIDE_CSTV_MASK), "mask_cstv");
+    auto* context = builder.CreateAdd(loadRH, maskCSTV, "context");
+    auto* loadLoop = builder.CreateLoad(Int64Ty, CSSLoopLayerTrack, "loadLoop");
+    auto* loopCondition = builder.CreateICmpNE(loadLoop, llvm::ConstantInt::get(Int64Ty, 0), "conditionLoop");
+    auto* markLoopBit = builder.CreateOr(context, llvm::ConstantInt::get(Int64Ty, LOOP_BIT), "mask_loop");
+    auto* wideContext = builder.CreateSelect(loopCondition, markLoopBit, context, "wide_context");
+
+    // the original arguments and the context, to the entry point of WideHeapFunctions
+    vector<llvm::Value*> Args(Call->arg_begin(), Call->arg_end());
+    Args.push_back(wideContext);
+    vector<llvm::Type*> Params(Call->getFunctionType()->param_begin(), Call->getFunctionType()->param_end());
+    Params.push_back(Int64Ty);
+    auto* WideType = llvm::FunctionType::get(Call->getFunctionType()->getReturnType(), Params, false);
+    auto WideCallee = M->getOrInsertFunction(WideHeapFunctions.find(FunctionName)->second, WideType);
+
+    llvm::CallBase* WideCall;
+    if (auto* Invoke = llvm::dyn_cast<llvm::InvokeInst>(Call)) {
+        WideCall = builder.CreateInvoke(WideCallee, Invoke->getNormalDest(), Invoke->getUnwindDest(), Args);
+    } else {
+        WideCall = builder.CreateCall(WideCallee, Args);
+    }
+    WideCall->takeName(Call);
+    Call->replaceAllUsesWith(WideCall);
+    Call->eraseFromParent();
+    CalledInstance->call_inst = WideCall;
+}
+#endif
+
+
 void InstrumentIRPass::FlipFunctionMap() {
     /*
      * Create a map: Caller -> Callee